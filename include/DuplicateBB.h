@@ -11,13 +11,12 @@
 #define LLVM_TUTOR_DUPLICATE_BB_H
 
 #include "RIV.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/PassManager.h"
-#include "llvm/IR/ValueMap.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/Pass.h"
 
-#include <map>
-
 //------------------------------------------------------------------------------
 // New PM interface
 //------------------------------------------------------------------------------
@@ -27,23 +26,30 @@ struct DuplicateBB : public llvm::PassInfoMixin<DuplicateBB> {
 
   // Maps BB, a BasicBlock, to one integer value (defined in a different
   // BasicBlock) that's reachable in BB. The Value that BB is mapped to is used
-  // in the `if-then-else` construct when cloning BB.
+  // in the `if-then-else` construct when cloning BB. Cloning replaces values
+  // with PHI nodes (via RAUW), which the value handles follow.
   using BBToSingleRIVMap =
-      std::vector<std::tuple<llvm::BasicBlock *, llvm::Value *>>;
-  // Maps a Value before duplication to a Phi node that merges the
-  // corresponding values after duplication/cloning.
-  using ValueToPhiMap = std::map<llvm::Value *, llvm::Value *>;
+      std::vector<std::tuple<llvm::BasicBlock *, llvm::WeakTrackingVH>>;
 
   // Creates a BBToSingleRIVMap of BasicBlocks that are suitable for cloning.
   BBToSingleRIVMap findBBsToDuplicate(llvm::Function &F,
                                       const RIV::Result &RIVResult);
 
+  // Returns the Candidates that fit into the code size and cycle budgets
+  // (-duplicate-bb-size-budget and -duplicate-bb-cycle-budget). The blocks
+  // are considered from the coldest to the hottest (according to BFI), so hot
+  // blocks are the first to be left out. The order of Candidates is kept.
+  BBToSingleRIVMap applyBudgets(llvm::Function &F,
+                                BBToSingleRIVMap Candidates,
+                                const llvm::BlockFrequencyInfo &BFI);
+
   // Clones the input basic block:
   //  * injects an `if-then-else` construct using ContextValue
   //  * duplicates BB
   //  * adds PHI nodes as required
+  //  * updates RIVResult, so that it remains valid
   void cloneBB(llvm::BasicBlock &BB, llvm::Value *ContextValue,
-               ValueToPhiMap &ReMapper);
+               RIV::Result &RIVResult);
 
   unsigned DuplicateBBCount = 0;
 
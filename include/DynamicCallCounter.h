@@ -14,6 +14,8 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
+#include <cstdint>
+
 //------------------------------------------------------------------------------
 // New PM interface
 //------------------------------------------------------------------------------
@@ -39,4 +41,37 @@ struct LegacyDynamicCallCounter : public llvm::ModulePass {
   DynamicCallCounter Impl;
 };
 
+//------------------------------------------------------------------------------
+// Binary profile format
+//------------------------------------------------------------------------------
+// With -dynamic-cc-output=binary, the instrumented module appends the
+// following record to the profile file when it exits (integers are stored in
+// the byte order of the target, `dynamic-cc-merge` expects little-endian):
+//    char     Magic[8];      // ProfileMagic (without the trailing NUL)
+//    uint32_t Version;       // ProfileVersion
+//    uint32_t Flags;         // ProfileFlag* (e.g. what the counters count)
+//    uint64_t NumCounters;
+//    uint64_t NamesSize;
+//    char     Names[NamesSize];   // NumCounters NUL-terminated names, padded
+//                                 // with NULs to a multiple of 8 bytes
+//    uint64_t Counters[NumCounters];
+// A profile file may contain any number of such records. Every run appends
+// one record per snapshot (see -dynamic-cc-snapshot-*) plus one when it exits.
+// Use `dynamic-cc-merge` (tools/DynamicCCMerge.cpp) to read and merge them.
+namespace dynamic_cc {
+constexpr char ProfileMagic[] = "LTDCCPRF";
+constexpr uint32_t ProfileVersion = 3;
+// Set if the counters are basic block executions (-dynamic-cc-mode=blocks)
+// rather than function calls
+constexpr uint32_t ProfileFlagBlocks = 1u << 0;
+// Set if the counters only cover the period since the previous record of the
+// same run (-dynamic-cc-snapshot-delta). Otherwise, they are the totals since
+// the run started, i.e. only the last record of every run counts.
+constexpr uint32_t ProfileFlagDelta = 1u << 1;
+// Set on the first record written by every run
+constexpr uint32_t ProfileFlagRunStart = 1u << 2;
+// The size of the fixed-size part of every record
+constexpr uint64_t ProfileHeaderSize = 32;
+} // namespace dynamic_cc
+
 #endif
@@ -0,0 +1,43 @@
+//========================================================================
+// FILE:
+//    FunctionRNG.h
+//
+// DESCRIPTION:
+//   Declares class FunctionRNG, the random number generator shared by the
+//   obfuscation passes (DuplicateBB, MBAAdd and MBARewrite).
+//
+//   Every pass gets a separate stream for every function. The stream depends
+//   only on the seed (LLVM's -rng-seed option), the name of the input file,
+//   the pass and the function (see Module::createRNG). So the output doesn't
+//   depend on the order in which functions are visited (e.g. when these are
+//   processed in parallel) and is reproducible from build to build.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_FUNCTION_RNG_H
+#define LLVM_TUTOR_FUNCTION_RNG_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/RandomNumberGenerator.h"
+
+#include <memory>
+
+class FunctionRNG {
+public:
+  // Creates the stream for PassName (e.g. "duplicate-bb") in F
+  FunctionRNG(const llvm::Function &F, llvm::StringRef PassName);
+
+  // Returns a uniformly distributed integer in [0, Bound). Bound must be
+  // non-zero.
+  uint64_t nextBelow(uint64_t Bound);
+  // Returns a uniformly distributed double in [0., 1.)
+  double nextDouble();
+
+private:
+  // The std:: distributions are not used, as their results differ between
+  // the implementations of the standard library
+  std::unique_ptr<llvm::RandomNumberGenerator> RNG;
+};
+
+#endif // LLVM_TUTOR_FUNCTION_RNG_H
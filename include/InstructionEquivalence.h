@@ -0,0 +1,51 @@
+//========================================================================
+// FILE:
+//    InstructionEquivalence.h
+//
+// DESCRIPTION:
+//   Declares helpers for deciding whether two pieces of code (e.g. two basic
+//   blocks or two functions) are identical:
+//    * areEquivalentInstructions - compares two instructions
+//    * hashInstruction/hashValue - structural hashes that are equal for
+//      equivalent instructions
+//   The helpers are shared by MergeBB and MergeFunctions.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_INSTRUCTION_EQUIVALENCE_H
+#define LLVM_TUTOR_INSTRUCTION_EQUIVALENCE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/IR/Instruction.h"
+
+// Maps the values (instructions, basic blocks, arguments) from one piece of
+// code to the values at the same positions in another piece of code
+using CounterpartMap = llvm::DenseMap<const llvm::Value *, const llvm::Value *>;
+
+// Assigns the values that are local to the code being hashed (e.g. the
+// instructions in a basic block) their positions. Local values differ between
+// identical pieces of code, so they are hashed by position rather than by
+// address.
+using LocalValueIds = llvm::DenseMap<const llvm::Value *, unsigned>;
+
+// Returns true if Inst1 and Inst2 perform the same operation on the same
+// operands. Operands are the same if they are identical or if Counterparts
+// maps Inst2's operand to Inst1's operand. For PHI nodes, the incoming blocks
+// are compared in the same way. The optional flags (e.g. nsw and fast-math
+// flags) and the attached metadata (other than debug locations) must match
+// too.
+bool areEquivalentInstructions(const llvm::Instruction *Inst1,
+                               const llvm::Instruction *Inst2,
+                               const CounterpartMap &Counterparts);
+
+// Hashes V by its position (if it's in LocalIds) or by its address
+llvm::hash_code hashValue(const llvm::Value *V, const LocalValueIds &LocalIds);
+
+// Hashes the opcode, the type and the operands of Inst (see hashValue).
+// Equivalent instructions (with consistently numbered local values) have
+// equal hashes.
+llvm::hash_code hashInstruction(const llvm::Instruction &Inst,
+                                const LocalValueIds &LocalIds);
+
+#endif // LLVM_TUTOR_INSTRUCTION_EQUIVALENCE_H
@@ -10,6 +10,8 @@
 #ifndef LLVM_TUTOR_MBA_ADD_H
 #define LLVM_TUTOR_MBA_ADD_H
 
+#include "MBABudget.h"
+
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
@@ -19,12 +21,21 @@
 struct MBAAdd : public llvm::PassInfoMixin<MBAAdd> {
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &);
-  bool runOnBasicBlock(llvm::BasicBlock &B);
+  // Replaces the `add` instructions in F (a random subset, see -mba-ratio).
+  // TTI and BFI are only used (and then required) with -mba-add-budgeted.
+  bool runOnFunction(llvm::Function &F,
+                     const llvm::TargetTransformInfo *TTI = nullptr,
+                     const llvm::BlockFrequencyInfo *BFI = nullptr);
 
   // Without isRequired returning true, this pass will be skipped for functions
   // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
   // all functions with optnone.
   static bool isRequired() { return true; }
+
+  // The overhead budget (with -mba-add-budgeted). The module budget is shared
+  // by all the functions that this instance is run on (for -passes=mba-add, a
+  // new instance is created for every module, see MBABudgetModuleAdaptor).
+  MBABudget Budget;
 };
 
 //------------------------------------------------------------------------------
@@ -33,7 +44,10 @@ struct MBAAdd : public llvm::PassInfoMixin<MBAAdd> {
 struct LegacyMBAAdd : public llvm::FunctionPass {
   static char ID;
   LegacyMBAAdd() : FunctionPass(ID) {}
+  // Resets the module budget
+  bool doInitialization(llvm::Module &M) override;
   bool runOnFunction(llvm::Function &F) override;
+  void getAnalysisUsage(llvm::AnalysisUsage &Info) const override;
 
   MBAAdd Impl;
 };
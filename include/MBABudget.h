@@ -0,0 +1,104 @@
+//========================================================================
+// FILE:
+//    MBABudget.h
+//
+// DESCRIPTION:
+//   Declares class MBABudget, the cost model based budget shared by the MBA
+//   passes (MBAAdd and MBASub).
+//
+//   The overhead of every rewrite is estimated with TargetTransformInfo (the
+//   cost of the instructions built by the identity minus the cost of the
+//   original instruction). The rewrites are then kept from the coldest
+//   instruction to the hottest one (according to BlockFrequencyInfo), as long
+//   as they fit into the budgets.
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_MBA_BUDGET_H
+#define LLVM_TUTOR_MBA_BUDGET_H
+
+#include "MBAIdentities.h"
+
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InstructionCost.h"
+
+#include <optional>
+#include <string>
+
+class MBABudget {
+public:
+  // The budgets (see MBABudgetOptions)
+  struct Limits {
+    // The maximum code growth per function, in percent of its size
+    // (TCK_CodeSize)
+    unsigned SizePercent;
+    // The maximum growth in the estimated latency of a function, in percent.
+    // The latency of a function is the sum of the latencies (TCK_Latency) of
+    // its instructions weighted by the block frequencies.
+    unsigned CyclePercent;
+    // The maximum code growth per module, in TCK_CodeSize units. 0 means no
+    // limit.
+    unsigned ModuleSize;
+  };
+
+  // Removes the rewrites that don't fit into the budgets from Rewrites (the
+  // remaining ones are kept in program order). Returns the number of removed
+  // rewrites.
+  //
+  // The module budget is shared by all the functions that this MBABudget is
+  // applied to, in the order in which these are visited. To get a fresh
+  // budget for every module, use a new MBABudget per module (see
+  // MBABudgetModuleAdaptor).
+  unsigned apply(llvm::Function &F, MBARewriter::RewriteList &Rewrites,
+                 const Limits &Budget, const llvm::TargetTransformInfo &TTI,
+                 const llvm::BlockFrequencyInfo &BFI);
+
+private:
+  // Set when the budget is first applied
+  std::optional<llvm::InstructionCost> ModuleSizeLeft;
+};
+
+// The options of a budgeted pass, e.g. for PassArg "mba-add":
+//    -mba-add-budgeted, -mba-add-size-budget, -mba-add-cycle-budget and
+//    -mba-add-module-size-budget
+// Like -<pass>-format (see ResultWriter.h), every pass has its own options.
+class MBABudgetOptions {
+public:
+  explicit MBABudgetOptions(llvm::StringRef PassArg);
+
+  bool isBudgeted() const { return Budgeted; }
+  MBABudget::Limits getLimits() const {
+    return {SizePercent, CyclePercent, ModuleSize};
+  }
+
+private:
+  // The option names and descriptions (cl::opt doesn't copy these)
+  std::string BudgetedName, SizeName, CycleName, ModuleSizeName;
+  std::string SizeDesc, CycleDesc, ModuleSizeDesc;
+
+  llvm::cl::opt<bool> Budgeted;
+  llvm::cl::opt<unsigned> SizePercent;
+  llvm::cl::opt<unsigned> CyclePercent;
+  llvm::cl::opt<unsigned> ModuleSize;
+};
+
+// Runs the function pass PassT (MBAAdd or MBASub) on every function of a
+// module. Every run uses a new instance of PassT, so the module budget starts
+// from scratch for every module (including when run on the same module
+// again).
+template <typename PassT>
+struct MBABudgetModuleAdaptor
+    : public llvm::PassInfoMixin<MBABudgetModuleAdaptor<PassT>> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM) {
+    return llvm::createModuleToFunctionPassAdaptor(PassT()).run(M, MAM);
+  }
+
+  static bool isRequired() { return true; }
+};
+
+#endif // LLVM_TUTOR_MBA_BUDGET_H
@@ -0,0 +1,89 @@
+//========================================================================
+// FILE:
+//    MBAIdentities.h
+//
+// DESCRIPTION:
+//   Declares:
+//    * struct MBAIdentity and the library (table) of Mixed Boolean-Arithmetic
+//      identities for integer add, sub, xor, or and and
+//    * class MBARewriter, the rewrite engine that applies these identities
+//    The two items are shared by the MBA passes (MBAAdd, MBASub and
+//    MBARewrite).
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_MBA_IDENTITIES_H
+#define LLVM_TUTOR_MBA_IDENTITIES_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstrTypes.h"
+
+// An identity `a <op> b == <formula>`, e.g. `a + b == (a | b) + (a & b)`
+struct MBAIdentity {
+  // The opcode of the rewritten instructions (e.g. Instruction::Add)
+  unsigned Opcode;
+  // The name used to select the identity (e.g. on the command line)
+  const char *Name;
+  // The right hand side (for debugging and documentation)
+  const char *Formula;
+  // Returns true if the identity holds for (or is implemented for) the
+  // integer or integer vector type Ty. Null means "all types".
+  bool (*IsApplicable)(const llvm::Type *Ty);
+  // Builds the formula for operands A and B
+  llvm::Value *(*Build)(llvm::IRBuilderBase &Builder, llvm::Value *A,
+                        llvm::Value *B);
+};
+
+// Returns all the identities from the library (grouped by opcode)
+llvm::ArrayRef<MBAIdentity> getMBAIdentities();
+
+// Returns the identity called Name, or null if there's no such identity
+const MBAIdentity *getMBAIdentity(llvm::StringRef Name);
+
+// Rewrites the instructions in a function using a set of identities. All
+// instructions are matched in a single walk over the function and then
+// rewritten in one batch, regardless of how many identities (and opcodes)
+// there are, e.g.:
+//    MBARewriter Rewriter(getMBAIdentity("sub-not"));
+//    Rewriter.run(F, [](const BinaryOperator &, auto Ids) { return Ids[0]; });
+class MBARewriter {
+public:
+  // Picks one of Identities (all of which apply to Inst) for rewriting Inst,
+  // or returns null to leave Inst as it is. Called once for every matched
+  // instruction, in program order.
+  using ChooseFn = llvm::function_ref<const MBAIdentity *(
+      const llvm::BinaryOperator &Inst,
+      llvm::ArrayRef<const MBAIdentity *> Identities)>;
+
+  // The matched instructions and the identities chosen for them (in program
+  // order)
+  using RewriteList =
+      llvm::SmallVector<std::pair<llvm::BinaryOperator *, const MBAIdentity *>,
+                        16>;
+
+  explicit MBARewriter(llvm::ArrayRef<const MBAIdentity *> Identities);
+
+  // Rewrites the instructions in F with the identities chosen by Choose.
+  // Returns the number of rewritten instructions.
+  unsigned run(llvm::Function &F, ChooseFn Choose) const {
+    return rewrite(match(F, Choose));
+  }
+
+  // The two steps of run. Use these to filter the matched instructions
+  // before rewriting them (e.g. see MBABudget).
+  RewriteList match(llvm::Function &F, ChooseFn Choose) const;
+  static unsigned rewrite(llvm::ArrayRef<RewriteList::value_type> Rewrites);
+
+private:
+  // Opcode <--> the identities for that opcode
+  llvm::DenseMap<unsigned, llvm::SmallVector<const MBAIdentity *, 4>>
+      ByOpcode;
+};
+
+#endif // LLVM_TUTOR_MBA_IDENTITIES_H
@@ -0,0 +1,44 @@
+//==============================================================================
+// FILE:
+//    MBARewrite.h
+//
+// DESCRIPTION:
+//    Declares the MBARewrite pass for the new and the legacy pass managers.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_MBA_REWRITE_H
+#define LLVM_TUTOR_MBA_REWRITE_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct MBARewrite : public llvm::PassInfoMixin<MBARewrite> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &);
+  // Replaces the integer add, sub, xor, or and and instructions in F (a
+  // random subset, see -mba-rewrite-ratio) using the identities selected
+  // with -mba-rewrite-identities
+  bool runOnFunction(llvm::Function &F);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+//------------------------------------------------------------------------------
+// Legacy PM interface
+//------------------------------------------------------------------------------
+struct LegacyMBARewrite : public llvm::FunctionPass {
+  static char ID;
+  LegacyMBARewrite() : FunctionPass(ID) {}
+  bool runOnFunction(llvm::Function &F) override;
+
+  MBARewrite Impl;
+};
+
+#endif
@@ -0,0 +1,46 @@
+//==============================================================================
+// FILE:
+//    MBASimplify.h
+//
+// DESCRIPTION:
+//    Declares the MBASimplify pass for the new and the legacy pass managers.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_MBA_SIMPLIFY_H
+#define LLVM_TUTOR_MBA_SIMPLIFY_H
+
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct MBASimplify : public llvm::PassInfoMixin<MBASimplify> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &);
+  // Simplifies the linear MBA expressions in F
+  bool runOnFunction(llvm::Function &F);
+  // Replaces the expression rooted at Root with a simpler equivalent, if
+  // there's one. Returns true if Root was replaced (and deleted).
+  static bool simplifyExpression(llvm::BinaryOperator &Root);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+//------------------------------------------------------------------------------
+// Legacy PM interface
+//------------------------------------------------------------------------------
+struct LegacyMBASimplify : public llvm::FunctionPass {
+  static char ID;
+  LegacyMBASimplify() : FunctionPass(ID) {}
+  bool runOnFunction(llvm::Function &F) override;
+
+  MBASimplify Impl;
+};
+
+#endif
@@ -10,6 +10,8 @@
 #ifndef LLVM_TUTOR_MBA_SUB_H
 #define LLVM_TUTOR_MBA_SUB_H
 
+#include "MBABudget.h"
+
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
@@ -18,12 +20,21 @@
 struct MBASub : public llvm::PassInfoMixin<MBASub> {
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &);
-  bool runOnBasicBlock(llvm::BasicBlock &B);
+  // Replaces the integer `sub` instructions in F. TTI and BFI are only used
+  // (and then required) with -mba-sub-budgeted.
+  bool runOnFunction(llvm::Function &F,
+                     const llvm::TargetTransformInfo *TTI = nullptr,
+                     const llvm::BlockFrequencyInfo *BFI = nullptr);
 
   // Without isRequired returning true, this pass will be skipped for functions
   // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
   // all functions with optnone.
   static bool isRequired() { return true; }
+
+  // The overhead budget (with -mba-sub-budgeted). The module budget is shared
+  // by all the functions that this instance is run on (for -passes=mba-sub, a
+  // new instance is created for every module, see MBABudgetModuleAdaptor).
+  MBABudget Budget;
 };
 
 struct LegacyMBASub : public llvm::FunctionPass {
@@ -33,7 +44,10 @@ struct LegacyMBASub : public llvm::FunctionPass {
   // The value does not matter.
   static char ID;
   LegacyMBASub() : FunctionPass(ID) {}
+  // Resets the module budget
+  bool doInitialization(llvm::Module &M) override;
   bool runOnFunction(llvm::Function &F) override;
+  void getAnalysisUsage(llvm::AnalysisUsage &Info) const override;
 
   MBASub Impl;
 };
@@ -10,9 +10,18 @@
 #ifndef LLVM_TUTOR_MERGEBBS_H
 #define LLVM_TUTOR_MERGEBBS_H
 
+#include "InstructionEquivalence.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
+#include <unordered_map>
+
+class BlockBuckets;
+
 using ResultMergeBB = llvm::StringMap<unsigned>;
 
 //------------------------------------------------------------------------------
@@ -23,9 +32,10 @@ struct MergeBB : public llvm::PassInfoMixin<MergeBB> {
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &);
 
-  // Checks whether the input instruction Inst (that has exactly one use) can be
-  // removed. This is the case when its only user is either:
-  //  1) a PHI (it can be easily updated if Inst is removed), or
+  // Checks whether the input instruction Inst can be removed. This is the case
+  // when each of its users is either:
+  //  1) a PHI in the successor (it can be easily updated if Inst is removed),
+  //     or
   //  2) located in the same block as Inst (if that block is removed then the
   //     user will also be removed)
   bool canRemoveInst(const llvm::Instruction *Inst);
@@ -33,17 +43,28 @@ struct MergeBB : public llvm::PassInfoMixin<MergeBB> {
   // Instructions in Insts belong to different blocks that unconditionally
   // branch to a common successor. Analyze them and return true if it would be
   // possible to merge them, i.e. replace Inst1 with Inst2 (or vice-versa).
-  bool canMergeInstructions(llvm::ArrayRef<llvm::Instruction *> Insts);
+  // The operands must be identical or, for operands defined in the blocks
+  // themselves, counterparts (see areEquivalentInstructions).
+  bool canMergeInstructions(llvm::ArrayRef<llvm::Instruction *> Insts,
+                            const CounterpartMap &Counterparts);
 
   // Replace the destination of incoming edges of BBToErase by BBToRetain
   unsigned updateBranchTargets(llvm::BasicBlock *BBToErase,
                                llvm::BasicBlock *BBToRetain);
 
   // If BB is duplicated, then merges BB with its duplicate and adds BB to
-  // DeleteList. DeleteList contains the list of blocks to be deleted.
+  // DeleteList. DeleteList contains the list of blocks to be deleted. Only
+  // the blocks in the same bucket as BB (see BlockBuckets) are considered.
+  // The blocks that need to be re-visited after merging are added to
+  // Worklist.
   bool
   mergeDuplicatedBlock(llvm::BasicBlock *BB,
-                       llvm::SmallPtrSet<llvm::BasicBlock *, 8> &DeleteList);
+                       llvm::SmallPtrSet<llvm::BasicBlock *, 8> &DeleteList,
+                       BlockBuckets &Buckets,
+                       llvm::SmallVectorImpl<llvm::BasicBlock *> &Worklist);
+
+  // Merges all the duplicated blocks in F. Returns true if F was modified.
+  bool mergeDuplicatedBlocks(llvm::Function &F);
 
   // Without isRequired returning true, this pass will be skipped for functions
   // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
@@ -65,6 +86,38 @@ struct LegacyMergeBB : public llvm::FunctionPass {
 //------------------------------------------------------------------------------
 // Helper data structures
 //------------------------------------------------------------------------------
+// Groups the blocks that end with an unconditional branch by a structural
+// hash (see hashBlock). Blocks that are identical (in the sense of
+// MergeBB::canMergeInstructions) always land in the same bucket, so a block
+// only needs to be compared against the blocks from its own bucket (rather
+// than against all the predecessors of its successor).
+class BlockBuckets {
+public:
+  explicit BlockBuckets(llvm::Function &F);
+
+  // Re-hashes BB, e.g. after its successor has changed
+  void update(llvm::BasicBlock *BB);
+  // The blocks that might be identical to BB (including BB itself), in
+  // program order
+  llvm::ArrayRef<llvm::BasicBlock *> getCandidates(llvm::BasicBlock *BB) const;
+
+  // Hashes the non-debug instructions in BB (opcodes, types and operands),
+  // the successor of BB and the values that the PHI nodes in the successor
+  // receive from BB
+  static llvm::hash_code hashBlock(const llvm::BasicBlock *BB);
+
+private:
+  void insert(llvm::BasicBlock *BB);
+  void erase(llvm::BasicBlock *BB);
+
+  llvm::DenseMap<const llvm::BasicBlock *, size_t> Hashes;
+  std::unordered_map<size_t, llvm::SmallVector<llvm::BasicBlock *, 2>>
+      Buckets;
+  // The position of every block in the function (to keep the buckets in
+  // program order)
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> Positions;
+};
+
 // Iterates through instructions in BB1 and BB2 in reverse order from the first
 // non-debug instruction. For example (assume all blocks have size n):
 //   LockstepReverseIterator I(BB1, BB2);
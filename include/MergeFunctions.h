@@ -0,0 +1,60 @@
+//==============================================================================
+// FILE:
+//    MergeFunctions.h
+//
+// DESCRIPTION:
+//    Declares the MergeFunctions pass for the new and the legacy pass managers.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_MERGE_FUNCTIONS_H
+#define LLVM_TUTOR_MERGE_FUNCTIONS_H
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct MergeFunctions : public llvm::PassInfoMixin<MergeFunctions> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+  bool runOnModule(llvm::Module &M);
+
+  // Hashes the signature and the body of F. Identical functions (see
+  // areEquivalentFunctions) have equal hashes.
+  static llvm::hash_code hashFunction(const llvm::Function &F);
+
+  // Returns true if F1 and F2 have identical signatures, attributes and
+  // bodies (i.e. F1 can be used instead of F2)
+  static bool areEquivalentFunctions(const llvm::Function &F1,
+                                     const llvm::Function &F2);
+
+  // Replaces Duplicate, which is identical to Target, with:
+  //  * Target (all uses of Duplicate are replaced and Duplicate is erased), if
+  //    Duplicate is local and its address is not taken or not significant,
+  //  * an alias to Target, if the address of Duplicate is not significant,
+  //  * a thunk that calls Target, otherwise (direct calls to Duplicate are
+  //    redirected to Target).
+  // Returns the thunk (if one was created).
+  llvm::Function *foldFunction(llvm::Function &Duplicate,
+                               llvm::Function &Target);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+//------------------------------------------------------------------------------
+// Legacy PM interface
+//------------------------------------------------------------------------------
+struct LegacyMergeFunctions : public llvm::ModulePass {
+  static char ID;
+  LegacyMergeFunctions() : ModulePass(ID) {}
+  bool runOnModule(llvm::Module &M) override;
+
+  MergeFunctions Impl;
+};
+
+#endif
@@ -6,29 +6,47 @@
 //    Declares the OpcodeCounter Passes:
 //      * new pass manager interface
 //      * printer pass for the new pass manager
+//    and the OpcodeHistogram Passes (OpcodeCounter for the whole module):
+//      * new pass manager interface
+//      * printer pass for the new pass manager
 //
 // License: MIT
 //==============================================================================
 #ifndef LLVM_TUTOR_OPCODECOUNTER_H
 #define LLVM_TUTOR_OPCODECOUNTER_H
 
-#include "llvm/ADT/StringMap.h"
+#include "ResultWriter.h"
+
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <array>
+
+// The options of OpcodeCounter (-opcode-counter-format and
+// -opcode-histogram-threads)
+extern llvm::cl::OptionCategory OpcodeCounterCategory;
+
 //------------------------------------------------------------------------------
 // New PM interface
 //------------------------------------------------------------------------------
-using ResultOpcodeCounter = llvm::StringMap<unsigned>;
+// Opcode (i.e. Instruction::getOpcode()) <--> number of times it was used.
+// Opcodes are small integers (starting at 1), so the counts are kept in a
+// dense array indexed by the opcode. The names are only needed for printing
+// (see Instruction::getOpcodeName(unsigned)).
+using ResultOpcodeCounter =
+    std::array<unsigned, llvm::Instruction::OtherOpsEnd>;
 
 struct OpcodeCounter : public llvm::AnalysisInfoMixin<OpcodeCounter> {
   using Result = ResultOpcodeCounter;
   Result run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &);
 
-  OpcodeCounter::Result generateOpcodeMap(llvm::Function &F);
+  static OpcodeCounter::Result generateOpcodeMap(llvm::Function &F);
+  // Adds the opcodes used in F to Res
+  static void countOpcodes(llvm::Function &F, Result &Res);
   // Part of the official API:
   //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
   static bool isRequired() { return true; }
@@ -45,14 +63,68 @@ private:
 //------------------------------------------------------------------------------
 class OpcodeCounterPrinter : public llvm::PassInfoMixin<OpcodeCounterPrinter> {
 public:
-  explicit OpcodeCounterPrinter(llvm::raw_ostream &OutS) : OS(OutS) {}
+  explicit OpcodeCounterPrinter(llvm::raw_ostream &OutS,
+                                ResultFormat Format = ResultFormat::Text)
+      : OS(OutS), Writer(OutS, Format, {"function", "opcode", "count"}) {}
   llvm::PreservedAnalyses run(llvm::Function &Func,
                               llvm::FunctionAnalysisManager &FAM);
   // Part of the official API:
   //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
   static bool isRequired() { return true; }
 
+private:
+  llvm::raw_ostream &OS;
+  // Used for the machine-readable formats (shared by all functions, so that
+  // the CSV header is printed only once)
+  ResultWriter Writer;
+};
+
+//------------------------------------------------------------------------------
+// New PM interface for the module-wide histogram
+//------------------------------------------------------------------------------
+// Sums the opcode counts over all functions in a module. The functions are
+// analysed in parallel.
+struct OpcodeHistogram : public llvm::AnalysisInfoMixin<OpcodeHistogram> {
+  using Result = ResultOpcodeCounter;
+  Result run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+
+  // Computes the histogram of M on (up to) NumThreads threads (0 means one
+  // per hardware thread, see -opcode-histogram-threads)
+  static Result computeHistogram(llvm::Module &M, unsigned NumThreads);
+  // Part of the official API:
+  //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
+  static bool isRequired() { return true; }
+
+private:
+  // A special type used by analysis passes to provide an address that
+  // identifies that particular analysis pass type.
+  static llvm::AnalysisKey Key;
+  friend struct llvm::AnalysisInfoMixin<OpcodeHistogram>;
+};
+
+class OpcodeHistogramPrinter
+    : public llvm::PassInfoMixin<OpcodeHistogramPrinter> {
+public:
+  explicit OpcodeHistogramPrinter(llvm::raw_ostream &OutS) : OS(OutS) {}
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  // Part of the official API:
+  //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
+  static bool isRequired() { return true; }
+
 private:
   llvm::raw_ostream &OS;
 };
+
+//------------------------------------------------------------------------------
+// Helpers for combining the results (e.g. for multiple modules)
+//------------------------------------------------------------------------------
+// Adds the counts from Other to Sum
+void mergeOpcodeCounts(ResultOpcodeCounter &Sum,
+                       const ResultOpcodeCounter &Other);
+
+// Prints the (e.g. merged) histogram (in the format selected with
+// -opcode-counter-format)
+void printOpcodeHistogram(llvm::raw_ostream &OutS,
+                          const ResultOpcodeCounter &Histogram);
 #endif
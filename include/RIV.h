@@ -13,20 +13,182 @@
 #ifndef LLVM_TUTOR_RIV_H
 #define LLVM_TUTOR_RIV_H
 
-#include "llvm/ADT/MapVector.h"
-#include "llvm/ADT/SmallPtrSet.h"
+#include "ResultWriter.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/iterator.h"
 #include "llvm/IR/Dominators.h"
-#include "llvm/IR/ValueMap.h"
 #include "llvm/Pass.h"
 
+#include <vector>
+
+//------------------------------------------------------------------------------
+// RIV results
+//------------------------------------------------------------------------------
+// For every basic block, the set of integer values reachable from that block.
+//
+// The set for a block BB is not stored explicitly. Instead, it is the union
+// of the values defined in the dominators of BB (excluding BB itself), the
+// global variables and the input arguments. Hence, for every block only its
+// immediate dominator and the range of values that it defines (i.e. the
+// "delta" over its immediate dominator) are stored. The sets are exposed as
+// (cheap to copy) views: ValueSet. Iterating over a ValueSet walks up the
+// dominator tree, so the values defined in the closest dominator come first,
+// followed by the global variables and then the input arguments.
+class RIVResult {
+public:
+  // A read-only view of the reachable integer values for one basic block
+  class ValueSet {
+  public:
+    class iterator
+        : public llvm::iterator_facade_base<iterator,
+                                            std::forward_iterator_tag,
+                                            llvm::Value *, std::ptrdiff_t,
+                                            llvm::Value **, llvm::Value *> {
+    public:
+      iterator() = default;
+      // Points at the first value defined in Node or in one of its dominators
+      // (Node -1 stands for the global variables and the input arguments)
+      iterator(const RIVResult &Res, int Node);
+      // The end iterator
+      explicit iterator(const RIVResult &Res)
+          : Res(&Res), Node(-1), Idx(Res.ArgsEnd), End(Res.ArgsEnd) {}
+
+      llvm::Value *operator*() const { return Res->Values[Idx]; }
+      iterator &operator++() {
+        Idx++;
+        skipEmptyRanges();
+        return *this;
+      }
+      bool operator==(const iterator &Other) const {
+        return Node == Other.Node && Idx == Other.Idx;
+      }
+
+    private:
+      // Moves up the dominator tree until a non-empty range is found (or the
+      // end is reached)
+      void skipEmptyRanges();
+
+      const RIVResult *Res = nullptr;
+      // The block whose values are being visited (-1 for the global variables
+      // and the input arguments, which are visited last)
+      int Node = -1;
+      // The current value and the end of the current range
+      unsigned Idx = 0;
+      unsigned End = 0;
+    };
+
+    ValueSet(const RIVResult &Res, int Block) : Res(&Res), Block(Block) {}
+
+    iterator begin() const {
+      return Block < 0 ? end() : iterator(*Res, Res->Blocks[Block].IDom);
+    }
+    iterator end() const { return iterator(*Res); }
+    // Both size() and contains() walk up the dominator tree
+    size_t size() const;
+    bool empty() const { return begin() == end(); }
+    bool contains(const llvm::Value *V) const;
+
+  private:
+    const RIVResult *Res;
+    // The index of the block (-1 if the block is not reachable)
+    int Block;
+  };
+
+  // Iterates over (block, ValueSet) pairs in the order in which the blocks
+  // were visited (depth-first through the dominator tree). Blocks added with
+  // the update API (see below) come last.
+  class iterator
+      : public llvm::iterator_facade_base<
+            iterator, std::forward_iterator_tag,
+            std::pair<const llvm::BasicBlock *, ValueSet>, std::ptrdiff_t,
+            void, std::pair<const llvm::BasicBlock *, ValueSet>> {
+  public:
+    iterator(const RIVResult &Res, size_t Idx) : Res(&Res), Idx(Idx) {}
+
+    std::pair<const llvm::BasicBlock *, ValueSet> operator*() const {
+      return {Res->Blocks[Idx].BB, ValueSet(*Res, Idx)};
+    }
+    iterator &operator++() {
+      Idx++;
+      return *this;
+    }
+    bool operator==(const iterator &Other) const { return Idx == Other.Idx; }
+
+  private:
+    const RIVResult *Res;
+    size_t Idx;
+  };
+
+  // Returns the reachable integer values for BB (an empty set if BB is not
+  // reachable from the entry block)
+  ValueSet lookup(const llvm::BasicBlock *BB) const;
+
+  iterator begin() const { return iterator(*this, 0); }
+  iterator end() const { return iterator(*this, Blocks.size()); }
+  size_t size() const { return Blocks.size(); }
+  bool empty() const { return Blocks.empty(); }
+  void clear();
+
+  // Incremental updates. These keep the results valid for transformations
+  // that only insert blocks, so that the transformations can preserve RIV
+  // (rather than forcing it to be re-computed).
+  //
+  // NewBB has been inserted and is immediately dominated by IDom (which
+  // must already be known).
+  void addBlock(llvm::BasicBlock *NewBB, const llvm::BasicBlock *IDom);
+  // Tail has been split off Head (e.g. with SplitBlock): Tail is immediately
+  // dominated by Head and it now dominates all the blocks that Head
+  // dominated. The values defined in Head and in Tail are re-collected, so
+  // Head may also have been modified (e.g. values replaced or new values
+  // added).
+  void splitBlock(llvm::BasicBlock *Head, llvm::BasicBlock *Tail);
+
+private:
+  friend struct RIV;
+
+  struct BlockInfo {
+    const llvm::BasicBlock *BB;
+    // The index of the immediate dominator (-1 for the entry block)
+    int IDom;
+    // The integer values defined in BB: Values[DefsBegin, DefsEnd)
+    unsigned DefsBegin;
+    unsigned DefsEnd;
+  };
+
+  // Appends BB (with the given immediate dominator) and the integer values
+  // defined in BB
+  void addBlockInfo(llvm::BasicBlock *BB, int IDom);
+  // Appends the integer values defined in BB to Values and returns their
+  // range
+  std::pair<unsigned, unsigned> collectDefs(llvm::BasicBlock *BB);
+  // The range of values defined in Node (or the global variables and the
+  // input arguments for Node -1)
+  std::pair<unsigned, unsigned> getDefs(int Node) const {
+    if (Node < 0)
+      return {0, ArgsEnd};
+    return {Blocks[Node].DefsBegin, Blocks[Node].DefsEnd};
+  }
+
+  // The integer values, grouped by the defining block. The global variables
+  // and the input arguments come first: Values[0, ArgsEnd). Note that after
+  // splitBlock, the values previously collected for Head are no longer
+  // referenced by any block (and may have been deleted).
+  std::vector<llvm::Value *> Values;
+  unsigned ArgsEnd = 0;
+
+  // The reachable blocks (in the order in which they were visited)
+  std::vector<BlockInfo> Blocks;
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> BlockIndices;
+};
+
 //------------------------------------------------------------------------------
 // New PM interface
 //------------------------------------------------------------------------------
 struct RIV : public llvm::AnalysisInfoMixin<RIV> {
-  // A map that for every basic block holds a set of pointers to reachable
-  // integer values for that block.
-  using Result = llvm::MapVector<llvm::BasicBlock const *,
-                                 llvm::SmallPtrSet<llvm::Value *, 8>>;
+  // For every basic block, the set of reachable integer values for that
+  // block.
+  using Result = RIVResult;
   Result run(llvm::Function &F, llvm::FunctionAnalysisManager &);
   Result buildRIV(llvm::Function &F,
                   llvm::DomTreeNodeBase<llvm::BasicBlock> *CFGRoot);
@@ -43,12 +205,17 @@ private:
 //------------------------------------------------------------------------------
 class RIVPrinter : public llvm::PassInfoMixin<RIVPrinter> {
 public:
-  explicit RIVPrinter(llvm::raw_ostream &OutS) : OS(OutS) {}
+  explicit RIVPrinter(llvm::raw_ostream &OutS,
+                      ResultFormat Format = ResultFormat::Text)
+      : OS(OutS), Writer(OutS, Format, {"function", "block", "value"}) {}
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &FAM);
 
 private:
   llvm::raw_ostream &OS;
+  // Used for the machine-readable formats (shared by all functions, so that
+  // the CSV header is printed only once)
+  ResultWriter Writer;
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,86 @@
+//========================================================================
+// FILE:
+//    ResultWriter.h
+//
+// DESCRIPTION:
+//   Declares:
+//    * enum ResultFormat, the formats in which the analysis printers can
+//      print their results
+//    * class ResultWriter that streams results as machine-readable records
+//      (JSON lines or CSV) into a raw_ostream
+//    The two items are shared by the printer passes (print<static-cc>,
+//    print<opcode-counter>, print<riv> and print<find-fcmp-eq>).
+//
+// License: MIT
+//========================================================================
+#ifndef LLVM_TUTOR_RESULT_WRITER_H
+#define LLVM_TUTOR_RESULT_WRITER_H
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <initializer_list>
+
+enum class ResultFormat {
+  // Human readable tables (the default)
+  Text,
+  // One JSON object per record, e.g. {"function":"foo","calls":3}
+  JSONLines,
+  // A header with the column names followed by one line per record
+  CSV
+};
+
+// The values for cl::opt<ResultFormat>. Every plugin defines its own option
+// (e.g. -static-cc-format), as plugins that are loaded into the same process
+// can't register the same option twice.
+inline llvm::cl::ValuesClass getResultFormatValues() {
+  return llvm::cl::values(
+      clEnumValN(ResultFormat::Text, "text", "Human readable text (default)"),
+      clEnumValN(ResultFormat::JSONLines, "jsonl",
+                 "JSON lines (one JSON object per record)"),
+      clEnumValN(ResultFormat::CSV, "csv", "Comma separated values"));
+}
+
+// Writes records, i.e. lists of fields with fixed column names, as JSON lines
+// or CSV. Everything is written (and escaped) straight into the output
+// stream, i.e. no intermediate strings are built, e.g.:
+//    ResultWriter Writer(OS, ResultFormat::JSONLines, {"function", "calls"});
+//    Writer.beginRecord().field(F.getName()).field(NumCalls).endRecord();
+// For CSV, the header is written right before the first record. Use the same
+// ResultWriter for all records that go into one output (e.g. by keeping it in
+// the printer pass) to get only one header. Text is not supported - the
+// printers print their own tables.
+class ResultWriter {
+public:
+  ResultWriter(llvm::raw_ostream &OutS, ResultFormat Format,
+               std::initializer_list<llvm::StringRef> Columns);
+
+  ResultWriter &beginRecord();
+  ResultWriter &field(llvm::StringRef Value);
+  ResultWriter &field(uint64_t Value);
+  // Writes a field, the value of which is printed by Print (e.g. via
+  // Value::print). The printed text is escaped on the fly (and leading spaces
+  // are dropped).
+  ResultWriter &
+  printedField(llvm::function_ref<void(llvm::raw_ostream &)> Print);
+  void endRecord();
+
+  ResultFormat getFormat() const { return Format; }
+
+private:
+  // Writes the separator and (for JSON) the name of the next field
+  void beginField();
+
+  llvm::raw_ostream &OS;
+  ResultFormat Format;
+  // The column names (these are expected to be string literals)
+  llvm::SmallVector<llvm::StringRef, 4> Columns;
+  // The index of the next field in the current record
+  unsigned NextField = 0;
+  bool HeaderWritten = false;
+};
+
+#endif // LLVM_TUTOR_RESULT_WRITER_H
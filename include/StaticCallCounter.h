@@ -18,8 +18,12 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <map>
+#include <string>
+
 //------------------------------------------------------------------------------
 // New PM interface
 //------------------------------------------------------------------------------
@@ -29,6 +33,9 @@ struct StaticCallCounter : public llvm::AnalysisInfoMixin<StaticCallCounter> {
   using Result = ResultStaticCC;
   Result run(llvm::Module &M, llvm::ModuleAnalysisManager &);
   Result runOnModule(llvm::Module &M);
+  // Adds the direct calls in F to Res. Unlike runOnModule, this only requires
+  // F to be materialized (e.g. when the module is loaded lazily).
+  static void runOnFunction(llvm::Function &F, Result &Res);
   // Part of the official API:
   //  https://llvm.org/docs/WritingAnLLVMNewPMPass.html#required-passes
   static bool isRequired() { return true; }
@@ -73,4 +80,28 @@ struct LegacyStaticCallCounter : public llvm::ModulePass {
   StaticCallCounter Impl;
 };
 
+//------------------------------------------------------------------------------
+// Helpers for combining the results for multiple modules
+//------------------------------------------------------------------------------
+// Function name <--> number of direct calls (in the order in which the
+// functions were first seen). Unlike ResultStaticCC, this doesn't refer to any
+// IR objects. Hence it can outlive the module (and the LLVMContext) that it
+// was computed for, e.g. to be merged with the results for other modules.
+using NamedResultStaticCC =
+    llvm::MapVector<std::string, unsigned, std::map<std::string, unsigned>>;
+
+NamedResultStaticCC getNamedResult(const ResultStaticCC &DirectCalls);
+
+// Adds the call counts from Other to Merged (functions are matched by name)
+void mergeStaticCCResults(NamedResultStaticCC &Merged,
+                          const NamedResultStaticCC &Other);
+
+// Pretty-prints the (e.g. merged) results (in the format selected with
+// -static-cc-format)
+void printStaticCCResult(llvm::raw_ostream &OutS,
+                         const NamedResultStaticCC &DirectCalls);
+
+// The options of StaticCallCounter (-static-cc-format)
+extern llvm::cl::OptionCategory StaticCCCategory;
+
 #endif // LLVM_TUTOR_STATICCALLCOUNTER_H
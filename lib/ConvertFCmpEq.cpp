@@ -13,6 +13,22 @@
 //    stream). It also demonstrates how instructions can be modified without
 //    having to completely replace them.
 //
+//    All floating-point types are supported, including vectors (e.g.
+//    <4 x float>). The absolute value is computed with llvm.fabs and the
+//    threshold is the machine epsilon of the element type, so vector
+//    comparisons stay vector comparisons.
+//
+//    The tolerance is selected with -convert-fcmp-eq-mode:
+//      * absolute (default) - |a - b| < eps
+//      * relative - |a - b| <= eps * max(|a|, |b|) || a == b
+//      * combined - |a - b| <= max(eps, eps * max(|a|, |b|)) || a == b
+//      * ulp - a and b are at most N representable values apart (compared as
+//        integers, see createOrderedBits)
+//    where eps is the machine epsilon (times -convert-fcmp-eq-epsilons) and N
+//    is -convert-fcmp-eq-ulps. None of these introduces branches (maximums
+//    are computed with llvm.maxnum and llvm.smax/llvm.smin), so the
+//    comparisons remain vectorizable.
+//
 //    Originally developed for [1].
 //
 //    [1] "Writing an LLVM Optimization" by Jonathan Smith
@@ -37,6 +53,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
@@ -44,16 +61,133 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include <cassert>
 
 using namespace llvm;
 
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+// How `a == b` is converted
+enum class ToleranceMode {
+  // |a - b| < eps
+  Absolute,
+  // |a - b| <= eps * max(|a|, |b|) (or a == b, e.g. for infinities)
+  Relative,
+  // a and b are at most N representable values apart
+  ULP,
+  // |a - b| <= max(eps, eps * max(|a|, |b|)) (or a == b)
+  Combined
+};
+
+static cl::opt<ToleranceMode> ToleranceModeOpt{
+    "convert-fcmp-eq-mode",
+    cl::desc("How ConvertFCmpEq compares floating-point values"),
+    cl::values(clEnumValN(ToleranceMode::Absolute, "absolute",
+                          "|a - b| < eps"),
+               clEnumValN(ToleranceMode::Relative, "relative",
+                          "|a - b| <= eps * max(|a|, |b|)"),
+               clEnumValN(ToleranceMode::ULP, "ulp",
+                          "a and b are at most -convert-fcmp-eq-ulps units "
+                          "in the last place apart"),
+               clEnumValN(ToleranceMode::Combined, "combined",
+                          "|a - b| <= max(eps, eps * max(|a|, |b|))")),
+    cl::init(ToleranceMode::Absolute)};
+
+static cl::opt<unsigned> NumEpsilons{
+    "convert-fcmp-eq-epsilons",
+    cl::desc("The tolerance (eps) used by ConvertFCmpEq, in multiples of the "
+             "machine epsilon"),
+    cl::value_desc("epsilons"), cl::init(1)};
+
+static cl::opt<unsigned> MaxULPs{
+    "convert-fcmp-eq-ulps",
+    cl::desc("The maximum distance in units in the last place for "
+             "-convert-fcmp-eq-mode=ulp"),
+    cl::value_desc("ulps"), cl::init(4)};
+
 // Unnamed namespace for private functions
 namespace {
 
-FCmpInst *convertFCmpEqInstruction(FCmpInst *FCmp) noexcept {
+// Returns the machine epsilon for the floating-point type Ty (splatted for
+// vector types), multiplied by -convert-fcmp-eq-epsilons. For IEEE 754
+// values, that's (b / 2) * b ^ -(p - 1), where b (base) = 2 and p is the
+// precision, e.g. 2 ^ -52 for double (p = 53) and 2 ^ -23 for float (p = 24).
+Constant *getEpsilon(Type *Ty) noexcept {
+  const fltSemantics &Semantics = Ty->getScalarType()->getFltSemantics();
+  int Precision = APFloat::semanticsPrecision(Semantics);
+  APFloat Epsilon = scalbn(APFloat(Semantics, 1), 1 - Precision,
+                           APFloat::rmNearestTiesToEven);
+  Epsilon.multiply(APFloat(Semantics, NumEpsilons),
+                   APFloat::rmNearestTiesToEven);
+  return ConstantFP::get(Ty, Epsilon);
+}
+
+// Returns the bits of the floating-point value V as an integer that is
+// ordered like V, i.e. adjacent floating-point values map to adjacent
+// integers. Negative values are stored as sign and magnitude, so their
+// magnitude bits are flipped and 1 is added, i.e. they're negated (-0.0 and
+// +0.0 both map to 0):
+//    %bits = bitcast double %v to i64
+//    %sign = ashr i64 %bits, 63
+//    %mask = lshr i64 %sign, 1
+//    %flip = xor i64 %bits, %mask
+//    %ord  = sub i64 %flip, %sign
+Value *createOrderedBits(IRBuilderBase &Builder, Value *V) {
+  Type *IntTy = V->getType()->getWithNewType(
+      Builder.getIntNTy(V->getType()->getScalarSizeInBits()));
+  auto *Bits = Builder.CreateBitCast(V, IntTy);
+  auto *Sign = Builder.CreateAShr(Bits, IntTy->getScalarSizeInBits() - 1);
+  auto *Mask = Builder.CreateLShr(Sign, 1);
+  return Builder.CreateSub(Builder.CreateXor(Bits, Mask), Sign);
+}
+
+// Converts an fcmp to a comparison of the distance between its operands in
+// ULPs. There are no integer equivalents of the unordered predicates, so the
+// result is combined with the original NaN check (fcmp ord/uno). Returns the
+// new comparison. The fcmp is not deleted.
+Value *convertToULPComparison(FCmpInst *FCmp, IRBuilderBase &Builder) {
+  Value *LHS = FCmp->getOperand(0);
+  Value *RHS = FCmp->getOperand(1);
+  bool IsEq = FCmp->getPredicate() == CmpInst::Predicate::FCMP_OEQ ||
+              FCmp->getPredicate() == CmpInst::Predicate::FCMP_UEQ;
+  bool IsOrdered = CmpInst::isOrdered(FCmp->getPredicate());
+
+  // %dist = smax(%ord.a, %ord.b) - smin(%ord.a, %ord.b), which is never
+  // negative when treated as unsigned
+  auto *OrderedLHS = createOrderedBits(Builder, LHS);
+  auto *OrderedRHS = createOrderedBits(Builder, RHS);
+  auto *Max = Builder.CreateBinaryIntrinsic(Intrinsic::smax, OrderedLHS,
+                                            OrderedRHS);
+  auto *Min = Builder.CreateBinaryIntrinsic(Intrinsic::smin, OrderedLHS,
+                                            OrderedRHS);
+  auto *Distance = Builder.CreateSub(Max, Min);
+  auto *ULPs = ConstantInt::get(Distance->getType(), MaxULPs);
+  auto *ULPCmp = IsEq ? Builder.CreateICmpULE(Distance, ULPs)
+                      : Builder.CreateICmpUGT(Distance, ULPs);
+
+  // For NaNs, the result is the same as for the original fcmp, i.e. false for
+  // ordered and true for unordered predicates
+  if (IsOrdered)
+    return Builder.CreateAnd(Builder.CreateFCmpORD(LHS, RHS), ULPCmp);
+  return Builder.CreateOr(Builder.CreateFCmpUNO(LHS, RHS), ULPCmp);
+}
+
+// Replaces FCmp with NewCmp (which takes over its name) and deletes FCmp
+void replaceFCmp(FCmpInst *FCmp, Value *NewCmp) {
+  NewCmp->takeName(FCmp);
+  FCmp->replaceAllUsesWith(NewCmp);
+  FCmp->eraseFromParent();
+}
+
+// Converts an equality-based fcmp to a tolerance-based comparison (see
+// -convert-fcmp-eq-mode). Returns the new comparison, which is either FCmp
+// itself or a replacement for it (in which case FCmp is deleted), or null if
+// FCmp is not an equality comparison.
+Value *convertFCmpEqInstruction(FCmpInst *FCmp) noexcept {
   assert(FCmp && "The given fcmp instruction is null");
 
   if (!FCmp->isEquality()) {
@@ -62,60 +196,110 @@ FCmpInst *convertFCmpEqInstruction(FCmpInst *FCmp) noexcept {
     return nullptr;
   }
 
+  // Create an IRBuilder with an insertion point set to the given fcmp
+  // instruction.
+  IRBuilder<> Builder(FCmp);
+
+  // The ULP-based comparison is an integer comparison, so it replaces the
+  // fcmp rather than modifies it.
+  if (ToleranceModeOpt == ToleranceMode::ULP) {
+    Value *ULPCmp = convertToULPComparison(FCmp, Builder);
+    replaceFCmp(FCmp, ULPCmp);
+    return ULPCmp;
+  }
+
   Value *LHS = FCmp->getOperand(0);
   Value *RHS = FCmp->getOperand(1);
   // Determine the new floating-point comparison predicate based on the current
-  // one.
-  CmpInst::Predicate CmpPred = [FCmp] {
+  // one. The relative tolerance is 0 for a == b == 0 (and so is the absolute
+  // one for -convert-fcmp-eq-epsilons=0), so in that case the comparison needs
+  // to be inclusive.
+  bool Inclusive =
+      ToleranceModeOpt != ToleranceMode::Absolute || NumEpsilons == 0;
+  CmpInst::Predicate CmpPred = [FCmp, Inclusive] {
     switch (FCmp->getPredicate()) {
     case CmpInst::Predicate::FCMP_OEQ:
-      return CmpInst::Predicate::FCMP_OLT;
+      return Inclusive ? CmpInst::Predicate::FCMP_OLE
+                       : CmpInst::Predicate::FCMP_OLT;
     case CmpInst::Predicate::FCMP_UEQ:
-      return CmpInst::Predicate::FCMP_ULT;
+      return Inclusive ? CmpInst::Predicate::FCMP_ULE
+                       : CmpInst::Predicate::FCMP_ULT;
     case CmpInst::Predicate::FCMP_ONE:
-      return CmpInst::Predicate::FCMP_OGE;
+      return Inclusive ? CmpInst::Predicate::FCMP_OGT
+                       : CmpInst::Predicate::FCMP_OGE;
     case CmpInst::Predicate::FCMP_UNE:
-      return CmpInst::Predicate::FCMP_UGE;
+      return Inclusive ? CmpInst::Predicate::FCMP_UGT
+                       : CmpInst::Predicate::FCMP_UGE;
     default:
       llvm_unreachable("Unsupported fcmp predicate");
     }
   }();
 
-  // Create the objects and values needed to perform the equality comparison
-  // conversion.
-  Module *M = FCmp->getModule();
-  assert(M && "The given fcmp instruction does not belong to a module");
-  LLVMContext &Ctx = M->getContext();
-  IntegerType *I64Ty = IntegerType::get(Ctx, 64);
-  Type *DoubleTy = Type::getDoubleTy(Ctx);
-
-  // Define the sign-mask and double-precision machine epsilon constants.
-  ConstantInt *SignMask = ConstantInt::get(I64Ty, ~(1L << 63));
-  // The machine epsilon value for IEEE 754 double-precision values is 2 ^ -52
-  // or (b / 2) * b ^ -(p - 1) where b (base) = 2 and p (precision) = 53.
-  APInt EpsilonBits(64, 0x3CB0000000000000);
-  Constant *EpsilonValue =
-      ConstantFP::get(DoubleTy, EpsilonBits.bitsToDouble());
-
-  // Create an IRBuilder with an insertion point set to the given fcmp
-  // instruction.
-  IRBuilder<> Builder(FCmp);
-  // Create the subtraction, casting, absolute value, and new comparison
-  // instructions one at a time.
+  // Create the subtraction and absolute value instructions one at a time. The
+  // operands can be of any floating-point type, including vectors (e.g.
+  // <4 x float>), so use llvm.fabs rather than clearing the sign bit of an
+  // integer. Unlike the latter, llvm.fabs is understood by the vectorizers.
   // %0 = fsub double %a, %b
   auto *FSubInst = Builder.CreateFSub(LHS, RHS);
-  // %1 = bitcast double %0 to i64
-  auto *CastToI64 = Builder.CreateBitCast(FSubInst, I64Ty);
-  // %2 = and i64 %1, 0x7fffffffffffffff
-  auto *AbsValue = Builder.CreateAnd(CastToI64, SignMask);
-  // %3 = bitcast i64 %2 to double
-  auto *CastToDouble = Builder.CreateBitCast(AbsValue, DoubleTy);
-  // %4 = fcmp <olt/ult/oge/uge> double %3, 0x3cb0000000000000
+  // %1 = call double @llvm.fabs.f64(double %0)
+  auto *AbsValue = Builder.CreateUnaryIntrinsic(Intrinsic::fabs, FSubInst);
+
+  // The threshold. For the relative and combined modes, that's computed with
+  // llvm.maxnum rather than with branches:
+  //    %2 = call double @llvm.fabs.f64(double %a)
+  //    %3 = call double @llvm.fabs.f64(double %b)
+  //    %4 = call double @llvm.maxnum.f64(double %2, double %3)
+  //    %5 = fmul double %4, 0x3CB0000000000000
+  //    %6 = call double @llvm.maxnum.f64(double %5, double 0x3CB0000000000000)
+  // (the latter for the combined mode only)
+  Value *Threshold = getEpsilon(LHS->getType());
+  Value *Magnitude = nullptr;
+  if (ToleranceModeOpt != ToleranceMode::Absolute) {
+    auto *AbsLHS = Builder.CreateUnaryIntrinsic(Intrinsic::fabs, LHS);
+    auto *AbsRHS = Builder.CreateUnaryIntrinsic(Intrinsic::fabs, RHS);
+    Magnitude = Builder.CreateMaxNum(AbsLHS, AbsRHS);
+    auto *RelThreshold = Builder.CreateFMul(Magnitude, Threshold);
+    Threshold = ToleranceModeOpt == ToleranceMode::Combined
+                    ? Builder.CreateMaxNum(RelThreshold, Threshold)
+                    : RelThreshold;
+  }
+
+  // For the relative and combined modes:
+  //    %7 = fcmp <oeq/ueq/one/une> double %a, %b
+  //    %8 = fcmp <ole/ule/ogt/ugt> double %1, %6
+  //    %9 = fcmp <one/ueq> double %4, 0x7FF0000000000000
+  //    %10 = and i1 %8, %9   (or i1 for one/une)
+  //    %11 = or i1 %10, %7   (and i1 for one/une)
+  // If either operand is infinite, so is the threshold, and the tolerance
+  // check would hold for e.g. inf == 1.0. It's only used when both operands
+  // are finite, and the infinite cases (including a == b == +/-inf, for which
+  // a - b is NaN) are left to the original comparison.
+  if (ToleranceModeOpt != ToleranceMode::Absolute) {
+    auto *ExactCmp = Builder.CreateFCmp(FCmp->getPredicate(), LHS, RHS);
+    auto *TolCmp = Builder.CreateFCmp(CmpPred, AbsValue, Threshold);
+    auto *Inf = ConstantFP::getInfinity(LHS->getType());
+    bool IsEq = FCmp->getPredicate() == CmpInst::Predicate::FCMP_OEQ ||
+                FCmp->getPredicate() == CmpInst::Predicate::FCMP_UEQ;
+    Value *NewCmp = nullptr;
+    if (IsEq) {
+      auto *IsFinite = Builder.CreateFCmpONE(Magnitude, Inf);
+      NewCmp = Builder.CreateOr(Builder.CreateAnd(TolCmp, IsFinite), ExactCmp);
+    } else {
+      auto *IsInfinite = Builder.CreateFCmpUEQ(Magnitude, Inf);
+      NewCmp =
+          Builder.CreateAnd(Builder.CreateOr(TolCmp, IsInfinite), ExactCmp);
+    }
+    replaceFCmp(FCmp, NewCmp);
+    return NewCmp;
+  }
+
+  // %2 = fcmp <olt/ult/oge/uge> double %1, 0x3cb0000000000000
+  // (<ole/ule/ogt/ugt> for -convert-fcmp-eq-epsilons=0)
   // Rather than creating a new instruction, we'll just change the predicate and
   // operands of the existing fcmp instruction to match what we want.
   FCmp->setPredicate(CmpPred);
-  FCmp->setOperand(0, CastToDouble);
-  FCmp->setOperand(1, EpsilonValue);
+  FCmp->setOperand(0, AbsValue);
+  FCmp->setOperand(1, Threshold);
   return FCmp;
 }
 
@@ -21,14 +21,23 @@
 //        goto BB-if-then
 //      else
 //        goto BB-else
-//    `var` is a randomly chosen variable from the RIV set for BB. If `var`
-//    happens to be a GlobalValue (i.e. global variable), BB won't be
+//    `var` is a randomly chosen variable from the RIV set for BB (see
+//    FunctionRNG - the choice is deterministic for a given -rng-seed). If
+//    `var` happens to be a GlobalValue (i.e. global variable), BB won't be
 //    duplicated. That's because global variables are often constants, and
 //    constant values lead to trivial `if` conditions (e.g. if ( 0 == 0 )).
 //
 //    All newly created basic blocks are suffixed with the original basic
 //    block's numeric ID.
 //
+//    The RIV results are updated as the new blocks are inserted, so this pass
+//    preserves RIV.
+//
+//    With -duplicate-bb-profile-guided, the blocks are only duplicated within
+//    a code size and a cycle budget (per function). The cycle cost of a block
+//    is estimated from its frequency (BlockFrequencyInfo, which is based on
+//    the profile data, if available), so the hot blocks are left out first.
+//
 //  ALGORITHM:
 //    --------------------------------------------------------------------------
 //    The following CFG graph represents function 'F' before and after applying
@@ -82,22 +91,51 @@
 // License: MIT
 //==============================================================================
 #include "DuplicateBB.h"
+#include "FunctionRNG.h"
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
-#include <random>
+#include <numeric>
 
 #define DEBUG_TYPE "duplicate-bb"
 
 STATISTIC(DuplicateBBCountStats, "The # of duplicated blocks");
+STATISTIC(OverBudgetCount,
+          "The # of blocks not duplicated because of the budgets");
 
 using namespace llvm;
 
+//------------------------------------------------------------------------------
+// Command line options
+//------------------------------------------------------------------------------
+static cl::opt<bool> ProfileGuided{
+    "duplicate-bb-profile-guided",
+    cl::desc{"Duplicate the coldest blocks first (according to the block "
+             "frequencies/profile data) and only within the size and cycle "
+             "budgets"},
+    cl::init(false)};
+
+static cl::opt<unsigned> SizeBudget{
+    "duplicate-bb-size-budget",
+    cl::desc{"The maximum code growth per function, in percent of its size "
+             "(with -duplicate-bb-profile-guided)"},
+    cl::value_desc{"percent"}, cl::init(200)};
+
+static cl::opt<unsigned> CycleBudget{
+    "duplicate-bb-cycle-budget",
+    cl::desc{"The maximum growth in the estimated number of instructions "
+             "executed per function call, in percent (with "
+             "-duplicate-bb-profile-guided)"},
+    cl::value_desc{"percent"}, cl::init(10)};
+
 //------------------------------------------------------------------------------
 // DuplicateBB Implementation
 //------------------------------------------------------------------------------
@@ -106,13 +144,10 @@ DuplicateBB::findBBsToDuplicate(Function &F, const RIV::Result &RIVResult) {
   BBToSingleRIVMap BlocksToDuplicate;
 
   // Get a random number generator. This will be used to choose a context
-  // value for the injected `if-then-else` construct.
-  // FIXME Switch to 'F.getParent()->createRNG("DuplicateBB")' once possible.
-  // This patch implements the necessary API:
-  //    * https://reviews.llvm.org/rG73713f3e5ef2ecf1e5afafa89f76ab89cc06b18e
-  // It should be available in LLVM 11.
-  std::random_device RD;
-  std::mt19937_64 RNG(RD());
+  // value for the injected `if-then-else` construct. The stream only depends
+  // on the seed (-rng-seed) and the names of the module and F, so the output
+  // is reproducible.
+  FunctionRNG RNG(F, DEBUG_TYPE);
 
   for (BasicBlock &BB : F) {
     // Basic blocks which are landing pads are used for handling exceptions.
@@ -133,11 +168,7 @@ DuplicateBB::findBBsToDuplicate(Function &F, const RIV::Result &RIVResult) {
 
     // Get a random context value from the RIV set
     auto Iter = ReachableValues.begin();
-//    这段代码是C++中关于随机数生成器的代码。std::uniform_int_distribution<>是C++标准库中的一个类，它用于生成均匀分布的整数。
-//    这段代码中的Dist(0, ReachableValuesCount - 1);创建了一个分布，其范围是从0到ReachableValuesCount - 1。调用这个分布可以返回这个范围内的随机整数。
-//    这个分布生成的随机数具有均匀的概率分布，也就是说，任何值在给定范围内都有相同的可能性被生成
-    std::uniform_int_distribution<> Dist(0, ReachableValuesCount - 1);
-    std::advance(Iter, Dist(RNG));
+    std::advance(Iter, RNG.nextBelow(ReachableValuesCount));
 
     if (dyn_cast<GlobalValue>(*Iter)) {
       LLVM_DEBUG(errs() << "Random context value is a global variable. "
@@ -155,15 +186,88 @@ DuplicateBB::findBBsToDuplicate(Function &F, const RIV::Result &RIVResult) {
   return BlocksToDuplicate;
 }
 
+// Estimates the cost of duplicating BB:
+//  * Size - the number of new instructions (the second clone, the PHI nodes in
+//    lt-tail, the `if-then-else` condition and the branches)
+//  * Cycles - the number of extra instructions per execution of BB (the
+//    `if-then-else` condition, the branches and the PHI nodes)
+static void getDuplicationCost(const BasicBlock &BB, uint64_t &Size,
+                               uint64_t &Cycles) {
+  uint64_t NumCloned = 0, NumValues = 0;
+  for (const Instruction &Inst :
+       make_range(BB.getFirstNonPHI()->getIterator(), BB.end())) {
+    if (Inst.isTerminator())
+      continue;
+    NumCloned++;
+    if (!Inst.getType()->isVoidTy())
+      NumValues++;
+  }
+
+  Size = NumCloned + NumValues + 4;
+  Cycles = NumValues + 3;
+}
+
+DuplicateBB::BBToSingleRIVMap
+DuplicateBB::applyBudgets(Function &F, BBToSingleRIVMap Candidates,
+                          const BlockFrequencyInfo &BFI) {
+  // STEP 1: Compute the budgets. The cycles are estimated as the sum of block
+  // sizes weighted by the block frequencies.
+  uint64_t FuncSize = 0, FuncCycles = 0;
+  for (BasicBlock &BB : F) {
+    FuncSize += BB.size();
+    FuncCycles = SaturatingAdd(
+        FuncCycles, SaturatingMultiply(BFI.getBlockFreq(&BB).getFrequency(),
+                                       static_cast<uint64_t>(BB.size())));
+  }
+  uint64_t SizeLeft =
+      SaturatingMultiply(FuncSize, static_cast<uint64_t>(SizeBudget)) / 100;
+  uint64_t CyclesLeft =
+      SaturatingMultiply(FuncCycles, static_cast<uint64_t>(CycleBudget)) / 100;
+
+  // STEP 2: Pick the blocks, from the coldest to the hottest (blocks with
+  // equal frequencies in program order), while they fit into the budgets
+  auto GetFreq = [&](size_t Idx) {
+    return BFI.getBlockFreq(std::get<0>(Candidates[Idx])).getFrequency();
+  };
+  std::vector<size_t> Order(Candidates.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  llvm::stable_sort(Order, [&](size_t LHS, size_t RHS) {
+    return GetFreq(LHS) < GetFreq(RHS);
+  });
+
+  BitVector Picked(Candidates.size());
+  for (size_t Idx : Order) {
+    uint64_t Size, Cycles;
+    getDuplicationCost(*std::get<0>(Candidates[Idx]), Size, Cycles);
+    Cycles = SaturatingMultiply(Cycles, GetFreq(Idx));
+    if (Size > SizeLeft || Cycles > CyclesLeft) {
+      LLVM_DEBUG(errs() << "Block " << std::get<0>(Candidates[Idx])->getName()
+                        << " is over budget. Skipping this BB\n");
+      OverBudgetCount++;
+      continue;
+    }
+
+    SizeLeft -= Size;
+    CyclesLeft -= Cycles;
+    Picked.set(Idx);
+  }
+
+  // STEP 3: Keep the picked blocks (in program order)
+  BBToSingleRIVMap BlocksToDuplicate;
+  for (size_t Idx : Picked.set_bits())
+    BlocksToDuplicate.push_back(std::move(Candidates[Idx]));
+
+  return BlocksToDuplicate;
+}
+
 void DuplicateBB::cloneBB(BasicBlock &BB, Value *ContextValue,
-                          ValueToPhiMap &ReMapper) {
+                          RIV::Result &RIVResult) {
   // Don't duplicate Phi nodes - start right after them
   Instruction *BBHead = BB.getFirstNonPHI();
 
   // Create the condition for 'if-then-else'
   IRBuilder<> Builder(BBHead);
-  Value *Cond = Builder.CreateIsNull(
-      ReMapper.count(ContextValue) ? ReMapper[ContextValue] : ContextValue);
+  Value *Cond = Builder.CreateIsNull(ContextValue);
 
   // Create and insert the 'if-else' blocks. At this point both blocks are
   // trivial and contain only one terminator instruction branching to BB's
@@ -235,8 +339,6 @@ void DuplicateBB::cloneBB(BasicBlock &BB, Value *ContextValue,
     Phi->addIncoming(ElseClone, ElseTerm->getParent());
     TailVMap[&Instr] = Phi;
 
-    ReMapper[&Instr] = Phi;
-
     // Instructions are modified as we go, use the iterator version of
     // ReplaceInstWithInst.
     ReplaceInstWithInst(Tail, IIT, Phi);
@@ -246,39 +348,51 @@ void DuplicateBB::cloneBB(BasicBlock &BB, Value *ContextValue,
   for (auto *I : ToRemove)
     I->eraseFromParent();
 
+  // Update the RIV results. BB (now `lt-if-then-else`) dominates the other
+  // new blocks and Tail dominates whatever BB used to dominate.
+  RIVResult.splitBlock(&BB, Tail);
+  RIVResult.addBlock(ThenTerm->getParent(), &BB);
+  RIVResult.addBlock(ElseTerm->getParent(), &BB);
+
   ++DuplicateBBCount;
 }
 
 PreservedAnalyses DuplicateBB::run(llvm::Function &F,
                                    llvm::FunctionAnalysisManager &FAM) {
-  BBToSingleRIVMap Targets = findBBsToDuplicate(F, FAM.getResult<RIV>(F));
-
-  // This map is used to keep track of the new bindings. Otherwise, the
-  // information from RIV will become obsolete.
-  ValueToPhiMap ReMapper;
+  auto &RIVResult = FAM.getResult<RIV>(F);
+  BBToSingleRIVMap Targets = findBBsToDuplicate(F, RIVResult);
+  if (ProfileGuided)
+    Targets = applyBudgets(F, std::move(Targets),
+                           FAM.getResult<BlockFrequencyAnalysis>(F));
 
   // Duplicate
   for (auto &BB_Ctx : Targets) {
-    cloneBB(*std::get<0>(BB_Ctx), std::get<1>(BB_Ctx), ReMapper);
+    cloneBB(*std::get<0>(BB_Ctx), std::get<1>(BB_Ctx), RIVResult);
   }
 
   DuplicateBBCountStats = DuplicateBBCount;
-  return (Targets.empty() ? llvm::PreservedAnalyses::all()
-                          : llvm::PreservedAnalyses::none());
+  if (Targets.empty())
+    return llvm::PreservedAnalyses::all();
+
+  // RIV has been kept up to date by cloneBB
+  llvm::PreservedAnalyses PA;
+  PA.preserve<RIV>();
+  return PA;
 }
 
 bool LegacyDuplicateBB::runOnFunction(llvm::Function &F) {
   // Find BBs to duplicate
+  RIV::Result &RIVResult = getAnalysis<LegacyRIV>().RIVMap;
   DuplicateBB::BBToSingleRIVMap Targets =
-      Impl.findBBsToDuplicate(F, getAnalysis<LegacyRIV>().getRIVMap());
-
-  // This map is used to keep track of the new bindings. Otherwise, the
-  // information from RIV will become obsolete.
-  DuplicateBB::ValueToPhiMap ReMapper;
+      Impl.findBBsToDuplicate(F, RIVResult);
+  if (ProfileGuided)
+    Targets = Impl.applyBudgets(
+        F, std::move(Targets),
+        getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI());
 
   // Duplicate
   for (auto &BB_Ctx : Targets) {
-    Impl.cloneBB(*std::get<0>(BB_Ctx), std::get<1>(BB_Ctx), ReMapper);
+    Impl.cloneBB(*std::get<0>(BB_Ctx), std::get<1>(BB_Ctx), RIVResult);
   }
 
   DuplicateBBCountStats = Impl.DuplicateBBCount;
@@ -314,6 +428,10 @@ llvmGetPassPluginInfo() {
 // This method defines how this pass interacts with other passes
 void LegacyDuplicateBB::getAnalysisUsage(AnalysisUsage &Info) const {
   Info.addRequired<LegacyRIV>();
+  if (ProfileGuided)
+    Info.addRequired<BlockFrequencyInfoWrapperPass>();
+  // The RIV results are updated by cloneBB
+  Info.addPreserved<LegacyRIV>();
 }
 
 char LegacyDuplicateBB::ID = 0;
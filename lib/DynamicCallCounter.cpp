@@ -36,6 +36,70 @@
 //    module. Functions that are only _declared_ (and defined elsewhere) are not
 //    counted.
 //
+//    The counters described above are neither thread-safe nor contention-free
+//    (all threads update the same cache line). For multithreaded programs use
+//    `-dynamic-cc-counters=sharded` instead. In this mode the counters are
+//    64-bit wide and stored in `CounterShards`, a 2D array with
+//    `-dynamic-cc-shards` rows (shards). Every row is padded to a multiple of
+//    the cache line size and contains one counter per function:
+//    ```IR
+//      @CounterShards = internal global [16 x [8 x i64]] zeroinitializer,
+//        align 64
+//    ```
+//    On first use, every thread is assigned one of the shards (round-robin,
+//    the index is kept in a `thread_local` variable). Threads only ever
+//    update counters in "their" shard, so unless there are more threads than
+//    shards there's no contention. The counters are incremented with atomic
+//    (monotonic) adds so that the results remain exact even when a shard is
+//    shared:
+//    ```IR
+//      %1 = call i32 @get_counter_shard()
+//      %2 = getelementptr [16 x [8 x i64]], ptr @CounterShards, i32 0, i32 %1,
+//        i32 <index-of-F>
+//      %3 = atomicrmw add ptr %2, i64 1 monotonic, align 8
+//    ```
+//    The shards are summed up in `printf_wrapper`.
+//
+//    Printing the results with one `printf` per function can dominate the
+//    shutdown time for very large modules and the output is not easy to
+//    aggregate. With `-dynamic-cc-output=binary`, `printf_wrapper` is replaced
+//    with `write_profile`. It appends one compact, binary record (see
+//    DynamicCallCounter.h for the format) to the profile file instead. With
+//    the plain counter layout, the call counters are stored in the record
+//    itself (rather than in `CounterFor_F`), so it's written as it is. Use
+//    `dynamic-cc-merge` (tools/DynamicCCMerge.cpp) to merge and print profiles.
+//
+//    Function calls are too coarse to find e.g. hot loops. With
+//    `-dynamic-cc-mode=blocks`, the execution counts of all basic blocks are
+//    reported instead (named `<function>:<block>`). Rather than one counter
+//    per block, counters are only added to the CFG edges that are not in a
+//    spanning tree of the CFG (see planBlockCounters for details). The block
+//    counts are reconstructed from these counters when the results are
+//    printed/written. Both counter layouts and both output formats are
+//    supported in this mode.
+//
+//    Every counter update is a read-modify-write of a global (and possibly
+//    shared) variable. To bound this overhead, pass
+//    `-dynamic-cc-sample-rate=N`. Only one in every N counter updates (on
+//    average) is then performed. This is decided with a per-thread countdown
+//    (i.e. a load, a compare and a store of a thread-local variable) that is
+//    reloaded with a random interval, so that the samples don't alias with
+//    periodic call patterns. The results are multiplied by N when
+//    printed/written (so these are estimates).
+//
+//    By default, the results are only printed/written when the module exits.
+//    Long-running processes can take snapshots of the results instead:
+//      * on demand, by calling `void dynamic_cc_snapshot()` (the instrumented
+//        module needs to declare it, DynamicCallCounter defines it),
+//      * whenever the process receives `-dynamic-cc-snapshot-signal`,
+//      * every `-dynamic-cc-snapshot-interval` seconds.
+//    The latter two are implemented with background threads (POSIX only, the
+//    instrumented program needs to be linked with pthreads). With
+//    `-dynamic-cc-snapshot-delta`, the counters are reset whenever they're
+//    read, so that every snapshot only covers the time since the previous
+//    one. Use the sharded counter layout if the counters might be updated
+//    while a snapshot is taken.
+//
 // USAGE:
 //    1. Legacy pass manager:
 //      $ opt -load <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
@@ -45,20 +109,174 @@
 //      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
 //        -passes=-"dynamic-cc" <bitcode-file> -o instrumentend.bin
 //      $ lli instrumented.bin
+//    3. Thread-safe counters (either pass manager):
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-counters=sharded `\`
+//        [-dynamic-cc-shards=<N>] <bitcode-file> -o instrumentend.bin
+//    4. Binary output (either pass manager):
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-output=binary `\`
+//        [-dynamic-cc-profile=<profile-file>] <bitcode-file> `\`
+//        -o instrumentend.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/dynamic-cc-merge <profile-file>
+//    5. Basic block counts (either pass manager):
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-mode=blocks <bitcode-file> `\`
+//        -o instrumentend.bin
+//      $ lli instrumented.bin
+//    6. Sampling (either pass manager):
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-sample-rate=<N> <bitcode-file> `\`
+//        -o instrumentend.bin
+//      $ lli instrumented.bin
+//    7. Snapshots (either pass manager):
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-snapshot-signal=<signal> `\`
+//        -dynamic-cc-snapshot-interval=<seconds> -dynamic-cc-snapshot-delta `\`
+//        <bitcode-file> -o instrumentend.bin
+//      $ lli instrumented.bin
 //
 // License: MIT
 //========================================================================
 #include "DynamicCallCounter.h"
 
+#include "llvm/ADT/IntEqClasses.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 
+#if LLVM_VERSION_MAJOR >= 17
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/Triple.h"
+#else
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/Host.h"
+#endif
+
+#include <limits>
+#include <numeric>
+#include <tuple>
+
 using namespace llvm;
 
 #define DEBUG_TYPE "dynamic-cc"
 
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+// What the injected counters count
+enum class ProfileMode {
+  // Calls to every function
+  Calls,
+  // Executions of every basic block (derived from edge counters)
+  Blocks
+};
+
+static cl::opt<ProfileMode> ProfileModeOpt{
+    "dynamic-cc-mode",
+    cl::desc("What the code injected by DynamicCallCounter counts"),
+    cl::values(clEnumValN(ProfileMode::Calls, "calls",
+                          "Count the calls to every function"),
+               clEnumValN(ProfileMode::Blocks, "blocks",
+                          "Count the executions of every basic block (using "
+                          "edge counters on a spanning-tree complement)")),
+    cl::init(ProfileMode::Calls)};
+
+// The supported layouts of the call counters
+enum class CounterLayout {
+  // One `i32 CounterFor_<F>` global per function
+  Plain,
+  // Per-thread, cache-line padded shards of i64 counters
+  Sharded
+};
+
+static cl::opt<CounterLayout> CounterLayoutOpt{
+    "dynamic-cc-counters",
+    cl::desc("The layout of the call counters injected by DynamicCallCounter"),
+    cl::values(clEnumValN(CounterLayout::Plain, "plain",
+                          "One i32 counter per function (not thread-safe)"),
+               clEnumValN(CounterLayout::Sharded, "sharded",
+                          "Per-thread shards of i64 counters padded to the "
+                          "cache line size (thread-safe)")),
+    cl::init(CounterLayout::Plain)};
+
+static cl::opt<unsigned> NumCounterShards{
+    "dynamic-cc-shards",
+    cl::desc("The number of counter shards for -dynamic-cc-counters=sharded"),
+    cl::value_desc("shards"), cl::init(16)};
+
+// The supported formats of the results
+enum class OutputFormat {
+  // A table printed with printf
+  Text,
+  // A binary record appended to a profile file (see DynamicCallCounter.h)
+  Binary
+};
+
+static cl::opt<OutputFormat> OutputFormatOpt{
+    "dynamic-cc-output",
+    cl::desc("The format of the results generated by the instrumented module"),
+    cl::values(clEnumValN(OutputFormat::Text, "text",
+                          "Print a table to stdout (one printf per function)"),
+               clEnumValN(OutputFormat::Binary, "binary",
+                          "Append a binary record to the profile file")),
+    cl::init(OutputFormat::Text)};
+
+static cl::opt<std::string> ProfileFileName{
+    "dynamic-cc-profile",
+    cl::desc("The default profile file for -dynamic-cc-output=binary (can be "
+             "overridden at run-time via the DYNAMIC_CC_PROFILE environment "
+             "variable)"),
+    cl::value_desc("filename"), cl::init("dynamic-cc.prof")};
+
+static cl::opt<unsigned> SampleRate{
+    "dynamic-cc-sample-rate",
+    cl::desc("Update the counters only once every N times (the results are "
+             "scaled back up by N)"),
+    cl::value_desc("N"), cl::init(1)};
+
+// The size of a cache line (in bytes) that the counter shards are padded to
+static constexpr unsigned CacheLineSize = 64;
+
+static unsigned getNumCounterShards() {
+  return std::max(1u, NumCounterShards.getValue());
+}
+
+static cl::opt<unsigned> SnapshotSignal{
+    "dynamic-cc-snapshot-signal",
+    cl::desc("Print/write the results whenever the instrumented process "
+             "receives this signal (e.g. 10 for SIGUSR1 on Linux, 0 to "
+             "disable)"),
+    cl::value_desc("signal"), cl::init(0)};
+
+static cl::opt<unsigned> SnapshotInterval{
+    "dynamic-cc-snapshot-interval",
+    cl::desc("Print/write the results every N seconds (0 to disable)"),
+    cl::value_desc("seconds"), cl::init(0)};
+
+static cl::opt<bool> DeltaSnapshots{
+    "dynamic-cc-snapshot-delta",
+    cl::desc("Reset the counters every time the results are printed/written, "
+             "so that every snapshot only covers the period since the "
+             "previous one"),
+    cl::init(false)};
+
+// The name of the function that prints/writes a snapshot of the results
+static constexpr char SnapshotFuncName[] = "dynamic_cc_snapshot";
+
+static unsigned getSampleRate() { return std::max(1u, SampleRate.getValue()); }
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
 Constant *CreateGlobalCounter(Module &M, StringRef GlobalVarName) {
   auto &CTX = M.getContext();
 
@@ -76,55 +294,1099 @@ Constant *CreateGlobalCounter(Module &M, StringRef GlobalVarName) {
   return NewGlobalVar;
 }
 
+// Creates `CounterShards`, a [NumShards x [Stride x i64]] array of counters,
+// where Stride is NumFuncs rounded up so that every shard starts at a cache
+// line boundary.
+static GlobalVariable *CreateCounterShards(Module &M, unsigned NumFuncs) {
+  auto &CTX = M.getContext();
+
+  uint64_t CountersPerLine = CacheLineSize / sizeof(uint64_t);
+  auto *ShardTy =
+      ArrayType::get(Type::getInt64Ty(CTX), alignTo(NumFuncs, CountersPerLine));
+  auto *ShardsTy = ArrayType::get(ShardTy, getNumCounterShards());
+
+  auto *Shards = new GlobalVariable(M, ShardsTy, /*isConstant=*/false,
+                                    GlobalValue::InternalLinkage,
+                                    Constant::getNullValue(ShardsTy),
+                                    "CounterShards");
+  Shards->setAlignment(Align(CacheLineSize));
+
+  return Shards;
+}
+
+// Defines `get_counter_shard`, a function that returns the index of the
+// counter shard assigned to the calling thread. Shards are assigned
+// round-robin, the first time a thread calls this function. It is equivalent
+// to the following C function:
+// ```
+//    static thread_local unsigned CounterShardIdx = 0;
+//    static unsigned NextCounterShard = 0;
+//    unsigned get_counter_shard() {
+//      if (CounterShardIdx == 0)
+//        CounterShardIdx =
+//          atomic_fetch_add(&NextCounterShard, 1) % NumShards + 1;
+//      return CounterShardIdx - 1;
+//    }
+// ```
+static Function *CreateGetCounterShard(Module &M) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+
+  // 0 means "no shard assigned yet", otherwise this is "shard index + 1"
+  auto *ShardIdx = new GlobalVariable(
+      M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Ty, 0), "CounterShardIdx", /*InsertBefore=*/nullptr,
+      GlobalValue::GeneralDynamicTLSModel);
+  auto *NextShard = new GlobalVariable(
+      M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Ty, 0), "NextCounterShard");
+
+  Function *GetShardF =
+      Function::Create(FunctionType::get(Int32Ty, /*isVarArg=*/false),
+                       GlobalValue::InternalLinkage, "get_counter_shard", M);
+  GetShardF->addFnAttr(Attribute::AlwaysInline);
+  GetShardF->setDoesNotThrow();
+
+  BasicBlock *Entry = BasicBlock::Create(CTX, "entry", GetShardF);
+  BasicBlock *Assign = BasicBlock::Create(CTX, "assign", GetShardF);
+  BasicBlock *Done = BasicBlock::Create(CTX, "done", GetShardF);
+
+  // Every thread takes the `assign` path only once
+  IRBuilder<> Builder(Entry);
+  Value *Idx = Builder.CreateLoad(Int32Ty, ShardIdx);
+  Builder.CreateCondBr(Builder.CreateICmpNE(Idx, Builder.getInt32(0)), Done,
+                       Assign,
+                       MDBuilder(CTX).createBranchWeights(
+                           /*TrueWeight=*/1 << 20, /*FalseWeight=*/1));
+
+  Builder.SetInsertPoint(Assign);
+  Value *Next =
+      Builder.CreateAtomicRMW(AtomicRMWInst::Add, NextShard,
+                              Builder.getInt32(1), MaybeAlign(4),
+                              AtomicOrdering::Monotonic);
+  Value *NewIdx = Builder.CreateAdd(
+      Builder.CreateURem(Next, Builder.getInt32(getNumCounterShards())),
+      Builder.getInt32(1));
+  Builder.CreateStore(NewIdx, ShardIdx);
+  Builder.CreateBr(Done);
+
+  Builder.SetInsertPoint(Done);
+  PHINode *AssignedIdx = Builder.CreatePHI(Int32Ty, 2);
+  AssignedIdx->addIncoming(Idx, Entry);
+  AssignedIdx->addIncoming(NewIdx, Assign);
+  Builder.CreateRet(Builder.CreateSub(AssignedIdx, Builder.getInt32(1)));
+
+  return GetShardF;
+}
+
+// Defines `sum_counter_shards`, a function that takes the index of a counter
+// and returns the sum of its values across all shards. With
+// -dynamic-cc-snapshot-delta, the counters are also reset.
+static Function *CreateSumCounterShards(Module &M, GlobalVariable *Shards) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+
+  Function *SumF = Function::Create(
+      FunctionType::get(Int64Ty, {Int32Ty}, /*isVarArg=*/false),
+      GlobalValue::InternalLinkage, "sum_counter_shards", M);
+  Argument *FuncIdx = SumF->getArg(0);
+
+  BasicBlock *Entry = BasicBlock::Create(CTX, "entry", SumF);
+  BasicBlock *Loop = BasicBlock::Create(CTX, "loop", SumF);
+  BasicBlock *Exit = BasicBlock::Create(CTX, "exit", SumF);
+
+  IRBuilder<> Builder(Entry);
+  Builder.CreateBr(Loop);
+
+  Builder.SetInsertPoint(Loop);
+  PHINode *Shard = Builder.CreatePHI(Int32Ty, 2);
+  PHINode *Sum = Builder.CreatePHI(Int64Ty, 2);
+  Value *CounterPtr = Builder.CreateGEP(Shards->getValueType(), Shards,
+                                        {Builder.getInt32(0), Shard, FuncIdx});
+  // Other threads may still be running, hence the atomic load (or exchange)
+  Value *Count = nullptr;
+  if (DeltaSnapshots) {
+    Count = Builder.CreateAtomicRMW(AtomicRMWInst::Xchg, CounterPtr,
+                                    Builder.getInt64(0), MaybeAlign(8),
+                                    AtomicOrdering::Monotonic);
+  } else {
+    LoadInst *Load = Builder.CreateLoad(Int64Ty, CounterPtr);
+    Load->setAtomic(AtomicOrdering::Monotonic);
+    Load->setAlignment(Align(8));
+    Count = Load;
+  }
+  Value *NewSum = Builder.CreateAdd(Sum, Count);
+  Value *NextShard = Builder.CreateAdd(Shard, Builder.getInt32(1));
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(NextShard, Builder.getInt32(getNumCounterShards())),
+      Exit, Loop);
+
+  Shard->addIncoming(Builder.getInt32(0), Entry);
+  Shard->addIncoming(NextShard, Loop);
+  Sum->addIncoming(Builder.getInt64(0), Entry);
+  Sum->addIncoming(NewSum, Loop);
+
+  Builder.SetInsertPoint(Exit);
+  Builder.CreateRet(NewSum);
+
+  return SumF;
+}
+
+// Creates `SampleCountdown`, the number of counter updates to skip before the
+// next one is sampled. It is thread_local, so that the common (not sampled)
+// path doesn't touch any memory shared with other threads.
+static GlobalVariable *CreateSampleCountdown(Module &M) {
+  Type *Int32Ty = Type::getInt32Ty(M.getContext());
+  return new GlobalVariable(
+      M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Ty, 0), "SampleCountdown", /*InsertBefore=*/nullptr,
+      GlobalValue::GeneralDynamicTLSModel);
+}
+
+// Defines `reload_sample_countdown`, a function that sets SampleCountdown to
+// a random number in [0, 2 * SampleRate - 2]. On average, one in every
+// SampleRate updates is sampled then, but (unlike with a fixed interval) the
+// samples can't be in lockstep with a periodic pattern of calls. It's only
+// called on the sampled path and is equivalent to the following C function
+// (xorshift32, the state is thread_local for the same reason as the
+// countdown):
+// ```
+//    static thread_local uint32_t SampleRNG = 2463534242;
+//    void reload_sample_countdown() {
+//      SampleRNG ^= SampleRNG << 13;
+//      SampleRNG ^= SampleRNG >> 17;
+//      SampleRNG ^= SampleRNG << 5;
+//      SampleCountdown = SampleRNG % (2 * SampleRate - 1);
+//    }
+// ```
+static Function *CreateReloadSampleCountdown(Module &M,
+                                             GlobalVariable *Countdown) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+
+  auto *RNG = new GlobalVariable(
+      M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Ty, 2463534242u), "SampleRNG",
+      /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+
+  Function *ReloadF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), /*isVarArg=*/false),
+      GlobalValue::InternalLinkage, "reload_sample_countdown", M);
+  // Keep the (rarely executed) body out of the instrumented functions
+  ReloadF->addFnAttr(Attribute::NoInline);
+  ReloadF->addFnAttr(Attribute::Cold);
+  ReloadF->setDoesNotThrow();
+
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", ReloadF));
+  Value *State = Builder.CreateLoad(Int32Ty, RNG);
+  State = Builder.CreateXor(State, Builder.CreateShl(State, 13));
+  State = Builder.CreateXor(State, Builder.CreateLShr(State, 17));
+  State = Builder.CreateXor(State, Builder.CreateShl(State, 5));
+  Builder.CreateStore(State, RNG);
+
+  uint64_t Span = std::min<uint64_t>(2 * (uint64_t)getSampleRate() - 1,
+                                     std::numeric_limits<uint32_t>::max());
+  Builder.CreateStore(Builder.CreateURem(State, Builder.getInt32(Span)),
+                      Countdown);
+  Builder.CreateRetVoid();
+
+  return ReloadF;
+}
+
+// The indices of the Flags and the Counters fields of `DynamicCCProfile`
+static constexpr unsigned ProfileFlagsField = 2;
+static constexpr unsigned ProfileCountersField = 6;
+
+// Returns the flags of the binary profile records (dynamic_cc::ProfileFlag*)
+// written by the instrumented module
+static uint32_t getProfileFlags() {
+  uint32_t Flags = dynamic_cc::ProfileFlagRunStart;
+  if (ProfileModeOpt == ProfileMode::Blocks)
+    Flags |= dynamic_cc::ProfileFlagBlocks;
+  if (DeltaSnapshots)
+    Flags |= dynamic_cc::ProfileFlagDelta;
+  return Flags;
+}
+
+// Creates `DynamicCCProfile`, the binary profile record (see
+// DynamicCallCounter.h) for counters with the given names. The record is a
+// single global that lives in a dedicated section. Everything apart from the
+// counters is known at compile time.
+static GlobalVariable *CreateProfileRecord(Module &M,
+                                           ArrayRef<std::string> Names) {
+  auto &CTX = M.getContext();
+  Type *Int8Ty = Type::getInt8Ty(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+
+  // NUL-terminated names, padded so that the counters are 8-byte aligned
+  std::string NameTable;
+  for (const std::string &Name : Names) {
+    NameTable += Name;
+    NameTable.push_back('\0');
+  }
+  NameTable.resize(alignTo(NameTable.size(), 8), '\0');
+
+  Constant *NamesInit =
+      ConstantDataArray::getString(CTX, NameTable, /*AddNull=*/false);
+  auto *CountersTy = ArrayType::get(Int64Ty, Names.size());
+  StructType *ProfileTy = StructType::get(
+      CTX, {ArrayType::get(Int8Ty, 8), Int32Ty, Int32Ty, Int64Ty, Int64Ty,
+            NamesInit->getType(), CountersTy});
+  Constant *ProfileInit = ConstantStruct::get(
+      ProfileTy,
+      {ConstantDataArray::getString(CTX, dynamic_cc::ProfileMagic,
+                                    /*AddNull=*/false),
+       ConstantInt::get(Int32Ty, dynamic_cc::ProfileVersion),
+       ConstantInt::get(Int32Ty, getProfileFlags()),
+       ConstantInt::get(Int64Ty, Names.size()),
+       ConstantInt::get(Int64Ty, NameTable.size()), NamesInit,
+       Constant::getNullValue(CountersTy)});
+
+  auto *Profile = new GlobalVariable(M, ProfileTy, /*isConstant=*/false,
+                                     GlobalValue::InternalLinkage, ProfileInit,
+                                     "DynamicCCProfile");
+  Profile->setAlignment(Align(8));
+  Profile->setSection(Triple(M.getTargetTriple()).isOSBinFormatMachO()
+                          ? "__DATA,__lt_dcc_prof"
+                          : "lt_dcc_prof");
+
+  return Profile;
+}
+
+// Defines `write_profile`, a function that appends Profile (see
+// CreateProfileRecord) to the profile file with one call to `fwrite`:
+// ```
+//    void write_profile() {
+//      <FillCounters>
+//      const char *Path = getenv("DYNAMIC_CC_PROFILE");
+//      FILE *Profile = fopen(Path ? Path : "<-dynamic-cc-profile>", "ab");
+//      if (Profile) {
+//        fwrite(&DynamicCCProfile, sizeof(DynamicCCProfile), 1, Profile);
+//        fclose(Profile);
+//        DynamicCCProfile.Flags &= ~ProfileFlagRunStart;
+//      }
+//    }
+// ```
+// FillCounters generates the code that stores the current results in
+// DynamicCCProfile.Counters (passed as the second argument). Without
+// FillCounters, the counters are updated in place, i.e. the record is always
+// up to date. With -dynamic-cc-snapshot-delta, such counters are reset once
+// they've been written.
+static Function *
+CreateProfileWriter(Module &M, GlobalVariable *Profile,
+                    function_ref<void(IRBuilder<> &, Value *)> FillCounters) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *SizeTy = M.getDataLayout().getIntPtrType(CTX);
+  PointerType *PtrTy = PointerType::getUnqual(Type::getInt8Ty(CTX));
+  StructType *ProfileTy = cast<StructType>(Profile->getValueType());
+
+  // STEP 1: Declare the required libc functions
+  // -------------------------------------------
+  FunctionCallee Getenv = M.getOrInsertFunction(
+      "getenv", FunctionType::get(PtrTy, {PtrTy}, /*isVarArg=*/false));
+  FunctionCallee Fopen = M.getOrInsertFunction(
+      "fopen", FunctionType::get(PtrTy, {PtrTy, PtrTy}, /*isVarArg=*/false));
+  FunctionCallee Fwrite = M.getOrInsertFunction(
+      "fwrite", FunctionType::get(SizeTy, {PtrTy, SizeTy, SizeTy, PtrTy},
+                                  /*isVarArg=*/false));
+  FunctionCallee Fclose = M.getOrInsertFunction(
+      "fclose", FunctionType::get(Int32Ty, {PtrTy}, /*isVarArg=*/false));
+
+  // STEP 2: Define write_profile
+  // ----------------------------
+  Function *WriterF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), /*isVarArg=*/false),
+      GlobalValue::InternalLinkage, "write_profile", M);
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", WriterF));
+  Value *CountersPtr =
+      Builder.CreateStructGEP(ProfileTy, Profile, ProfileCountersField);
+  if (FillCounters)
+    FillCounters(Builder, CountersPtr);
+
+  BasicBlock *Write = BasicBlock::Create(CTX, "write", WriterF);
+  BasicBlock *Exit = BasicBlock::Create(CTX, "exit", WriterF);
+  Value *EnvPath =
+      Builder.CreateCall(Getenv, {Builder.CreateGlobalStringPtr(
+                                     "DYNAMIC_CC_PROFILE", "ProfileEnvVar")});
+  Value *Path = Builder.CreateSelect(
+      Builder.CreateIsNull(EnvPath),
+      Builder.CreateGlobalStringPtr(ProfileFileName, "ProfileFileName"),
+      EnvPath);
+  Value *File =
+      Builder.CreateCall(Fopen, {Path, Builder.CreateGlobalStringPtr("ab")});
+  Builder.CreateCondBr(Builder.CreateIsNull(File), Exit, Write);
+
+  Builder.SetInsertPoint(Write);
+  Builder.CreateCall(
+      Fwrite,
+      {Builder.CreatePointerCast(Profile, PtrTy),
+       ConstantInt::get(SizeTy,
+                        M.getDataLayout().getTypeAllocSize(ProfileTy)),
+       ConstantInt::get(SizeTy, 1), File});
+  Builder.CreateCall(Fclose, {File});
+  // Only the first record of every run is marked as such (write_profile is
+  // never called concurrently, see CreateSnapshotFunction)
+  Builder.CreateStore(
+      Builder.getInt32(getProfileFlags() & ~dynamic_cc::ProfileFlagRunStart),
+      Builder.CreateStructGEP(ProfileTy, Profile, ProfileFlagsField));
+  if (!FillCounters && DeltaSnapshots)
+    Builder.CreateMemSet(
+        CountersPtr, Builder.getInt8(0),
+        M.getDataLayout().getTypeAllocSize(
+            ProfileTy->getElementType(ProfileCountersField)),
+        Align(8));
+  Builder.CreateBr(Exit);
+
+  Builder.SetInsertPoint(Exit);
+  Builder.CreateRetVoid();
+
+  return WriterF;
+}
+
+// Defines `dynamic_cc_snapshot`, an external function that calls DumpF (i.e.
+// prints/writes the current results). The instrumented program can call it
+// directly, it's also called by the snapshot threads (see
+// CreateSnapshotThreads) and when the program exits. Concurrent snapshots are
+// serialised with a spin lock. It's equivalent to the following C function:
+// ```
+//    static int SnapshotLock = 0;
+//    void dynamic_cc_snapshot() {
+//      while (atomic_exchange(&SnapshotLock, 1))
+//        ;
+//      DumpF();
+//      atomic_store(&SnapshotLock, 0);
+//    }
+// ```
+static Function *CreateSnapshotFunction(Module &M, Function *DumpF) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+
+  auto *Lock = new GlobalVariable(M, Int32Ty, /*isConstant=*/false,
+                                  GlobalValue::InternalLinkage,
+                                  ConstantInt::get(Int32Ty, 0), "SnapshotLock");
+
+  // The module may already declare this function (if it calls it)
+  auto *SnapshotF = cast<Function>(
+      M.getOrInsertFunction(SnapshotFuncName, Type::getVoidTy(CTX))
+          .getCallee());
+  BasicBlock *Entry = BasicBlock::Create(CTX, "entry", SnapshotF);
+  BasicBlock *Acquire = BasicBlock::Create(CTX, "acquire", SnapshotF);
+  BasicBlock *Dump = BasicBlock::Create(CTX, "dump", SnapshotF);
+
+  IRBuilder<> Builder(Entry);
+  Builder.CreateBr(Acquire);
+
+  Builder.SetInsertPoint(Acquire);
+  Value *WasLocked = Builder.CreateAtomicRMW(
+      AtomicRMWInst::Xchg, Lock, Builder.getInt32(1), MaybeAlign(4),
+      AtomicOrdering::Acquire);
+  Builder.CreateCondBr(Builder.CreateICmpNE(WasLocked, Builder.getInt32(0)),
+                       Acquire, Dump);
+
+  Builder.SetInsertPoint(Dump);
+  Builder.CreateCall(DumpF);
+  StoreInst *Unlock = Builder.CreateStore(Builder.getInt32(0), Lock);
+  Unlock->setAtomic(AtomicOrdering::Release);
+  Unlock->setAlignment(Align(4));
+  Builder.CreateRetVoid();
+
+  return SnapshotF;
+}
+
+// Defines `start_snapshot_threads`, a constructor that starts the threads
+// that call SnapshotF when the process receives -dynamic-cc-snapshot-signal
+// and/or every -dynamic-cc-snapshot-interval seconds. The signal is blocked
+// (in the main thread and hence in all threads created later) and received
+// synchronously with `sigwait`, so SnapshotF doesn't need to be
+// async-signal-safe. This is equivalent to the following C code:
+// ```
+//    void *signal_snapshot_thread(void *) {
+//      sigset_t Set; int Sig;
+//      sigemptyset(&Set); sigaddset(&Set, <signal>);
+//      for (;;)
+//        if (sigwait(&Set, &Sig) == 0)
+//          dynamic_cc_snapshot();
+//    }
+//    void *timer_snapshot_thread(void *) {
+//      for (;;) {
+//        sleep(<interval>);
+//        dynamic_cc_snapshot();
+//      }
+//    }
+//    void start_snapshot_threads() {
+//      sigset_t Set; pthread_t Thread;
+//      sigemptyset(&Set); sigaddset(&Set, <signal>);
+//      pthread_sigmask(SIG_BLOCK, &Set, NULL);
+//      if (pthread_create(&Thread, NULL, signal_snapshot_thread, NULL) == 0)
+//        pthread_detach(Thread);
+//      if (pthread_create(&Thread, NULL, timer_snapshot_thread, NULL) == 0)
+//        pthread_detach(Thread);
+//    }
+// ```
+// Only POSIX targets are supported.
+static Function *CreateSnapshotThreads(Module &M, Function *SnapshotF) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *VoidTy = Type::getVoidTy(CTX);
+  // pthread_t is either an integer or a pointer (both are pointer-sized)
+  Type *ThreadTy = M.getDataLayout().getIntPtrType(CTX);
+  PointerType *PtrTy = PointerType::getUnqual(Type::getInt8Ty(CTX));
+  // Large enough for sigset_t on all supported platforms
+  Type *SigSetTy = ArrayType::get(Type::getInt8Ty(CTX), 128);
+  // The value of SIG_BLOCK differs between platforms
+  Triple TT(M.getTargetTriple().empty() ? sys::getDefaultTargetTriple()
+                                        : M.getTargetTriple());
+  int SigBlock = TT.isOSLinux() ? 0 : 1;
+
+  FunctionType *ThreadFuncTy = FunctionType::get(PtrTy, {PtrTy}, false);
+  FunctionCallee SigEmptySet =
+      M.getOrInsertFunction("sigemptyset", Int32Ty, PtrTy);
+  FunctionCallee SigAddSet =
+      M.getOrInsertFunction("sigaddset", Int32Ty, PtrTy, Int32Ty);
+  FunctionCallee SigWait =
+      M.getOrInsertFunction("sigwait", Int32Ty, PtrTy, PtrTy);
+  FunctionCallee PthreadSigmask = M.getOrInsertFunction(
+      "pthread_sigmask", Int32Ty, Int32Ty, PtrTy, PtrTy);
+  FunctionCallee PthreadCreate =
+      M.getOrInsertFunction("pthread_create", Int32Ty, PtrTy, PtrTy,
+                            PointerType::getUnqual(ThreadFuncTy), PtrTy);
+  FunctionCallee PthreadDetach =
+      M.getOrInsertFunction("pthread_detach", Int32Ty, ThreadTy);
+  FunctionCallee Sleep = M.getOrInsertFunction("sleep", Int32Ty, Int32Ty);
+
+  auto CreateSigSet = [&](IRBuilder<> &Builder) {
+    AllocaInst *SetAlloca = Builder.CreateAlloca(SigSetTy, nullptr, "set");
+    SetAlloca->setAlignment(Align(8));
+    Value *Set = Builder.CreatePointerCast(SetAlloca, PtrTy);
+    Builder.CreateCall(SigEmptySet, {Set});
+    Builder.CreateCall(SigAddSet, {Set, Builder.getInt32(SnapshotSignal)});
+    return Set;
+  };
+
+  Function *CtorF =
+      Function::Create(FunctionType::get(VoidTy, false),
+                       GlobalValue::InternalLinkage, "start_snapshot_threads", M);
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", CtorF));
+  Value *Thread = Builder.CreateAlloca(ThreadTy, nullptr, "thread");
+
+  // Starts (and detaches) a thread that runs ThreadF
+  auto StartThread = [&](Function *ThreadF) {
+    BasicBlock *Detach = BasicBlock::Create(CTX, "detach", CtorF);
+    BasicBlock *Next = BasicBlock::Create(CTX, "next", CtorF);
+    Value *Err = Builder.CreateCall(
+        PthreadCreate, {Builder.CreatePointerCast(Thread, PtrTy),
+                        Constant::getNullValue(PtrTy), ThreadF,
+                        Constant::getNullValue(PtrTy)});
+    Builder.CreateCondBr(Builder.CreateICmpEQ(Err, Builder.getInt32(0)),
+                         Detach, Next);
+    Builder.SetInsertPoint(Detach);
+    Builder.CreateCall(PthreadDetach, {Builder.CreateLoad(ThreadTy, Thread)});
+    Builder.CreateBr(Next);
+    Builder.SetInsertPoint(Next);
+  };
+
+  if (SnapshotSignal) {
+    Function *ThreadF = Function::Create(ThreadFuncTy,
+                                         GlobalValue::InternalLinkage,
+                                         "signal_snapshot_thread", M);
+    BasicBlock *Entry = BasicBlock::Create(CTX, "entry", ThreadF);
+    BasicBlock *Wait = BasicBlock::Create(CTX, "wait", ThreadF);
+    BasicBlock *Snapshot = BasicBlock::Create(CTX, "snapshot", ThreadF);
+    IRBuilder<> ThreadBuilder(Entry);
+    Value *Sig = ThreadBuilder.CreatePointerCast(
+        ThreadBuilder.CreateAlloca(Int32Ty, nullptr, "sig"), PtrTy);
+    Value *Set = CreateSigSet(ThreadBuilder);
+    ThreadBuilder.CreateBr(Wait);
+    ThreadBuilder.SetInsertPoint(Wait);
+    Value *Err = ThreadBuilder.CreateCall(SigWait, {Set, Sig});
+    ThreadBuilder.CreateCondBr(
+        ThreadBuilder.CreateICmpEQ(Err, ThreadBuilder.getInt32(0)), Snapshot,
+        Wait);
+    ThreadBuilder.SetInsertPoint(Snapshot);
+    ThreadBuilder.CreateCall(SnapshotF);
+    ThreadBuilder.CreateBr(Wait);
+
+    // Block the signal in this (and all future) threads
+    Builder.CreateCall(PthreadSigmask,
+                       {Builder.getInt32(SigBlock), CreateSigSet(Builder),
+                        Constant::getNullValue(PtrTy)});
+    StartThread(ThreadF);
+  }
+
+  if (SnapshotInterval) {
+    Function *ThreadF = Function::Create(ThreadFuncTy,
+                                         GlobalValue::InternalLinkage,
+                                         "timer_snapshot_thread", M);
+    BasicBlock *Entry = BasicBlock::Create(CTX, "entry", ThreadF);
+    BasicBlock *Loop = BasicBlock::Create(CTX, "loop", ThreadF);
+    IRBuilder<> ThreadBuilder(Entry);
+    ThreadBuilder.CreateBr(Loop);
+    ThreadBuilder.SetInsertPoint(Loop);
+    ThreadBuilder.CreateCall(Sleep, {ThreadBuilder.getInt32(SnapshotInterval)});
+    ThreadBuilder.CreateCall(SnapshotF);
+    ThreadBuilder.CreateBr(Loop);
+
+    StartThread(ThreadF);
+  }
+
+  Builder.CreateRetVoid();
+  return CtorF;
+}
+
+// Makes sure that DumpF (the function that prints/writes the results) is
+// called when the module exits and, if requested, whenever a snapshot is
+// taken.
+static void ScheduleDumps(Module &M, Function *DumpF) {
+  // Snapshots are only required if the module asks for them or if one of the
+  // triggers is enabled
+  Function *SnapshotDecl = M.getFunction(SnapshotFuncName);
+  bool NeedsSnapshots = (SnapshotDecl && SnapshotDecl->isDeclaration()) ||
+                        SnapshotSignal || SnapshotInterval;
+  if (!NeedsSnapshots) {
+    appendToGlobalDtors(M, DumpF, /*Priority=*/0);
+    return;
+  }
+
+  Function *SnapshotF = CreateSnapshotFunction(M, DumpF);
+  appendToGlobalDtors(M, SnapshotF, /*Priority=*/0);
+  if (SnapshotSignal || SnapshotInterval)
+    appendToGlobalCtors(M, CreateSnapshotThreads(M, SnapshotF),
+                        /*Priority=*/0);
+}
+
+// A counter injected by DynamicCallCounter
+struct CounterSite {
+  // The counter is incremented right before this instruction
+  Instruction *InsertPt;
+  // Used to name the counter variable (`CounterFor_<Name>`)
+  std::string Name;
+};
+
+// A linear combination of counters, sum(Coeff * Counter), stored as
+// (counter index, Coeff) pairs. This is how the reported results (e.g. block
+// counts) are computed from the counters.
+using CounterExpr = SmallVector<std::pair<unsigned, int64_t>, 2>;
+
+// Returns the instruction in BB that a counter at the start of BB is inserted
+// before. In the entry block, that's after the static allocas: with sampling,
+// the block is split at the counter, and the allocas moved into the tail would
+// become dynamic allocas (which, e.g., SROA and the inliner can't handle).
+static Instruction *getBlockStartInsertPt(BasicBlock &BB) {
+  BasicBlock::iterator InsertPt = BB.getFirstInsertionPt();
+  if (BB.isEntryBlock())
+    while (isa<AllocaInst>(*InsertPt) &&
+           cast<AllocaInst>(*InsertPt).isStaticAlloca())
+      ++InsertPt;
+  return &*InsertPt;
+}
+
+// Returns the name under which the execution count of BB is reported
+static std::string getBlockName(const BasicBlock &BB, unsigned BBIdx) {
+  std::string Name = BB.getParent()->getName().str() + ":";
+  if (BB.hasName())
+    return Name + BB.getName().str();
+  return Name + "bb" + std::to_string(BBIdx);
+}
+
+// Decides where to insert the counters required to compute the execution
+// counts of all basic blocks in F (and inserts them into Counters). The
+// corresponding results are appended to Names and Counts.
+//
+// Instead of counting every block, this counts control-flow edges. F is
+// viewed as a graph with one extra, virtual vertex that's connected with the
+// entry block (calls) and with every block that leaves F (returns). For every
+// vertex, the number of times it's entered equals the number of times it's
+// left. Hence, once a spanning tree of this graph is selected, the counts of
+// the tree edges can be derived from the counts of the remaining edges and
+// only the latter need counters (Knuth, "The Art of Computer Programming",
+// Vol. 1, 2.3.4.1). To keep the overhead low, the tree is built from the
+// "hottest" edges first (i.e. the ones nested deepest in loops). Edges that
+// can't be instrumented (e.g. critical edges out of an `indirectbr`) are
+// added to the tree first.
+//
+// The block counts are sums of the counts of their incoming edges. These are
+// expressed as linear combinations of counters at compile-time, so the
+// instrumented module only needs to add them up when printing the results.
+// Note that for functions that are left via unwinding or longjmp (rather than
+// a return), the reconstructed counts are approximate.
+static void planBlockCounters(Function &F, std::vector<CounterSite> &Counters,
+                              std::vector<std::string> &Names,
+                              std::vector<CounterExpr> &Counts) {
+  // Block <--> vertex index (0 is the virtual vertex)
+  DenseMap<BasicBlock *, unsigned> VertexIdx;
+  for (BasicBlock &BB : F) {
+    VertexIdx[&BB] = VertexIdx.size() + 1;
+    Names.push_back(getBlockName(BB, VertexIdx.size()));
+  }
+
+  struct CFGEdge {
+    // nullptr means the virtual vertex
+    BasicBlock *Src;
+    BasicBlock *Dst;
+    unsigned SuccIdx;
+    // The loop depth of this edge (used as its expected "hotness")
+    unsigned Depth;
+    bool CanInstrument;
+    // The counter for this edge requires a new basic block ...
+    bool NeedsSplit;
+    // ... or is inserted at the end of Src (otherwise at the start of Dst)
+    bool AtSrc;
+    bool InTree;
+  };
+  std::vector<CFGEdge> Edges;
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  BasicBlock *Entry = &F.getEntryBlock();
+  Edges.push_back({nullptr, Entry, 0, 0, true, false, false, false});
+  for (BasicBlock &BB : F) {
+    Instruction *TI = BB.getTerminator();
+    if (TI->getNumSuccessors() == 0)
+      Edges.push_back({&BB, nullptr, 0, 0, true, false, true, false});
+
+    // Multiple edges to the same successor are counted as one
+    SmallPtrSet<BasicBlock *, 4> Visited;
+    for (unsigned SuccIdx = 0; SuccIdx < TI->getNumSuccessors(); SuccIdx++) {
+      BasicBlock *Succ = TI->getSuccessor(SuccIdx);
+      if (!Visited.insert(Succ).second)
+        continue;
+
+      bool InSrc = BB.getUniqueSuccessor() == Succ && !TI->isEHPad();
+      bool InDst = Succ->getUniquePredecessor() == &BB &&
+                   Succ->getFirstInsertionPt() != Succ->end();
+      bool CanSplit = !isa<IndirectBrInst>(TI) && !isa<CallBrInst>(TI) &&
+                      !Succ->isEHPad();
+      Edges.push_back({&BB, Succ, SuccIdx,
+                       std::min(LI.getLoopDepth(&BB), LI.getLoopDepth(Succ)),
+                       InSrc || InDst || CanSplit, !InSrc && !InDst, InSrc,
+                       false});
+    }
+  }
+
+  auto GetVertex = [&](BasicBlock *BB) { return BB ? VertexIdx[BB] : 0; };
+
+  // STEP 1: Select the spanning tree
+  // --------------------------------
+  SmallVector<unsigned, 16> Order(Edges.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  std::stable_sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+    const CFGEdge &EA = Edges[A], &EB = Edges[B];
+    return std::make_tuple(EA.CanInstrument, -(int)EA.Depth, !EA.NeedsSplit) <
+           std::make_tuple(EB.CanInstrument, -(int)EB.Depth, !EB.NeedsSplit);
+  });
+
+  IntEqClasses Components(VertexIdx.size() + 1);
+  for (unsigned EdgeIdx : Order) {
+    CFGEdge &E = Edges[EdgeIdx];
+    unsigned Src = GetVertex(E.Src), Dst = GetVertex(E.Dst);
+    if (Components.findLeader(Src) == Components.findLeader(Dst))
+      continue;
+    Components.join(Src, Dst);
+    E.InTree = true;
+  }
+
+  // If some of the remaining edges can't be instrumented, fall back to
+  // counting the entry block only
+  if (any_of(Edges, [](const CFGEdge &E) {
+        return !E.InTree && !E.CanInstrument;
+      })) {
+    Names.resize(Names.size() - VertexIdx.size() + 1);
+    Counts.push_back({{(unsigned)Counters.size(), 1}});
+    Counters.push_back({getBlockStartInsertPt(*Entry), F.getName().str()});
+    return;
+  }
+
+  // STEP 2: Express the count of every edge via the counters
+  // --------------------------------------------------------
+  // Edge <--> its count as coefficients of the counters of F
+  unsigned NumCounters = count_if(Edges, [](CFGEdge &E) { return !E.InTree; });
+  std::vector<SmallVector<int64_t, 8>> EdgeCounts(
+      Edges.size(), SmallVector<int64_t, 8>(NumCounters, 0));
+  SmallVector<bool, 16> IsKnown(Edges.size(), false);
+  // Vertex <--> incident edges (self-loops are listed once)
+  std::vector<SmallVector<unsigned, 4>> Incident(VertexIdx.size() + 1);
+  // Vertex <--> the number of incident edges with unknown counts
+  SmallVector<unsigned, 16> NumUnknown(VertexIdx.size() + 1, 0);
+
+  unsigned CounterIdx = 0;
+  for (unsigned EdgeIdx = 0; EdgeIdx < Edges.size(); EdgeIdx++) {
+    const CFGEdge &E = Edges[EdgeIdx];
+    unsigned Src = GetVertex(E.Src), Dst = GetVertex(E.Dst);
+    Incident[Src].push_back(EdgeIdx);
+    if (Src != Dst)
+      Incident[Dst].push_back(EdgeIdx);
+
+    if (!E.InTree) {
+      EdgeCounts[EdgeIdx][CounterIdx++] = 1;
+      IsKnown[EdgeIdx] = true;
+      continue;
+    }
+    NumUnknown[Src]++;
+    NumUnknown[Dst]++;
+  }
+
+  // Repeatedly pick a vertex with exactly one unknown edge (i.e. a leaf of
+  // what's left of the tree) and compute that edge from the flow conservation
+  SmallVector<unsigned, 16> Worklist;
+  for (unsigned Vertex = 0; Vertex < NumUnknown.size(); Vertex++)
+    if (NumUnknown[Vertex] == 1)
+      Worklist.push_back(Vertex);
+
+  while (!Worklist.empty()) {
+    unsigned Vertex = Worklist.pop_back_val();
+    if (NumUnknown[Vertex] != 1)
+      continue;
+
+    // Flow = sum(incoming counts) - sum(outgoing counts) over the known edges
+    SmallVector<int64_t, 8> Flow(NumCounters, 0);
+    unsigned UnknownIdx = 0;
+    for (unsigned EdgeIdx : Incident[Vertex]) {
+      const CFGEdge &E = Edges[EdgeIdx];
+      if (!IsKnown[EdgeIdx]) {
+        UnknownIdx = EdgeIdx;
+        continue;
+      }
+      if (E.Src == E.Dst)
+        continue;
+      int64_t Sign = GetVertex(E.Dst) == Vertex ? 1 : -1;
+      for (unsigned Idx = 0; Idx < NumCounters; Idx++)
+        Flow[Idx] += Sign * EdgeCounts[EdgeIdx][Idx];
+    }
+
+    // The unknown edge balances the flow
+    const CFGEdge &Unknown = Edges[UnknownIdx];
+    int64_t Sign = GetVertex(Unknown.Dst) == Vertex ? -1 : 1;
+    for (unsigned Idx = 0; Idx < NumCounters; Idx++)
+      EdgeCounts[UnknownIdx][Idx] = Sign * Flow[Idx];
+    IsKnown[UnknownIdx] = true;
+
+    for (unsigned Endpoint : {GetVertex(Unknown.Src), GetVertex(Unknown.Dst)})
+      if (--NumUnknown[Endpoint] == 1)
+        Worklist.push_back(Endpoint);
+  }
+
+  // STEP 3: Express the count of every block via the counters
+  // ---------------------------------------------------------
+  // A block is executed as many times as it's entered
+  std::vector<SmallVector<int64_t, 8>> BlockCounts(
+      VertexIdx.size() + 1, SmallVector<int64_t, 8>(NumCounters, 0));
+  for (unsigned EdgeIdx = 0; EdgeIdx < Edges.size(); EdgeIdx++)
+    for (unsigned Idx = 0; Idx < NumCounters; Idx++)
+      BlockCounts[GetVertex(Edges[EdgeIdx].Dst)][Idx] +=
+          EdgeCounts[EdgeIdx][Idx];
+
+  unsigned FirstCounter = Counters.size();
+  for (unsigned Vertex = 1; Vertex < BlockCounts.size(); Vertex++) {
+    CounterExpr Count;
+    for (unsigned Idx = 0; Idx < NumCounters; Idx++)
+      if (BlockCounts[Vertex][Idx] != 0)
+        Count.push_back({FirstCounter + Idx, BlockCounts[Vertex][Idx]});
+    Counts.push_back(std::move(Count));
+  }
+
+  // STEP 4: Decide where to insert the counters
+  // -------------------------------------------
+  // This may split critical edges, so it's done last
+  for (const CFGEdge &E : Edges) {
+    if (E.InTree)
+      continue;
+
+    Instruction *InsertPt = nullptr;
+    if (E.NeedsSplit) {
+      BasicBlock *EdgeBB = SplitCriticalEdge(
+          E.Src->getTerminator(), E.SuccIdx,
+          CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+      assert(EdgeBB && "Failed to split a critical edge");
+      InsertPt = EdgeBB->getTerminator();
+    } else if (E.AtSrc) {
+      // Nothing can be inserted between a musttail call and the return
+      InsertPt = E.Src->getTerminatingMustTailCall();
+      if (!InsertPt)
+        InsertPt = E.Src->getTerminator();
+    } else {
+      InsertPt = getBlockStartInsertPt(*E.Dst);
+    }
+
+    Counters.push_back(
+        {InsertPt, F.getName().str() + ".edge" +
+                       std::to_string(Counters.size() - FirstCounter)});
+  }
+}
+
 //-----------------------------------------------------------------------------
 // DynamicCallCounter implementation
 //-----------------------------------------------------------------------------
 bool DynamicCallCounter::runOnModule(Module &M) {
-  bool Instrumented = false;
+  // The functions to instrument. This list is created upfront so that the
+  // helper functions added below are not instrumented.
+  SmallVector<Function *, 16> FuncsToInstrument;
+  for (auto &F : M)
+    if (!F.isDeclaration())
+      FuncsToInstrument.push_back(&F);
 
-  // Function name <--> IR variable that holds the call counter
-  llvm::StringMap<Constant *> CallCounterMap;
-  // Function name <--> IR variable that holds the function name
-  llvm::StringMap<Constant *> FuncNameMap;
+  // Stop here if there are no function definitions in this module
+  if (FuncsToInstrument.empty())
+    return false;
+
+  // STEP 1: Decide where to insert the counters
+  // --------------------------------------------
+  std::vector<CounterSite> Counters;
+  // The names and the values (computed from the counters) of the results
+  std::vector<std::string> ResultNames;
+  std::vector<CounterExpr> ResultCounts;
+
+  if (ProfileModeOpt == ProfileMode::Calls) {
+    // One counter (and one result) per function
+    for (Function *F : FuncsToInstrument) {
+      ResultCounts.push_back({{(unsigned)Counters.size(), 1}});
+      ResultNames.push_back(F->getName().str());
+      Counters.push_back(
+          {getBlockStartInsertPt(F->getEntryBlock()), F->getName().str()});
+    }
+  } else {
+    for (Function *F : FuncsToInstrument)
+      planBlockCounters(*F, Counters, ResultNames, ResultCounts);
+  }
+
+  // Counter index <--> IR variable that holds the counter (for the plain
+  // counter layout)
+  SmallVector<Constant *, 16> CounterVars;
+  // Result index <--> IR variable that holds the result name
+  SmallVector<Constant *, 16> ResultNameVars;
 
   auto &CTX = M.getContext();
 
-  // STEP 1: For each function in the module, inject a call-counting code
-  // --------------------------------------------------------------------
-  for (auto &F : M) {
-    if (F.isDeclaration())
-      continue;
+  // With the binary output, the results are written as `DynamicCCProfile`.
+  // Call counts with the plain counter layout are kept in that record
+  // directly, so writing them doesn't require any code per counter.
+  GlobalVariable *Profile = nullptr;
+  if (OutputFormatOpt == OutputFormat::Binary)
+    Profile = CreateProfileRecord(M, ResultNames);
+  bool CountersInProfile = Profile && ProfileModeOpt == ProfileMode::Calls &&
+                           CounterLayoutOpt == CounterLayout::Plain;
 
-    // Get an IR builder. Sets the insertion point to the top of the function
-    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+  // Helper globals and functions for the sharded counter layout
+  GlobalVariable *CounterShards = nullptr;
+  Function *GetCounterShardF = nullptr;
+  if (CounterLayoutOpt == CounterLayout::Sharded) {
+    CounterShards = CreateCounterShards(M, Counters.size());
+    GetCounterShardF = CreateGetCounterShard(M);
+  }
+
+  // The countdown for the sampling mode
+  GlobalVariable *SampleCountdown = nullptr;
+  Function *ReloadSampleCountdownF = nullptr;
+  if (getSampleRate() > 1) {
+    SampleCountdown = CreateSampleCountdown(M);
+    ReloadSampleCountdownF = CreateReloadSampleCountdown(M, SampleCountdown);
+  }
 
-    // Create a global variable to count the calls to this function
-    std::string CounterName = "CounterFor_" + std::string(F.getName());
-    Constant *Var = CreateGlobalCounter(M, CounterName);
-    CallCounterMap[F.getName()] = Var;
+  // STEP 2: Inject the counters
+  // ---------------------------
+  for (unsigned CounterIdx = 0; CounterIdx < Counters.size(); CounterIdx++) {
+    // Get an IR builder. Sets the insertion point to where the counter is
+    // incremented (e.g. the top of the function)
+    IRBuilder<> Builder(Counters[CounterIdx].InsertPt);
+
+    if (CountersInProfile) {
+      // The counter is an element of DynamicCCProfile.Counters
+      CounterVars.push_back(ConstantExpr::getInBoundsGetElementPtr(
+          Profile->getValueType(), Profile,
+          ArrayRef<Constant *>{Builder.getInt32(0),
+                               Builder.getInt32(ProfileCountersField),
+                               Builder.getInt32(CounterIdx)}));
+    } else if (CounterLayoutOpt == CounterLayout::Plain) {
+      // Create a global variable to hold the counter
+      std::string CounterName = "CounterFor_" + Counters[CounterIdx].Name;
+      Constant *Var = CreateGlobalCounter(M, CounterName);
+      CounterVars.push_back(Var);
+    }
 
     // Create a global variable to hold the name of this function
-    auto FuncName = Builder.CreateGlobalStringPtr(F.getName());
-    FuncNameMap[F.getName()] = FuncName;
+    if (OutputFormatOpt == OutputFormat::Text &&
+        ProfileModeOpt == ProfileMode::Calls)
+      ResultNameVars.push_back(
+          Builder.CreateGlobalStringPtr(ResultNames[CounterIdx]));
+
+    // With sampling, only one in every SampleRate updates (on average) is
+    // performed. The following is injected before the counter update:
+    // ```
+    //    bool IsSample = (SampleCountdown == 0);
+    //    SampleCountdown = SampleCountdown - 1;
+    //    if (IsSample) {
+    //      reload_sample_countdown();
+    //      <counter update>
+    //    }
+    // ```
+    if (SampleCountdown) {
+      Type *Int32Ty = Builder.getInt32Ty();
+      Value *Countdown = Builder.CreateLoad(Int32Ty, SampleCountdown);
+      Value *IsSample = Builder.CreateICmpEQ(Countdown, Builder.getInt32(0));
+      Builder.CreateStore(Builder.CreateSub(Countdown, Builder.getInt32(1)),
+                          SampleCountdown);
+      Instruction *SampleTerm = SplitBlockAndInsertIfThen(
+          IsSample, Counters[CounterIdx].InsertPt, /*Unreachable=*/false,
+          MDBuilder(CTX).createBranchWeights(/*TrueWeight=*/1,
+                                             getSampleRate() - 1));
+      Builder.SetInsertPoint(SampleTerm);
+      Builder.CreateCall(ReloadSampleCountdownF);
+    }
 
-    // Inject instruction to increment the call count each time this function
-    // executes
-    LoadInst *Load2 = Builder.CreateLoad(IntegerType::getInt32Ty(CTX), Var);
-    Value *Inc2 = Builder.CreateAdd(Builder.getInt32(1), Load2);
-    Builder.CreateStore(Inc2, Var);
+    if (CounterLayoutOpt == CounterLayout::Plain) {
+      // Inject instruction to increment the counter each time this point is
+      // reached. The counters in DynamicCCProfile are 64-bit wide and
+      // written as they are, so sampled updates add SampleRate (rather than
+      // 1) to them.
+      Constant *Var = CounterVars[CounterIdx];
+      IntegerType *CounterTy = CountersInProfile ? Type::getInt64Ty(CTX)
+                                                 : Type::getInt32Ty(CTX);
+      uint64_t Step =
+          CountersInProfile && SampleCountdown ? getSampleRate() : 1;
+      LoadInst *Load2 = Builder.CreateLoad(CounterTy, Var);
+      Value *Inc2 = Builder.CreateAdd(ConstantInt::get(CounterTy, Step), Load2);
+      Builder.CreateStore(Inc2, Var);
+    } else {
+      // Inject instructions to atomically increment this counter in the shard
+      // assigned to the current thread
+      Value *Shard = Builder.CreateCall(GetCounterShardF);
+      Value *CounterPtr = Builder.CreateGEP(
+          CounterShards->getValueType(), CounterShards,
+          {Builder.getInt32(0), Shard, Builder.getInt32(CounterIdx)});
+      Builder.CreateAtomicRMW(AtomicRMWInst::Add, CounterPtr,
+                              Builder.getInt64(1), MaybeAlign(8),
+                              AtomicOrdering::Monotonic);
+    }
 
     // The following is visible only if you pass -debug on the command line
     // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << " Instrumented: " << F.getName() << "\n");
-
-    Instrumented = true;
+    LLVM_DEBUG(dbgs() << " Instrumented: " << Counters[CounterIdx].Name
+                      << "\n");
   }
 
-  // Stop here if there are no function definitions in this module
-  if (false == Instrumented)
-    return Instrumented;
+  // Emits code that reads the counter with index CounterIdx. The result is
+  // always an i64 (it's passed to printf as %lu).
+  Function *SumCounterShardsF = nullptr;
+  if (CounterLayoutOpt == CounterLayout::Sharded)
+    SumCounterShardsF = CreateSumCounterShards(M, CounterShards);
+
+  // (Function, counter index) <--> the value of the counter read in that
+  // function. Every counter is read only once per printout (the results may
+  // share counters and, with delta snapshots, reading a counter resets it).
+  DenseMap<std::pair<Function *, unsigned>, Value *> CounterValues;
+  auto ReadCounter = [&](IRBuilder<> &Builder, unsigned CounterIdx) -> Value * {
+    Value *&Count =
+        CounterValues[{Builder.GetInsertBlock()->getParent(), CounterIdx}];
+    if (Count)
+      return Count;
+
+    if (CounterLayoutOpt == CounterLayout::Sharded)
+      Count = Builder.CreateCall(SumCounterShardsF,
+                                 {Builder.getInt32(CounterIdx)});
+    else if (DeltaSnapshots)
+      Count = Builder.CreateZExt(
+          Builder.CreateAtomicRMW(AtomicRMWInst::Xchg, CounterVars[CounterIdx],
+                                  Builder.getInt32(0), MaybeAlign(4),
+                                  AtomicOrdering::Monotonic),
+          Builder.getInt64Ty());
+    else
+      Count = Builder.CreateZExt(
+          Builder.CreateLoad(IntegerType::getInt32Ty(CTX),
+                             CounterVars[CounterIdx]),
+          Builder.getInt64Ty());
+
+    // Scale the sampled counts back up
+    if (SampleCountdown)
+      Count = Builder.CreateMul(Count, Builder.getInt64(getSampleRate()));
+    return Count;
+  };
+
+  // Emits code that computes the result with index ResultIdx
+  auto ReadResult = [&](IRBuilder<> &Builder, unsigned ResultIdx) -> Value * {
+    const CounterExpr &Count = ResultCounts[ResultIdx];
+    if (Count.size() == 1 && Count[0].second == 1)
+      return ReadCounter(Builder, Count[0].first);
+
+    Value *Sum = Builder.getInt64(0);
+    for (auto [CounterIdx, Coeff] : Count) {
+      Value *Term = ReadCounter(Builder, CounterIdx);
+      if (Coeff == 1)
+        Sum = Builder.CreateAdd(Sum, Term);
+      else if (Coeff == -1)
+        Sum = Builder.CreateSub(Sum, Term);
+      else
+        Sum = Builder.CreateAdd(
+            Sum, Builder.CreateMul(Term, Builder.getInt64(Coeff)));
+    }
 
-  // STEP 2: Inject the declaration of printf
+    // With sampling, the estimated edge counts are not consistent and the
+    // result may be negative
+    if (SampleCountdown)
+      Sum = Builder.CreateSelect(
+          Builder.CreateICmpSLT(Sum, Builder.getInt64(0)), Builder.getInt64(0),
+          Sum);
+    return Sum;
+  };
+
+  // With the binary output, the results are written by `write_profile`
+  // (instead of printed by `printf_wrapper`)
+  if (OutputFormatOpt == OutputFormat::Binary) {
+    Type *CountersTy =
+        cast<StructType>(Profile->getValueType())
+            ->getElementType(ProfileCountersField);
+    Function *WriterF = nullptr;
+    if (CountersInProfile) {
+      WriterF = CreateProfileWriter(M, Profile, nullptr);
+    } else if (ProfileModeOpt == ProfileMode::Calls) {
+      // Every result is a (sharded) counter, so these are read in a loop:
+      // ```
+      //    for (i = 0; i < NumCounters; i++)
+      //      Counters[i] = sum_counter_shards(i) * SampleRate;
+      // ```
+      WriterF = CreateProfileWriter(
+          M, Profile, [&](IRBuilder<> &Builder, Value *CountersPtr) {
+            Function *F = Builder.GetInsertBlock()->getParent();
+            BasicBlock *Preheader = Builder.GetInsertBlock();
+            BasicBlock *Loop = BasicBlock::Create(CTX, "fill", F);
+            BasicBlock *Done = BasicBlock::Create(CTX, "filled", F);
+            Builder.CreateBr(Loop);
+
+            Builder.SetInsertPoint(Loop);
+            PHINode *Idx = Builder.CreatePHI(Builder.getInt32Ty(), 2);
+            Value *Count = Builder.CreateCall(SumCounterShardsF, {Idx});
+            if (SampleCountdown)
+              Count =
+                  Builder.CreateMul(Count, Builder.getInt64(getSampleRate()));
+            Builder.CreateStore(
+                Count, Builder.CreateInBoundsGEP(
+                           CountersTy, CountersPtr, {Builder.getInt32(0), Idx}));
+            Value *Next = Builder.CreateAdd(Idx, Builder.getInt32(1));
+            Builder.CreateCondBr(
+                Builder.CreateICmpEQ(Next, Builder.getInt32(Counters.size())),
+                Done, Loop);
+            Idx->addIncoming(Builder.getInt32(0), Preheader);
+            Idx->addIncoming(Next, Loop);
+
+            Builder.SetInsertPoint(Done);
+          });
+    } else {
+      // Every block count is a different combination of counters, so these
+      // are computed one by one
+      WriterF = CreateProfileWriter(
+          M, Profile, [&](IRBuilder<> &Builder, Value *CountersPtr) {
+            for (unsigned Idx = 0; Idx < ResultNames.size(); Idx++)
+              Builder.CreateStore(ReadResult(Builder, Idx),
+                                  Builder.CreateConstInBoundsGEP2_32(
+                                      CountersTy, CountersPtr, 0, Idx));
+          });
+    }
+    ScheduleDumps(M, WriterF);
+    return true;
+  }
+
+  // STEP 3: Inject the declaration of printf
   // ----------------------------------------
   // Create (or _get_ in cases where it's already available) the following
   // declaration in the IR module:
@@ -144,10 +1406,12 @@ bool DynamicCallCounter::runOnModule(Module &M) {
   PrintfF->addParamAttr(0, Attribute::NoCapture);
   PrintfF->addParamAttr(0, Attribute::ReadOnly);
 
-  // STEP 3: Inject a global variable that will hold the printf format string
+  // STEP 4: Inject a global variable that will hold the printf format string
   // ------------------------------------------------------------------------
+  // The counts are i64, i.e. `long long` (`long` is only 32-bit on LLP64
+  // targets, e.g. Windows)
   llvm::Constant *ResultFormatStr =
-      llvm::ConstantDataArray::getString(CTX, "%-20s %-10lu\n");
+      llvm::ConstantDataArray::getString(CTX, "%-20s %-10llu\n");
 
   Constant *ResultFormatStrVar =
       M.getOrInsertGlobal("ResultFormatStrIR", ResultFormatStr->getType());
@@ -157,7 +1421,9 @@ bool DynamicCallCounter::runOnModule(Module &M) {
   out += "=================================================\n";
   out += "LLVM-TUTOR: dynamic analysis results\n";
   out += "=================================================\n";
-  out += "NAME                 #N DIRECT CALLS\n";
+  out += ProfileModeOpt == ProfileMode::Calls
+             ? "NAME                 #N DIRECT CALLS\n"
+             : "NAME                 #N EXECUTIONS\n";
   out += "-------------------------------------------------\n";
 
   llvm::Constant *ResultHeaderStr =
@@ -167,10 +1433,11 @@ bool DynamicCallCounter::runOnModule(Module &M) {
       M.getOrInsertGlobal("ResultHeaderStrIR", ResultHeaderStr->getType());
   dyn_cast<GlobalVariable>(ResultHeaderStrVar)->setInitializer(ResultHeaderStr);
 
-  // STEP 4: Define a printf wrapper that will print the results
+  // STEP 5: Define a printf wrapper that will print the results
   // -----------------------------------------------------------
-  // Define `printf_wrapper` that will print the results stored in FuncNameMap
-  // and CallCounterMap.  It is equivalent to the following C++ function:
+  // Define `printf_wrapper` that will print the results computed from
+  // CounterVars (or CounterShards).  It is equivalent to the following C++
+  // function:
   // ```
   //    void printf_wrapper() {
   //      for (auto &item : Functions)
@@ -178,8 +1445,8 @@ bool DynamicCallCounter::runOnModule(Module &M) {
   //        item.name, item.count);
   //    }
   // ```
-  // (item.name comes from FuncNameMap, item.count comes from
-  // CallCounterMap)
+  // (item.name comes from ResultNameVars, item.count is computed from
+  // CounterVars or from the sums of the counters from all shards)
   FunctionType *PrintfWrapperTy =
       FunctionType::get(llvm::Type::getVoidTy(CTX), {},
                         /*IsVarArgs=*/false);
@@ -200,20 +1467,24 @@ bool DynamicCallCounter::runOnModule(Module &M) {
 
   Builder.CreateCall(Printf, {ResultHeaderStrPtr});
 
-  LoadInst *LoadCounter;
-  for (auto &item : CallCounterMap) {
-    LoadCounter = Builder.CreateLoad(IntegerType::getInt32Ty(CTX), item.second);
-    // LoadCounter = Builder.CreateLoad(item.second);
-    Builder.CreateCall(
-        Printf, {ResultFormatStrPtr, FuncNameMap[item.first()], LoadCounter});
+  for (unsigned ResultIdx = 0; ResultIdx < ResultNames.size(); ResultIdx++) {
+    // In the calls mode, the names were created together with the counters
+    if (ResultNameVars.size() == ResultIdx)
+      ResultNameVars.push_back(
+          Builder.CreateGlobalStringPtr(ResultNames[ResultIdx]));
+
+    Value *Count = ReadResult(Builder, ResultIdx);
+    Builder.CreateCall(Printf,
+                       {ResultFormatStrPtr, ResultNameVars[ResultIdx], Count});
   }
 
   // Finally, insert return instruction
   Builder.CreateRetVoid();
 
-  // STEP 5: Call `printf_wrapper` at the very end of this module
+  // STEP 6: Call `printf_wrapper` at the very end of this module
   // ------------------------------------------------------------
-  appendToGlobalDtors(M, PrintfWrapperF, /*Priority=*/0);
+  // (and whenever a snapshot is taken)
+  ScheduleDumps(M, PrintfWrapperF);
 
   return true;
 }
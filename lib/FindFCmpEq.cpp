@@ -26,6 +26,10 @@
 //    2. Manual pass pipeline - new PM
 //      opt --load-pass-plugin libFindFCmpEq.dylib `\`
 //        --passes='print<find-fcmp-eq>' --disable-output <input-llvm-file>
+//    3. Manual pass pipeline - new PM, JSON lines (or CSV) output
+//      opt --load-pass-plugin libFindFCmpEq.dylib `\`
+//        --passes='print<find-fcmp-eq>' --find-fcmp-eq-format=jsonl `\`
+//        --disable-output <input-llvm-file>
 //
 // License: MIT
 //=============================================================================
@@ -50,6 +54,16 @@
 
 using namespace llvm;
 
+static constexpr char PassArg[] = "find-fcmp-eq";
+static constexpr char PassName[] =
+    "Floating-point equality comparisons locator";
+static constexpr char PluginName[] = "FindFCmpEq";
+
+static cl::opt<ResultFormat>
+    OutputFormat{"find-fcmp-eq-format",
+                 cl::desc("The format of the printed results"),
+                 getResultFormatValues(), cl::init(ResultFormat::Text)};
+
 // Unnamed namespace for internal functions
 namespace {
 
@@ -73,12 +87,23 @@ printFCmpEqInstructions(raw_ostream &OS, Function &Func,
   }
 }
 
-} // namespace
+// Writes one record per comparison (rather than pretty-printing them)
+static void
+writeFCmpEqInstructions(ResultWriter &Writer, Function &Func,
+                        const FindFCmpEq::Result &FCmpEqInsts) noexcept {
+  if (FCmpEqInsts.empty())
+    return;
 
-static constexpr char PassArg[] = "find-fcmp-eq";
-static constexpr char PassName[] =
-    "Floating-point equality comparisons locator";
-static constexpr char PluginName[] = "FindFCmpEq";
+  ModuleSlotTracker Tracker(Func.getParent());
+
+  for (FCmpInst *FCmpEq : FCmpEqInsts)
+    Writer.beginRecord()
+        .field(Func.getName())
+        .printedField([&](raw_ostream &OS) { FCmpEq->print(OS, Tracker); })
+        .endRecord();
+}
+
+} // namespace
 
 //------------------------------------------------------------------------------
 // FindFCmpEq implementation
@@ -107,7 +132,10 @@ FindFCmpEq::Result FindFCmpEq::run(Function &Func) {
 PreservedAnalyses FindFCmpEqPrinter::run(Function &Func,
                                          FunctionAnalysisManager &FAM) {
   auto &Comparisons = FAM.getResult<FindFCmpEq>(Func);
-  printFCmpEqInstructions(OS, Func, Comparisons);
+  if (Writer.getFormat() != ResultFormat::Text)
+    writeFCmpEqInstructions(Writer, Func, Comparisons);
+  else
+    printFCmpEqInstructions(OS, Func, Comparisons);
   return PreservedAnalyses::all();
 }
 
@@ -135,6 +163,12 @@ void FindFCmpEqWrapper::print(llvm::raw_ostream &OS,
   // containing function from the results list as the function argument to
   // printFCmpEqInstructions().
   Function &Func = *Results.front()->getFunction();
+  if (OutputFormat != ResultFormat::Text) {
+    ResultWriter Writer(OS, OutputFormat, {"function", "instruction"});
+    writeFCmpEqInstructions(Writer, Func, Results);
+    return;
+  }
+
   printFCmpEqInstructions(OS, Func, Results);
 }
 
@@ -161,7 +195,7 @@ PassPluginLibraryInfo getFindFCmpEqPluginInfo() {
                   std::string PrinterPassElement =
                       formatv("print<{0}>", PassArg);
                   if (Name.equals(PrinterPassElement)) {
-                    FPM.addPass(FindFCmpEqPrinter(llvm::outs()));
+                    FPM.addPass(FindFCmpEqPrinter(llvm::outs(), OutputFormat));
                     return true;
                   }
 
@@ -0,0 +1,38 @@
+//==============================================================================
+// FILE:
+//    FunctionRNG.cpp
+//
+// DESCRIPTION:
+//    Implementation of FunctionRNG, the per-function random number generator
+//    used by the obfuscation passes.
+//
+// License: MIT
+//==============================================================================
+#include "FunctionRNG.h"
+
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+FunctionRNG::FunctionRNG(const Function &F, StringRef PassName)
+    : RNG(F.getParent()->createRNG((PassName + "." + F.getName()).str())) {}
+
+uint64_t FunctionRNG::nextBelow(uint64_t Bound) {
+  assert(Bound != 0 && "Empty range");
+
+  // Reject the values from the incomplete range at the bottom, so that every
+  // result is equally likely
+  uint64_t Threshold = -Bound % Bound;
+  uint64_t Value;
+  do
+    Value = (*RNG)();
+  while (Value < Threshold);
+
+  return Value % Bound;
+}
+
+double FunctionRNG::nextDouble() {
+  // The top 53 bits fill the mantissa of a double exactly
+  return static_cast<double>((*RNG)() >> 11) * 0x1.0p-53;
+}
@@ -0,0 +1,84 @@
+//==============================================================================
+// FILE:
+//    InstructionEquivalence.cpp
+//
+// DESCRIPTION:
+//    Implementation of the helpers for comparing and hashing instructions
+//    (used by MergeBB and MergeFunctions).
+//
+// License: MIT
+//==============================================================================
+#include "InstructionEquivalence.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+// Returns true if V1 and V2 are identical or counterparts
+static bool areEquivalentValues(const Value *V1, const Value *V2,
+                                const CounterpartMap &Counterparts) {
+  return V1 == V2 || Counterparts.lookup(V2) == V1;
+}
+
+bool areEquivalentInstructions(const Instruction *Inst1,
+                               const Instruction *Inst2,
+                               const CounterpartMap &Counterparts) {
+  if (!Inst1->isSameOperationAs(Inst2))
+    return false;
+
+  // isSameOperationAs ignores the poison-generating flags (nsw, nuw, exact,
+  // inbounds) and the fast-math flags. These change the semantics, so they
+  // have to match.
+  if (Inst1->getRawSubclassOptionalData() !=
+      Inst2->getRawSubclassOptionalData())
+    return false;
+
+  // So does some of the metadata (e.g. !range, !nonnull and !noundef), so
+  // require the same metadata (other than the debug locations). The metadata
+  // nodes are uniqued, so comparing the pointers is sufficient.
+  SmallVector<std::pair<unsigned, MDNode *>, 4> MDs1, MDs2;
+  Inst1->getAllMetadataOtherThanDebugLoc(MDs1);
+  Inst2->getAllMetadataOtherThanDebugLoc(MDs2);
+  if (MDs1 != MDs2)
+    return false;
+
+  assert(Inst2->getNumOperands() == Inst1->getNumOperands());
+  auto NumOpnds = Inst1->getNumOperands();
+  for (unsigned OpndIdx = 0; OpndIdx != NumOpnds; ++OpndIdx) {
+    if (!areEquivalentValues(Inst1->getOperand(OpndIdx),
+                             Inst2->getOperand(OpndIdx), Counterparts))
+      return false;
+  }
+
+  // The incoming blocks of PHI nodes are not operands
+  if (auto *PN1 = dyn_cast<PHINode>(Inst1)) {
+    auto *PN2 = cast<PHINode>(Inst2);
+    for (unsigned Idx = 0, E = PN1->getNumIncomingValues(); Idx != E; ++Idx)
+      if (!areEquivalentValues(PN1->getIncomingBlock(Idx),
+                               PN2->getIncomingBlock(Idx), Counterparts))
+        return false;
+  }
+
+  return true;
+}
+
+hash_code hashValue(const Value *V, const LocalValueIds &LocalIds) {
+  auto Id = LocalIds.find(V);
+  if (Id != LocalIds.end())
+    return hash_combine(true, Id->second);
+  return hash_combine(false, V);
+}
+
+hash_code hashInstruction(const Instruction &Inst,
+                          const LocalValueIds &LocalIds) {
+  hash_code Hash = hash_combine(Inst.getOpcode(), Inst.getType());
+  for (const Value *Opnd : Inst.operand_values())
+    Hash = hash_combine(Hash, hashValue(Opnd, LocalIds));
+
+  if (auto *PN = dyn_cast<PHINode>(&Inst))
+    for (const BasicBlock *InBB : PN->blocks())
+      Hash = hash_combine(Hash, hashValue(InBB, LocalIds));
+
+  return Hash;
+}
@@ -3,16 +3,31 @@
 //    MBAAdd.cpp
 //
 // DESCRIPTION:
-//    This pass performs a substitution for 8-bit integer add
+//    This pass performs a substitution for integer add
 //    instruction based on this Mixed Boolean-Airthmetic expression:
 //      a + b == (((a ^ b) + 2 * (a & b)) * 39 + 23) * 151 + 111
 //    See formula (3) in [1].
 //
+//    The identity holds because f(x) = 39 * x + 23 and g(x) = 151 * x + 111
+//    are inverses of each other modulo 2^8. For the other supported widths
+//    (i16, i32 and i64, as well as vectors of these and of i8) the same f is
+//    used and g is derived from it:
+//      a + b == (((a ^ b) + 2 * (a & b)) * 39 + 23) * C + D
+//    where C is the multiplicative inverse of 39 modulo 2^width and
+//    D = -C * 23. The identity ("add-affine") is implemented in
+//    MBAIdentities.cpp.
+//
+//    With -mba-add-budgeted, the instructions are only substituted within a
+//    code size and a latency budget (see MBABudget). The cost of every
+//    substitution is estimated with the target's cost model (TTI) and the
+//    coldest instructions are substituted first.
+//
 // USAGE:
 //    1. Legacy pass manager:
 //      $ opt -load <BUILD_DIR>/lib/libMBAAdd.so `\`
 //        --legacy-mba-add [-mba-ratio=<ratio>] <bitcode-file>
-//      with the optional ratio in the range [0, 1.0].
+//      with the optional ratio in the range [0, 1.0]. The instructions to
+//      replace are chosen at random, the seed can be set with -rng-seed.
 //    2. New pass maanger:
 //      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBAAdd.so `\`
 //        -passes=-"mba-add" <bitcode-file>
@@ -27,20 +42,20 @@
 #include "MBAAdd.h"
 
 #include "llvm/ADT/Statistic.h"
-#include "llvm/IR/IRBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
+#include "FunctionRNG.h"
+#include "MBAIdentities.h"
 #include "Ratio.h"
 
-#include <random>
-
 using namespace llvm;
 
 #define DEBUG_TYPE "mba-add"
 
 STATISTIC(SubstCount, "The # of substituted instructions");
+STATISTIC(OverBudgetCount,
+          "The # of instructions not substituted because of the budgets");
 
 // Pass Option declaration
 static cl::opt<Ratio, false, llvm::cl::parser<Ratio>> MBARatio{
@@ -48,122 +63,73 @@ static cl::opt<Ratio, false, llvm::cl::parser<Ratio>> MBARatio{
     cl::desc("Only apply the mba pass on <ratio> of the candidates"),
     cl::value_desc("ratio"), cl::init(1.), cl::Optional};
 
+// -mba-add-budgeted and the budgets (see MBABudgetOptions)
+static MBABudgetOptions BudgetOptions{"mba-add"};
+
 //-----------------------------------------------------------------------------
 // MBAAdd Implementation
 //-----------------------------------------------------------------------------
-bool MBAAdd::runOnBasicBlock(BasicBlock &BB) {
-  bool Changed = false;
-
-  // Get a (rather naive) random number generator that will be used to decide
-  // whether to replace the current instruction or not.
-  // FIXME We should be using 'Module::createRNG' here instead. However, that
-  // method requires a pointer to 'Pass' on input and passes
-  // for the new pass manager _do_not_ inherit from llvm::Pass. In other words,
-  // 'createRNG' cannot be used here and there's no other way of obtaining
-  // llvm::RandomNumberGenerator. Last checked for LLVM 8.
-  std::mt19937_64 RNG;
-  RNG.seed(1234);
-  std::uniform_real_distribution<double> Dist(0., 1.);
-
-  // Loop over all instructions in the block. Replacing instructions requires
-  // iterators, hence a for-range loop wouldn't be suitable
-  for (auto Inst = BB.begin(), IE = BB.end(); Inst != IE; ++Inst) {
-    // Skip non-binary (e.g. unary or compare) instructions
-    // 使用dyn_cast来检查当前指令是否是一个二进制操作。如果不是，那么就跳过当前循环，开始下一次循环
-    auto *BinOp = dyn_cast<BinaryOperator>(Inst);
-    if (!BinOp)
-      continue;
-
-    // Skip instructions other than add
-    if (BinOp->getOpcode() != Instruction::Add)
-      continue;
-
-    // Skip if the result is not 8-bit wide (this implies that the operands are
-    // also 8-bit wide)
-    if (!BinOp->getType()->isIntegerTy() ||
-        !(BinOp->getType()->getIntegerBitWidth() == 8))
-      continue;
-
-    // Use Ratio and RNG to decide whether to substitute this particular 'add'
-    if (Dist(RNG) > MBARatio.getRatio())
-      continue;
-
-    // A uniform API for creating instructions and inserting
-    // them into basic blocks
-    IRBuilder<> Builder(BinOp);
-
-    // Constants used in building the instruction for substitution
-    // 构建替换指令时使用的常量
-    auto Val39 = ConstantInt::get(BinOp->getType(), 39);
-    auto Val151 = ConstantInt::get(BinOp->getType(), 151);
-    auto Val23 = ConstantInt::get(BinOp->getType(), 23);
-    auto Val2 = ConstantInt::get(BinOp->getType(), 2);
-    auto Val111 = ConstantInt::get(BinOp->getType(), 111);
-
-    // Build an instruction representing `(((a ^ b) + 2 * (a & b)) * 39 + 23) *
-    // 151 + 111`
-    Instruction *NewInst =
-        // E = e5 + 111
-        BinaryOperator::CreateAdd(
-            Val111,
-            // e5 = e4 * 151
-            Builder.CreateMul(
-                Val151,
-                // e4 = e2 + 23
-                Builder.CreateAdd(
-                    Val23,
-                    // e3 = e2 * 39
-                    Builder.CreateMul(
-                        Val39,
-                        // e2 = e0 + e1
-                        Builder.CreateAdd(
-                            // e0 = a ^ b
-                            Builder.CreateXor(BinOp->getOperand(0),
-                                              BinOp->getOperand(1)),
-                            // e1 = 2 * (a & b)
-                            Builder.CreateMul(
-                                Val2, Builder.CreateAnd(BinOp->getOperand(0),
-                                                        BinOp->getOperand(1))))
-                    ) // e3 = e2 * 39
-                ) // e4 = e2 + 23
-            ) // e5 = e4 * 151
-        ); // E = e5 + 111
-
-    // The following is visible only if you pass -debug on the command line
-    // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewInst << "\n");
-
-    // Replace `(a + b)` (original instructions) with `(((a ^ b) + 2 * (a & b))
-    // * 39 + 23) * 151 + 111` (the new instruction)
-    // Transform/Utils/BasicBlockUtils.h
-    // https://llvm.org/doxygen/BasicBlockUtils_8h_source.html
-    ReplaceInstWithInst(&BB, Inst, NewInst);
-    Changed = true;
-
-    // Update the statistics
-    ++SubstCount;
+bool MBAAdd::runOnFunction(Function &F, const TargetTransformInfo *TTI,
+                           const BlockFrequencyInfo *BFI) {
+  // Used to decide whether to replace an instruction or not (see -mba-ratio)
+  FunctionRNG RNG(F, DEBUG_TYPE);
+
+  // The identity is implemented in MBAIdentities.cpp, together with the
+  // constants for all the supported widths
+  MBARewriter Rewriter(getMBAIdentity("add-affine"));
+  MBARewriter::RewriteList Rewrites = Rewriter.match(
+      F, [&](const BinaryOperator &,
+             ArrayRef<const MBAIdentity *> Identities) -> const MBAIdentity * {
+        // Use Ratio and RNG to decide whether to substitute this particular
+        // 'add'
+        if (RNG.nextDouble() > MBARatio.getRatio())
+          return nullptr;
+        return Identities.front();
+      });
+
+  if (BudgetOptions.isBudgeted()) {
+    assert(TTI && BFI && "The budgets require TTI and BFI");
+    OverBudgetCount += Budget.apply(F, Rewrites, BudgetOptions.getLimits(),
+                                    *TTI, *BFI);
   }
-  return Changed;
+  unsigned NumRewritten = MBARewriter::rewrite(Rewrites);
+
+  // Update the statistics
+  SubstCount += NumRewritten;
+  return NumRewritten != 0;
 }
 
 PreservedAnalyses MBAAdd::run(llvm::Function &F,
-                              llvm::FunctionAnalysisManager &) {
-  bool Changed = false;
+                              llvm::FunctionAnalysisManager &FAM) {
+  bool Changed =
+      BudgetOptions.isBudgeted()
+          ? runOnFunction(F, &FAM.getResult<TargetIRAnalysis>(F),
+                          &FAM.getResult<BlockFrequencyAnalysis>(F))
+          : runOnFunction(F);
 
-  for (auto &BB : F) {
-    Changed |= runOnBasicBlock(BB);
-  }
   return (Changed ? llvm::PreservedAnalyses::none()
                   : llvm::PreservedAnalyses::all());
 }
 
+bool LegacyMBAAdd::doInitialization(llvm::Module &) {
+  Impl.Budget = MBABudget();
+  return false;
+}
+
 bool LegacyMBAAdd::runOnFunction(llvm::Function &F) {
-  bool Changed = false;
+  if (!BudgetOptions.isBudgeted())
+    return Impl.runOnFunction(F);
 
-  for (auto &BB : F) {
-    Changed |= Impl.runOnBasicBlock(BB);
+  return Impl.runOnFunction(
+      F, &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F),
+      &getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI());
+}
+
+void LegacyMBAAdd::getAnalysisUsage(AnalysisUsage &Info) const {
+  if (BudgetOptions.isBudgeted()) {
+    Info.addRequired<TargetTransformInfoWrapperPass>();
+    Info.addRequired<BlockFrequencyInfoWrapperPass>();
   }
-  return Changed;
 }
 
 //-----------------------------------------------------------------------------
@@ -172,6 +138,17 @@ bool LegacyMBAAdd::runOnFunction(llvm::Function &F) {
 llvm::PassPluginLibraryInfo getMBAAddPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "mba-add", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
+            // At the module level (e.g. -passes=mba-add), every module gets a
+            // fresh module budget
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "mba-add") {
+                    MPM.addPass(MBABudgetModuleAdaptor<MBAAdd>());
+                    return true;
+                  }
+                  return false;
+                });
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -0,0 +1,190 @@
+//==============================================================================
+// FILE:
+//    MBABudget.cpp
+//
+// DESCRIPTION:
+//    Implementation of MBABudget, which limits the overhead of the MBA passes.
+//
+//    The cost of an identity is measured by building it (for the type of the
+//    rewritten instruction) in a scratch function that's not inserted into
+//    any module, and asking TTI for the cost of every generated instruction:
+//      * Size - TCK_CodeSize
+//      * Cycles - TCK_Latency, weighted by the frequency of the block of the
+//        rewritten instruction
+//    So the overhead follows the identity table (MBAIdentities.cpp) without
+//    any costs being hard-coded here.
+//
+// License: MIT
+//==============================================================================
+#include "MBABudget.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Debug.h"
+
+#include <limits>
+#include <numeric>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "mba-budget"
+
+namespace {
+// The estimated cost of some instructions
+struct Cost {
+  InstructionCost Size = 0;
+  InstructionCost Cycles = 0;
+};
+} // namespace
+
+// Returns Cost * Freq (saturated)
+static InstructionCost scaleByFreq(InstructionCost Cost, uint64_t Freq) {
+  using CostType = InstructionCost::CostType;
+  return Cost * static_cast<CostType>(std::min<uint64_t>(
+                    Freq, std::numeric_limits<CostType>::max()));
+}
+
+static Cost getInstructionCost(const Instruction &Inst,
+                               const TargetTransformInfo &TTI) {
+  return {TTI.getInstructionCost(&Inst, TargetTransformInfo::TCK_CodeSize),
+          TTI.getInstructionCost(&Inst, TargetTransformInfo::TCK_Latency)};
+}
+
+// Returns the cost of the instructions that Identity builds for operands of
+// type Ty
+static Cost getFormulaCost(const MBAIdentity &Identity, Type *Ty,
+                           const TargetTransformInfo &TTI) {
+  FunctionType *FTy = FunctionType::get(Ty, {Ty, Ty}, /*isVarArg=*/false);
+  std::unique_ptr<Function> Scratch(
+      Function::Create(FTy, GlobalValue::PrivateLinkage, "mba.cost"));
+  BasicBlock *BB = BasicBlock::Create(Ty->getContext(), "", Scratch.get());
+
+  IRBuilder<> Builder(BB);
+  Identity.Build(Builder, Scratch->getArg(0), Scratch->getArg(1));
+
+  // Invalid costs are propagated, so identities that can't be costed are
+  // never picked (see MBABudget::apply)
+  Cost FormulaCost;
+  for (const Instruction &Inst : *BB) {
+    Cost InstCost = getInstructionCost(Inst, TTI);
+    FormulaCost.Size += InstCost.Size;
+    FormulaCost.Cycles += InstCost.Cycles;
+  }
+  return FormulaCost;
+}
+
+//-----------------------------------------------------------------------------
+// MBABudgetOptions implementation
+//-----------------------------------------------------------------------------
+MBABudgetOptions::MBABudgetOptions(StringRef PassArg)
+    : BudgetedName((PassArg + "-budgeted").str()),
+      SizeName((PassArg + "-size-budget").str()),
+      CycleName((PassArg + "-cycle-budget").str()),
+      ModuleSizeName((PassArg + "-module-size-budget").str()),
+      SizeDesc("The maximum code growth per function, in percent of its size "
+               "(with -" +
+               BudgetedName + ")"),
+      CycleDesc("The maximum growth in the estimated latency per function "
+                "call, in percent (with -" +
+                BudgetedName + ")"),
+      ModuleSizeDesc("The maximum code growth per module, in the units of the "
+                     "target's code size cost model, 0 means no limit (with -" +
+                     BudgetedName + ")"),
+      Budgeted{StringRef(BudgetedName),
+               cl::desc{"Substitute the coldest instructions first (according "
+                        "to the block frequencies/profile data) and only "
+                        "within the size and cycle budgets (as estimated by "
+                        "the target's cost model)"},
+               cl::init(false)},
+      SizePercent{StringRef(SizeName), cl::desc{SizeDesc},
+                  cl::value_desc{"percent"}, cl::init(100)},
+      CyclePercent{StringRef(CycleName), cl::desc{CycleDesc},
+                   cl::value_desc{"percent"}, cl::init(10)},
+      ModuleSize{StringRef(ModuleSizeName), cl::desc{ModuleSizeDesc},
+                 cl::value_desc{"size"}, cl::init(0)} {}
+
+//-----------------------------------------------------------------------------
+// MBABudget implementation
+//-----------------------------------------------------------------------------
+unsigned MBABudget::apply(Function &F, MBARewriter::RewriteList &Rewrites,
+                          const Limits &Budget, const TargetTransformInfo &TTI,
+                          const BlockFrequencyInfo &BFI) {
+  // STEP 1: Compute the budgets. The cycles are estimated as the sum of the
+  // instruction latencies weighted by the block frequencies. Instructions
+  // that can't be costed are ignored.
+  InstructionCost FuncSize = 0, FuncCycles = 0;
+  for (BasicBlock &BB : F) {
+    InstructionCost BBCycles = 0;
+    for (Instruction &Inst : BB) {
+      Cost InstCost = getInstructionCost(Inst, TTI);
+      if (InstCost.Size.isValid())
+        FuncSize += InstCost.Size;
+      if (InstCost.Cycles.isValid())
+        BBCycles += InstCost.Cycles;
+    }
+    FuncCycles += scaleByFreq(BBCycles, BFI.getBlockFreq(&BB).getFrequency());
+  }
+  InstructionCost SizeLeft = FuncSize * Budget.SizePercent / 100;
+  InstructionCost CyclesLeft = FuncCycles * Budget.CyclePercent / 100;
+
+  if (!ModuleSizeLeft)
+    ModuleSizeLeft = Budget.ModuleSize;
+
+  // STEP 2: Pick the rewrites, from the coldest to the hottest instruction
+  // (instructions with equal frequencies in program order), while they fit
+  // into the budgets
+  auto GetFreq = [&](size_t Idx) {
+    return BFI.getBlockFreq(Rewrites[Idx].first->getParent()).getFrequency();
+  };
+  std::vector<size_t> Order(Rewrites.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  llvm::stable_sort(Order, [&](size_t LHS, size_t RHS) {
+    return GetFreq(LHS) < GetFreq(RHS);
+  });
+
+  // (identity, type) <--> the cost of the formula
+  DenseMap<std::pair<const MBAIdentity *, Type *>, Cost> FormulaCosts;
+  BitVector Picked(Rewrites.size());
+  for (size_t Idx : Order) {
+    BinaryOperator *BinOp = Rewrites[Idx].first;
+    const MBAIdentity *Identity = Rewrites[Idx].second;
+
+    auto CachedCost = FormulaCosts.find({Identity, BinOp->getType()});
+    if (CachedCost == FormulaCosts.end())
+      CachedCost =
+          FormulaCosts
+              .try_emplace({Identity, BinOp->getType()},
+                           getFormulaCost(*Identity, BinOp->getType(), TTI))
+              .first;
+
+    // The overhead is the cost of the formula minus the cost of BinOp
+    Cost BinOpCost = getInstructionCost(*BinOp, TTI);
+    InstructionCost Size =
+        std::max(CachedCost->second.Size - BinOpCost.Size, InstructionCost(0));
+    InstructionCost Cycles = scaleByFreq(
+        std::max(CachedCost->second.Cycles - BinOpCost.Cycles,
+                 InstructionCost(0)),
+        GetFreq(Idx));
+
+    if (!Size.isValid() || !Cycles.isValid() || Size > SizeLeft ||
+        Cycles > CyclesLeft || (Budget.ModuleSize && Size > *ModuleSizeLeft)) {
+      LLVM_DEBUG(dbgs() << *BinOp << " is over budget. Skipping it\n");
+      continue;
+    }
+
+    SizeLeft -= Size;
+    CyclesLeft -= Cycles;
+    *ModuleSizeLeft -= Size;
+    Picked.set(Idx);
+  }
+
+  // STEP 3: Keep the picked rewrites (in program order)
+  MBARewriter::RewriteList Kept;
+  for (size_t Idx : Picked.set_bits())
+    Kept.push_back(Rewrites[Idx]);
+
+  unsigned NumRemoved = Rewrites.size() - Kept.size();
+  Rewrites = std::move(Kept);
+  return NumRemoved;
+}
@@ -0,0 +1,239 @@
+//==============================================================================
+// FILE:
+//    MBAIdentities.cpp
+//
+// DESCRIPTION:
+//    The library of Mixed Boolean-Arithmetic identities and the rewrite engine
+//    (MBARewriter) shared by the MBA passes.
+//
+//    Every identity is a row in the table below: the opcode it rewrites, its
+//    name, the formula and a function that builds the formula with IRBuilder.
+//    All identities hold modulo 2^n, i.e. for all integer widths, apart from
+//    "add-affine" which needs per-width constants (see [1] and MBAAdd.cpp).
+//    The sub-expressions are built in separate statements, so that the order
+//    of the generated instructions doesn't depend on the order in which the
+//    compiler evaluates function arguments.
+//
+// [1] "Defeating MBA-based Obfuscation" Ninon Eyrolles, Louis Goubin, Marion
+//     Videau
+// [2] "Hacker's Delight" by Henry S. Warren, Jr.
+//
+// License: MIT
+//==============================================================================
+#include "MBAIdentities.h"
+
+#include "llvm/ADT/APInt.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+
+#include <array>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "mba-identities"
+
+//-----------------------------------------------------------------------------
+// The constants for "add-affine"
+//-----------------------------------------------------------------------------
+namespace {
+// The constants in `(((a ^ b) + 2 * (a & b)) * A + B) * C + D` for one bit
+// width
+struct MBAAddConstants {
+  llvm::APInt A, B, C, D;
+};
+} // namespace
+
+// Returns the constants for BitWidth, or null if BitWidth is not supported.
+// The tables for all supported widths (8, 16, 32 and 64) are computed once.
+static const MBAAddConstants *getMBAAddConstants(unsigned BitWidth) {
+  static const std::array<MBAAddConstants, 4> Tables = [] {
+    std::array<MBAAddConstants, 4> Res;
+    for (unsigned Idx = 0; Idx < Res.size(); Idx++) {
+      unsigned Width = 8u << Idx;
+      APInt A(Width, 39), B(Width, 23);
+
+      // The inverse of A modulo 2^Width (Newton's iteration - A is its own
+      // inverse modulo 2^3 and every step doubles the number of correct bits)
+      APInt C = A;
+      for (unsigned CorrectBits = 3; CorrectBits < Width; CorrectBits *= 2)
+        C *= APInt(Width, 2) - A * C;
+
+      Res[Idx] = {A, B, C, -(C * B)};
+    }
+    return Res;
+  }();
+
+  if (BitWidth < 8 || BitWidth > 64 || !isPowerOf2_32(BitWidth))
+    return nullptr;
+  return &Tables[Log2_32(BitWidth) - 3];
+}
+
+//-----------------------------------------------------------------------------
+// The identities
+//-----------------------------------------------------------------------------
+// Returns C as a constant of the same type as V (a splat for vectors)
+static Constant *getConst(Value *V, uint64_t C) {
+  return ConstantInt::get(V->getType(), C);
+}
+
+static const MBAIdentity Identities[] = {
+    // a + b
+    {Instruction::Add, "add-xor-and", "(a ^ b) + 2 * (a & b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Xor = B.CreateXor(X, Y);
+       Value *And = B.CreateAnd(X, Y);
+       return B.CreateAdd(Xor, B.CreateMul(getConst(X, 2), And));
+     }},
+    {Instruction::Add, "add-or-and", "(a | b) + (a & b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Or = B.CreateOr(X, Y);
+       Value *And = B.CreateAnd(X, Y);
+       return B.CreateAdd(Or, And);
+     }},
+    {Instruction::Add, "add-affine",
+     "(((a ^ b) + 2 * (a & b)) * A + B) * C + D (39, 23, 151, 111 for i8)",
+     [](const Type *Ty) {
+       return getMBAAddConstants(Ty->getScalarSizeInBits()) != nullptr;
+     },
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       const MBAAddConstants *Consts =
+           getMBAAddConstants(X->getType()->getScalarSizeInBits());
+       Type *Ty = X->getType();
+
+       // e0 = a ^ b, e1 = 2 * (a & b), e2 = e0 + e1
+       Value *Xor = B.CreateXor(X, Y);
+       Value *And = B.CreateAnd(X, Y);
+       Value *Sum = B.CreateAdd(Xor, B.CreateMul(getConst(X, 2), And));
+       // e3 = e2 * A, e4 = e3 + B
+       Value *Mul = B.CreateMul(ConstantInt::get(Ty, Consts->A), Sum);
+       Value *F = B.CreateAdd(ConstantInt::get(Ty, Consts->B), Mul);
+       // e5 = e4 * C, E = e5 + D
+       Value *G = B.CreateMul(ConstantInt::get(Ty, Consts->C), F);
+       return B.CreateAdd(ConstantInt::get(Ty, Consts->D), G);
+     }},
+    // a - b
+    {Instruction::Sub, "sub-not", "(a + ~b) + 1", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       return B.CreateAdd(B.CreateAdd(X, B.CreateNot(Y)), getConst(X, 1));
+     }},
+    {Instruction::Sub, "sub-xor-and", "(a ^ -b) + 2 * (a & -b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *NegY = B.CreateNeg(Y);
+       Value *Xor = B.CreateXor(X, NegY);
+       Value *And = B.CreateAnd(X, NegY);
+       return B.CreateAdd(Xor, B.CreateMul(getConst(X, 2), And));
+     }},
+    {Instruction::Sub, "sub-and-not", "(a & ~b) - (~a & b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *LHS = B.CreateAnd(X, B.CreateNot(Y));
+       Value *RHS = B.CreateAnd(B.CreateNot(X), Y);
+       return B.CreateSub(LHS, RHS);
+     }},
+    // a ^ b
+    {Instruction::Xor, "xor-or-and", "(a | b) - (a & b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Or = B.CreateOr(X, Y);
+       Value *And = B.CreateAnd(X, Y);
+       return B.CreateSub(Or, And);
+     }},
+    {Instruction::Xor, "xor-or-nand", "(a | b) & ~(a & b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Or = B.CreateOr(X, Y);
+       Value *Nand = B.CreateNot(B.CreateAnd(X, Y));
+       return B.CreateAnd(Or, Nand);
+     }},
+    // a | b
+    {Instruction::Or, "or-xor-and", "(a ^ b) + (a & b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Xor = B.CreateXor(X, Y);
+       Value *And = B.CreateAnd(X, Y);
+       return B.CreateAdd(Xor, And);
+     }},
+    {Instruction::Or, "or-and-not", "(a & ~b) + b", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       return B.CreateAdd(B.CreateAnd(X, B.CreateNot(Y)), Y);
+     }},
+    // a & b
+    {Instruction::And, "and-add-or", "(a + b) - (a | b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Add = B.CreateAdd(X, Y);
+       Value *Or = B.CreateOr(X, Y);
+       return B.CreateSub(Add, Or);
+     }},
+    {Instruction::And, "and-or-xor", "(a | b) - (a ^ b)", nullptr,
+     [](IRBuilderBase &B, Value *X, Value *Y) {
+       Value *Or = B.CreateOr(X, Y);
+       Value *Xor = B.CreateXor(X, Y);
+       return B.CreateSub(Or, Xor);
+     }},
+};
+
+ArrayRef<MBAIdentity> getMBAIdentities() { return Identities; }
+
+const MBAIdentity *getMBAIdentity(StringRef Name) {
+  for (const MBAIdentity &Identity : Identities)
+    if (Name == Identity.Name)
+      return &Identity;
+  return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+// MBARewriter implementation
+//-----------------------------------------------------------------------------
+MBARewriter::MBARewriter(ArrayRef<const MBAIdentity *> Identities) {
+  for (const MBAIdentity *Identity : Identities)
+    ByOpcode[Identity->Opcode].push_back(Identity);
+}
+
+MBARewriter::RewriteList MBARewriter::match(Function &F,
+                                             ChooseFn Choose) const {
+  // Match all instructions in one go
+  RewriteList Rewrites;
+  SmallVector<const MBAIdentity *, 4> Applicable;
+  for (Instruction &Inst : instructions(F)) {
+    auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
+    if (!BinOp || !BinOp->getType()->isIntOrIntVectorTy())
+      continue;
+
+    auto Candidates = ByOpcode.find(BinOp->getOpcode());
+    if (Candidates == ByOpcode.end())
+      continue;
+
+    Applicable.clear();
+    for (const MBAIdentity *Identity : Candidates->second)
+      if (!Identity->IsApplicable || Identity->IsApplicable(BinOp->getType()))
+        Applicable.push_back(Identity);
+    if (Applicable.empty())
+      continue;
+
+    if (const MBAIdentity *Chosen = Choose(*BinOp, Applicable))
+      Rewrites.emplace_back(BinOp, Chosen);
+  }
+
+  return Rewrites;
+}
+
+unsigned
+MBARewriter::rewrite(ArrayRef<RewriteList::value_type> Rewrites) {
+  // Rewrite the matched instructions in one batch. Operands that have already
+  // been rewritten refer to the new values (via RAUW).
+  for (auto &Rewrite : Rewrites) {
+    BinaryOperator *BinOp = Rewrite.first;
+    IRBuilder<> Builder(BinOp);
+    Value *NewValue =
+        Rewrite.second->Build(Builder, BinOp->getOperand(0),
+                              BinOp->getOperand(1));
+
+    // The following is visible only if you pass -debug on the command line
+    // *and* you have an assert build.
+    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewValue << "\n");
+
+    NewValue->takeName(BinOp);
+    BinOp->replaceAllUsesWith(NewValue);
+    BinOp->eraseFromParent();
+  }
+
+  return Rewrites.size();
+}
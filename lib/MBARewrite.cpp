@@ -0,0 +1,152 @@
+//==============================================================================
+// FILE:
+//    MBARewrite.cpp
+//
+// DESCRIPTION:
+//    Obfuscates integer add, sub, xor, or and and instructions through Mixed
+//    Boolean-Arithmetic (MBA) identities, e.g.:
+//      a + b == (a | b) + (a & b)
+//      a ^ b == (a | b) - (a & b)
+//    The identities come from the library in MBAIdentities.cpp. For every
+//    instruction, one of the identities for its opcode is picked at random.
+//    Unlike MBAAdd and MBASub (one identity each), this pass covers all
+//    opcodes with a single walk over every function.
+//
+// USAGE:
+//    1. Legacy pass manager:
+//      $ opt -load <BUILD_DIR>/lib/libMBARewrite.so --legacy-mba-rewrite `\`
+//        [-mba-rewrite-identities=<name>,...] [-mba-rewrite-ratio=<ratio>] `\`
+//        <bitcode-file>
+//    2. New pass manager:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBARewrite.so `\`
+//        -passes="mba-rewrite" <bitcode-file>
+//
+// License: MIT
+//==============================================================================
+#include "MBARewrite.h"
+
+#include "FunctionRNG.h"
+#include "MBAIdentities.h"
+#include "Ratio.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "mba-rewrite"
+
+STATISTIC(SubstCount, "The # of substituted instructions");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+// CL parser specialisation to parse the names of MBA identities (see
+// getMBAIdentities)
+namespace llvm {
+namespace cl {
+template <>
+class parser<const MBAIdentity *>
+    : public basic_parser<const MBAIdentity *> {
+public:
+  parser(Option &Opt) : basic_parser<const MBAIdentity *>(Opt) {}
+
+  // Returns false on success
+  bool parse(Option &Opt, StringRef ArgName, StringRef Arg,
+             const MBAIdentity *&Val) {
+    Val = getMBAIdentity(Arg);
+    if (!Val)
+      return Opt.error("'" + Arg + "' is not a known MBA identity");
+    return false;
+  }
+
+  StringRef getValueName() const override { return "identity"; }
+};
+} // namespace cl
+} // namespace llvm
+
+static cl::list<const MBAIdentity *, bool, cl::parser<const MBAIdentity *>>
+    SelectedIdentities{
+        "mba-rewrite-identities",
+        cl::desc{"The MBA identities to use, e.g. add-or-and,xor-or-and (all "
+                 "identities by default)"},
+        cl::CommaSeparated};
+
+static cl::opt<Ratio, false, llvm::cl::parser<Ratio>> RewriteRatio{
+    "mba-rewrite-ratio",
+    cl::desc("Only rewrite <ratio> of the candidates"),
+    cl::value_desc("ratio"), cl::init(1.), cl::Optional};
+
+//-----------------------------------------------------------------------------
+// MBARewrite Implementation
+//-----------------------------------------------------------------------------
+bool MBARewrite::runOnFunction(Function &F) {
+  FunctionRNG RNG(F, DEBUG_TYPE);
+
+  // Use the identities selected on the command line or, by default, all
+  SmallVector<const MBAIdentity *, 16> Identities(SelectedIdentities.begin(),
+                                                  SelectedIdentities.end());
+  if (Identities.empty())
+    for (const MBAIdentity &Identity : getMBAIdentities())
+      Identities.push_back(&Identity);
+
+  MBARewriter Rewriter(Identities);
+  unsigned NumRewritten = Rewriter.run(
+      F, [&](const BinaryOperator &,
+             ArrayRef<const MBAIdentity *> Identities) -> const MBAIdentity * {
+        if (RNG.nextDouble() > RewriteRatio.getRatio())
+          return nullptr;
+        return Identities[RNG.nextBelow(Identities.size())];
+      });
+
+  SubstCount += NumRewritten;
+  return NumRewritten != 0;
+}
+
+PreservedAnalyses MBARewrite::run(llvm::Function &F,
+                                  llvm::FunctionAnalysisManager &) {
+  bool Changed = runOnFunction(F);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+bool LegacyMBARewrite::runOnFunction(llvm::Function &F) {
+  return Impl.runOnFunction(F);
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getMBARewritePluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "mba-rewrite", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "mba-rewrite") {
+                    FPM.addPass(MBARewrite());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getMBARewritePluginInfo();
+}
+
+//-----------------------------------------------------------------------------
+// Legacy PM Registration
+//-----------------------------------------------------------------------------
+char LegacyMBARewrite::ID = 0;
+
+// Register the pass - required for (among others) opt
+static RegisterPass<LegacyMBARewrite> X(/*PassArg=*/"legacy-mba-rewrite",
+                                        /*Name=*/"MBARewrite",
+                                        /*CFGOnly=*/true,
+                                        /*is_analysis=*/false);
@@ -0,0 +1,549 @@
+//==============================================================================
+// FILE:
+//    MBASimplify.cpp
+//
+// DESCRIPTION:
+//    Simplifies (i.e. de-obfuscates) linear Mixed Boolean-Arithmetic (MBA)
+//    expressions, e.g. the ones generated by MBAAdd, MBASub and MBARewrite:
+//      (((a ^ b) + 2 * (a & b)) * 39 + 23) * 151 + 111 --> a + b
+//      (a + ~b) + 1                                    --> a - b
+//      (a | b) - (a & b)                               --> a ^ b
+//
+//    A linear MBA expression E(a, b) is a sum of bitwise expressions of a and
+//    b, multiplied by constants. Such an expression is computed bit by bit,
+//    so it's determined by its signature S, i.e. by the values of E for
+//    one-bit inputs:
+//      E(a, b) == sum(2^i * S(a_i, b_i)) (mod 2^n)
+//    where a_i and b_i are the bits of a and b. For example, the signature of
+//    a constant C is -C everywhere (as sum(2^i) == -1). This gives the
+//    canonical form of E:
+//      E(a, b) == -S(0, 0) + (S(1, 0) - S(0, 0)) * a + (S(0, 1) - S(0, 0)) * b
+//                 + (S(1, 1) - S(1, 0) - S(0, 1) + S(0, 0)) * (a & b)
+//    If S only takes the values 0 and 1, then E is the bitwise function with
+//    the truth table S instead. See [1] and [2] for details.
+//
+//    Every integer binary operator is tried as the root of an expression,
+//    from the last instruction to the first one. So the largest expressions
+//    are simplified first (and their sub-expressions are deleted with them).
+//    An expression is replaced only if the simplified form has fewer
+//    instructions than are deleted. Sub-expressions that are also used
+//    elsewhere are kept, so these don't count.
+//
+//    Values other than add, sub, mul and shl by a constant, and, or and xor
+//    are the variables of an expression (e.g. arguments, loads and PHI
+//    nodes). So are the constants in bitwise operations, e.g. 1 in `x & 1`.
+//    Expressions with more than two variables are left as they are (but
+//    their sub-expressions may still be simplified).
+//
+// USAGE:
+//    1. Legacy pass manager:
+//      $ opt -load <BUILD_DIR>/lib/libMBASimplify.so `\`
+//        --legacy-mba-simplify <bitcode-file>
+//    2. New pass manager:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBASimplify.so `\`
+//        -passes="mba-simplify" <bitcode-file>
+//
+// [1] "Defeating MBA-based Obfuscation" Ninon Eyrolles, Louis Goubin, Marion
+//     Videau
+// [2] "Efficient Deobfuscation of Linear Mixed Boolean-Arithmetic
+//     Expressions" Benjamin Reichenwallner, Peter Meerwein
+//
+// License: MIT
+//==============================================================================
+#include "MBASimplify.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include <array>
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+#define DEBUG_TYPE "mba-simplify"
+
+STATISTIC(SimplifiedCount, "The # of simplified expressions");
+
+// Pass Option declaration
+static cl::opt<unsigned> MaxExpressionSize{
+    "mba-simplify-max-size",
+    cl::desc{"The maximum number of instructions in an expression to simplify"},
+    cl::value_desc{"instructions"}, cl::init(64)};
+
+// The number of sets of operands of bitwise operations that are tried as the
+// variables of an expression (see MBASimplify::simplifyExpression)
+static constexpr size_t MaxNestedAttempts = 8;
+
+//-----------------------------------------------------------------------------
+// Signatures of linear MBA expressions
+//-----------------------------------------------------------------------------
+namespace {
+// S(x, y) for x, y in {0, 1}, indexed by x + 2 * y
+using Signature = std::array<APInt, 4>;
+
+// Computes the signature of the linear MBA expression rooted at an
+// instruction, e.g.:
+//    LinearMBAMatcher Matcher;
+//    if (Matcher.match(Root))
+//      // Root == E(Matcher.X, Matcher.Y), where E has signature Matcher.Sig
+class LinearMBAMatcher {
+public:
+  // Values in Variables are treated as variables, even if these are linear
+  // MBA expressions themselves
+  explicit LinearMBAMatcher(ArrayRef<Value *> Variables = {})
+      : Opaque(Variables.begin(), Variables.end()) {}
+
+  // Returns true if Root is a linear MBA expression in (at most) two
+  // variables
+  bool match(BinaryOperator &Root);
+
+  // The variables (Y is null for expressions in one variable)
+  Value *X = nullptr;
+  Value *Y = nullptr;
+  Signature Sig;
+  // The number of instructions in the expression that are not used outside
+  // of it (i.e. that are deleted if the expression is replaced)
+  unsigned Size = 0;
+  // For every bitwise operation that is not a bitwise expression of X and Y,
+  // the sets of operands that may be the variables instead (see
+  // MBASimplify::simplifyExpression). From the innermost operation.
+  SmallVector<SmallVector<Value *, 2>, 4> MixedOperands;
+
+private:
+  bool visit(Value *V, Signature &Res);
+  bool visitVariable(Value *V, Signature &Res);
+
+  // The sub-expressions visited so far (shared sub-expressions are visited
+  // once). Instructions that turn out to be variables are not included.
+  DenseMap<Value *, Signature> Visited;
+  // The number of visited instructions (see -mba-simplify-max-size)
+  unsigned NumVisited = 0;
+  SmallPtrSet<Value *, 4> Opaque;
+};
+} // namespace
+
+static bool isBoolean(const Signature &Sig) {
+  return all_of(Sig,
+                [](const APInt &Val) { return Val.isZero() || Val.isOne(); });
+}
+
+bool LinearMBAMatcher::match(BinaryOperator &Root) {
+  if (!visit(&Root, Sig) || !X || !Visited.count(&Root))
+    return false;
+
+  // Count the instructions that are deleted together with Root, i.e. Root
+  // and the sub-expressions (reachable from Root without going through the
+  // variables) that are only used within the expression. Sub-expressions
+  // that have other users are kept, so these don't count (as in
+  // Reassociate). A sub-expression is dead once all its uses are.
+  SmallVector<Instruction *, 16> Worklist{&Root};
+  DenseMap<Value *, unsigned> LiveUses;
+  Size = 1;
+  while (!Worklist.empty()) {
+    Instruction *Inst = Worklist.pop_back_val();
+    for (Value *Op : Inst->operands()) {
+      if (!Visited.count(Op))
+        continue;
+      auto [It, Inserted] = LiveUses.try_emplace(Op, Op->getNumUses());
+      if (--It->second == 0) {
+        Worklist.push_back(cast<Instruction>(Op));
+        Size++;
+      }
+    }
+  }
+  return true;
+}
+
+bool LinearMBAMatcher::visitVariable(Value *V, Signature &Res) {
+  if (!X)
+    X = V;
+  else if (!Y && V != X)
+    Y = V;
+
+  unsigned Width = V->getType()->getScalarSizeInBits();
+  if (V == X)
+    Res = {APInt(Width, 0), APInt(Width, 1), APInt(Width, 0), APInt(Width, 1)};
+  else if (V == Y)
+    Res = {APInt(Width, 0), APInt(Width, 0), APInt(Width, 1), APInt(Width, 1)};
+  else
+    return false;
+  return true;
+}
+
+bool LinearMBAMatcher::visit(Value *V, Signature &Res) {
+  // Constants (including vector splats)
+  const APInt *C;
+  if (PatternMatch::match(V, m_APInt(C))) {
+    Res.fill(-*C);
+    return true;
+  }
+
+  auto *BinOp = dyn_cast<BinaryOperator>(V);
+  if (!BinOp || Opaque.count(BinOp))
+    return visitVariable(V, Res);
+
+  auto CachedSig = Visited.find(BinOp);
+  if (CachedSig != Visited.end()) {
+    Res = CachedSig->second;
+    return true;
+  }
+  if (++NumVisited > MaxExpressionSize)
+    return false;
+
+  Value *LHSVal = BinOp->getOperand(0), *RHSVal = BinOp->getOperand(1);
+  Signature LHS, RHS;
+  switch (BinOp->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+    if (!visit(LHSVal, LHS) || !visit(RHSVal, RHS))
+      return false;
+    for (unsigned Idx = 0; Idx < Res.size(); Idx++)
+      Res[Idx] = BinOp->getOpcode() == Instruction::Add ? LHS[Idx] + RHS[Idx]
+                                                        : LHS[Idx] - RHS[Idx];
+    break;
+  case Instruction::Mul:
+    // Only multiplication by a constant is linear
+    if (PatternMatch::match(LHSVal, m_APInt(C)))
+      std::swap(LHSVal, RHSVal);
+    else if (!PatternMatch::match(RHSVal, m_APInt(C)))
+      return visitVariable(BinOp, Res);
+    if (!visit(LHSVal, LHS))
+      return false;
+    for (unsigned Idx = 0; Idx < Res.size(); Idx++)
+      Res[Idx] = LHS[Idx] * *C;
+    break;
+  case Instruction::Shl:
+    // Only shifts by a constant are linear (x << C == x * 2^C)
+    if (!PatternMatch::match(RHSVal, m_APInt(C)) ||
+        C->uge(BinOp->getType()->getScalarSizeInBits()))
+      return visitVariable(BinOp, Res);
+    if (!visit(LHSVal, LHS))
+      return false;
+    for (unsigned Idx = 0; Idx < Res.size(); Idx++)
+      Res[Idx] = LHS[Idx].shl(*C);
+    break;
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor: {
+    // ~E == -E - 1 holds for any E, so `not` is linear
+    if (BinOp->getOpcode() == Instruction::Xor &&
+        PatternMatch::match(RHSVal, m_AllOnes())) {
+      if (!visit(LHSVal, LHS))
+        return false;
+      for (unsigned Idx = 0; Idx < Res.size(); Idx++)
+        Res[Idx] = 1 - LHS[Idx];
+      break;
+    }
+
+    // Otherwise both operands need to be bitwise expressions. Constants other
+    // than 0 and -1 are not bitwise expressions of X and Y (e.g. in `x & 1`),
+    // so these are variables here. This way, e.g. MBAAdd applied to `x + 1`
+    // is simplified too.
+    auto VisitBitwiseOp = [&](Value *Op, Signature &OpSig) {
+      const APInt *OpC;
+      if (PatternMatch::match(Op, m_APInt(OpC)) && !OpC->isZero() &&
+          !OpC->isAllOnes())
+        return visitVariable(Op, OpSig);
+      return visit(Op, OpSig);
+    };
+    bool Matched =
+        VisitBitwiseOp(LHSVal, LHS) && VisitBitwiseOp(RHSVal, RHS);
+    if (!Matched) {
+      // There were too many variables in the operands, maybe these are the
+      // variables
+      MixedOperands.push_back({LHSVal, RHSVal});
+      return false;
+    }
+    if (!isBoolean(LHS) || !isBoolean(RHS)) {
+      // Either the operand(s) that are not bitwise expressions, or both
+      // operands may be the variables
+      if (!isBoolean(LHS) && !isBoolean(RHS)) {
+        MixedOperands.push_back({LHSVal, RHSVal});
+      } else {
+        MixedOperands.push_back({isBoolean(LHS) ? RHSVal : LHSVal});
+        MixedOperands.push_back({LHSVal, RHSVal});
+      }
+      return visitVariable(BinOp, Res);
+    }
+    for (unsigned Idx = 0; Idx < Res.size(); Idx++) {
+      if (BinOp->getOpcode() == Instruction::And)
+        Res[Idx] = LHS[Idx] & RHS[Idx];
+      else if (BinOp->getOpcode() == Instruction::Or)
+        Res[Idx] = LHS[Idx] | RHS[Idx];
+      else
+        Res[Idx] = LHS[Idx] ^ RHS[Idx];
+    }
+    break;
+  }
+  default:
+    return visitVariable(BinOp, Res);
+  }
+
+  Visited[BinOp] = Res;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Building the simplified expressions
+//-----------------------------------------------------------------------------
+// Builds the bitwise function of X and Y with the truth table Sig (see
+// isBoolean)
+static Value *buildBitwise(IRBuilderBase &Builder, const Signature &Sig,
+                           Value *X, Value *Y) {
+  unsigned TruthTable = 0;
+  for (unsigned Idx = 0; Idx < Sig.size(); Idx++)
+    TruthTable |= Sig[Idx].getZExtValue() << Idx;
+
+  // The truth tables of X and Y are 0b1010 and 0b1100, respectively
+  Type *Ty = X->getType();
+  switch (TruthTable) {
+  case 0x0:
+    return Constant::getNullValue(Ty);
+  case 0x1:
+    return Builder.CreateNot(Builder.CreateOr(X, Y));
+  case 0x2:
+    return Builder.CreateAnd(X, Builder.CreateNot(Y));
+  case 0x3:
+    return Builder.CreateNot(Y);
+  case 0x4:
+    return Builder.CreateAnd(Builder.CreateNot(X), Y);
+  case 0x5:
+    return Builder.CreateNot(X);
+  case 0x6:
+    return Builder.CreateXor(X, Y);
+  case 0x7:
+    return Builder.CreateNot(Builder.CreateAnd(X, Y));
+  case 0x8:
+    return Builder.CreateAnd(X, Y);
+  case 0x9:
+    return Builder.CreateNot(Builder.CreateXor(X, Y));
+  case 0xA:
+    return X;
+  case 0xB:
+    return Builder.CreateOr(X, Builder.CreateNot(Y));
+  case 0xC:
+    return Y;
+  case 0xD:
+    return Builder.CreateOr(Builder.CreateNot(X), Y);
+  case 0xE:
+    return Builder.CreateOr(X, Y);
+  default:
+    return Constant::getAllOnesValue(Ty);
+  }
+}
+
+// Builds the canonical form of the linear MBA expression with signature Sig
+static Value *buildLinear(IRBuilderBase &Builder, const Signature &Sig,
+                          Value *X, Value *Y) {
+  Type *Ty = X->getType();
+  APInt CoeffX = Sig[1] - Sig[0];
+  APInt CoeffY = Sig[2] - Sig[0];
+  APInt CoeffXY = Sig[3] - Sig[2] - Sig[1] + Sig[0];
+  APInt Const = -Sig[0];
+
+  // The variables can be constants (see LinearMBAMatcher::visit), fold these
+  const APInt *ConstX, *ConstY;
+  bool IsConstX = match(X, m_APInt(ConstX));
+  bool IsConstY = Y && match(Y, m_APInt(ConstY));
+  if (IsConstX && IsConstY) {
+    Const += CoeffXY * (*ConstX & *ConstY);
+    CoeffXY = 0;
+  }
+  if (IsConstX) {
+    Const += CoeffX * *ConstX;
+    CoeffX = 0;
+  }
+  if (IsConstY) {
+    Const += CoeffY * *ConstY;
+    CoeffY = 0;
+  }
+
+  // Factor out a common power of two, e.g.
+  //    4 * a - 4 * b + 4 == (a - b + 1) << 2
+  unsigned Shift = Ty->getScalarSizeInBits(), NumNonZero = 0;
+  for (const APInt *Coeff : {&CoeffX, &CoeffY, &CoeffXY, &Const}) {
+    if (Coeff->isZero())
+      continue;
+    Shift = std::min(Shift, Coeff->countTrailingZeros());
+    NumNonZero++;
+  }
+  if (NumNonZero < 2)
+    Shift = 0;
+  for (APInt *Coeff : {&CoeffX, &CoeffY, &CoeffXY, &Const})
+    Coeff->ashrInPlace(Shift);
+
+  SmallVector<std::pair<APInt, Value *>, 3> Terms;
+  if (!CoeffX.isZero())
+    Terms.emplace_back(CoeffX, X);
+  if (!CoeffY.isZero())
+    Terms.emplace_back(CoeffY, Y);
+  if (!CoeffXY.isZero())
+    Terms.emplace_back(CoeffXY, Builder.CreateAnd(X, Y));
+  // Start with a term that is added rather than subtracted, so that e.g.
+  // a - b is a single `sub`
+  std::stable_partition(Terms.begin(), Terms.end(),
+                        [](const auto &Term) { return !Term.first.isAllOnes(); });
+
+  Value *Res = nullptr;
+  for (auto &Term : Terms) {
+    if (Term.first.isAllOnes()) {
+      Res = Res ? Builder.CreateSub(Res, Term.second)
+                : Builder.CreateNeg(Term.second);
+      continue;
+    }
+    Value *Scaled =
+        Term.first.isOne()
+            ? Term.second
+            : Builder.CreateMul(Term.second, ConstantInt::get(Ty, Term.first));
+    Res = Res ? Builder.CreateAdd(Res, Scaled) : Scaled;
+  }
+
+  if (!Res)
+    return ConstantInt::get(Ty, Const);
+  if (!Const.isZero())
+    Res = Builder.CreateAdd(Res, ConstantInt::get(Ty, Const));
+  if (Shift)
+    Res = Builder.CreateShl(Res, Shift);
+  return Res;
+}
+
+//-----------------------------------------------------------------------------
+// MBASimplify Implementation
+//-----------------------------------------------------------------------------
+// Replaces Root with the simplified form of the expression found by Matcher,
+// if it has fewer instructions. Returns true if Root was replaced.
+static bool replaceIfSimpler(BinaryOperator &Root,
+                             const LinearMBAMatcher &Matcher) {
+  // Build the simplified expression right before Root and count the new
+  // instructions
+  unsigned NumNewInsts = 0;
+  IRBuilder<ConstantFolder, IRBuilderCallbackInserter> Builder(
+      Root.getContext(), ConstantFolder(),
+      IRBuilderCallbackInserter([&](Instruction *) { NumNewInsts++; }));
+  Builder.SetInsertPoint(&Root);
+  Value *NewValue = isBoolean(Matcher.Sig)
+                        ? buildBitwise(Builder, Matcher.Sig, Matcher.X,
+                                       Matcher.Y)
+                        : buildLinear(Builder, Matcher.Sig, Matcher.X,
+                                      Matcher.Y);
+
+  // Keep the original expression if it's not any simpler
+  if (NumNewInsts >= Matcher.Size) {
+    RecursivelyDeleteTriviallyDeadInstructions(NewValue);
+    return false;
+  }
+
+  // The following is visible only if you pass -debug on the command line
+  // *and* you have an assert build.
+  LLVM_DEBUG(dbgs() << Root << " -> " << *NewValue << "\n");
+
+  if (NumNewInsts)
+    NewValue->takeName(&Root);
+  Root.replaceAllUsesWith(NewValue);
+  RecursivelyDeleteTriviallyDeadInstructions(&Root);
+  return true;
+}
+
+bool MBASimplify::simplifyExpression(BinaryOperator &Root) {
+  LinearMBAMatcher Matcher;
+  if (Matcher.match(Root) && replaceIfSimpler(Root, Matcher))
+    return true;
+
+  // Bitwise operations on arithmetic expressions, e.g. (x | y) + (x & y) with
+  // x = a ^ b and y = 2 * (a & b), are variables above. These are linear MBA
+  // expressions of their operands, though (e.g. MBARewrite applied twice),
+  // so try again with the operands as the variables. Only the innermost few
+  // operations are tried.
+  size_t NumAttempts =
+      std::min(Matcher.MixedOperands.size(), MaxNestedAttempts);
+  for (size_t Idx = 0; Idx < NumAttempts; Idx++) {
+    LinearMBAMatcher NestedMatcher(Matcher.MixedOperands[Idx]);
+    if (NestedMatcher.match(Root) && replaceIfSimpler(Root, NestedMatcher))
+      return true;
+  }
+  return false;
+}
+
+bool MBASimplify::runOnFunction(Function &F) {
+  unsigned NumSimplified = 0;
+  // Expressions with too many variables may become simpler once their
+  // sub-expressions have been simplified, so repeat until nothing changes.
+  // An expression is only replaced if fewer instructions are created than
+  // deleted (see LinearMBAMatcher::Size), so this terminates.
+  bool Changed;
+  do {
+    // Visit the candidates bottom-up. The instructions deleted along the way
+    // (i.e. the sub-expressions of the simplified expressions) are skipped.
+    SmallVector<WeakVH, 32> Candidates;
+    for (Instruction &Inst : instructions(F))
+      if (isa<BinaryOperator>(Inst) && Inst.getType()->isIntOrIntVectorTy())
+        Candidates.push_back(&Inst);
+
+    Changed = false;
+    for (WeakVH &Candidate : reverse(Candidates)) {
+      Value *Root = Candidate;
+      if (Root && simplifyExpression(*cast<BinaryOperator>(Root))) {
+        NumSimplified++;
+        Changed = true;
+      }
+    }
+  } while (Changed);
+
+  // Update the statistics
+  SimplifiedCount += NumSimplified;
+  return NumSimplified != 0;
+}
+
+PreservedAnalyses MBASimplify::run(llvm::Function &F,
+                                   llvm::FunctionAnalysisManager &) {
+  bool Changed = runOnFunction(F);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+bool LegacyMBASimplify::runOnFunction(llvm::Function &F) {
+  return Impl.runOnFunction(F);
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getMBASimplifyPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "mba-simplify", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "mba-simplify") {
+                    FPM.addPass(MBASimplify());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getMBASimplifyPluginInfo();
+}
+
+//-----------------------------------------------------------------------------
+// Legacy PM Registration
+//-----------------------------------------------------------------------------
+char LegacyMBASimplify::ID = 0;
+
+static RegisterPass<LegacyMBASimplify> X(/*PassArg=*/"legacy-mba-simplify",
+                                         /*Name=*/"MBASimplify",
+                                         /*CFGOnly=*/true,
+                                         /*is_analysis=*/false);
@@ -9,6 +9,11 @@
 //      a - b == (a + ~b) + 1
 //    See formula 2.2 (j) in [1].
 //
+//    With -mba-sub-budgeted, the instructions are only substituted within a
+//    code size and a latency budget (see MBABudget). The cost of every
+//    substitution is estimated with the target's cost model (TTI) and the
+//    coldest instructions are substituted first.
+//
 // USAGE:
 //    1. Legacy pass manager:
 //      $ opt -load <BUILD_DIR>/lib/libMBASub.so --legacy-mba-sub <bitcode-file>
@@ -22,83 +27,83 @@
 //==============================================================================
 #include "MBASub.h"
 
+#include "MBAIdentities.h"
+
 #include "llvm/ADT/Statistic.h"
-#include "llvm/IR/IRBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-#include "llvm/Transforms/Utils/BasicBlockUtils.h"
-
-#include <random>
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "mba-sub"
 
 STATISTIC(SubstCount, "The # of substituted instructions");
+STATISTIC(OverBudgetCount,
+          "The # of instructions not substituted because of the budgets");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+// -mba-sub-budgeted and the budgets (see MBABudgetOptions)
+static MBABudgetOptions BudgetOptions{"mba-sub"};
 
 //-----------------------------------------------------------------------------
 // MBASub Implementaion
 //-----------------------------------------------------------------------------
-bool MBASub::runOnBasicBlock(BasicBlock &BB) {
-  bool Changed = false;
-
-  // Loop over all instructions in the block. Replacing instructions requires
-  // iterators, hence a for-range loop wouldn't be suitable.
-  for (auto Inst = BB.begin(), IE = BB.end(); Inst != IE; ++Inst) {
-
-    // Skip non-binary (e.g. unary or compare) instruction.
-    auto *BinOp = dyn_cast<BinaryOperator>(Inst);
-    if (!BinOp)
-      continue;
-
-    /// Skip instructions other than integer sub.
-    unsigned Opcode = BinOp->getOpcode();
-    if (Opcode != Instruction::Sub || !BinOp->getType()->isIntegerTy())
-      continue;
-
-    // A uniform API for creating instructions and inserting
-    // them into basic blocks.
-    IRBuilder<> Builder(BinOp);
-
-    // Create an instruction representing (a + ~b) + 1
-    Instruction *NewValue = BinaryOperator::CreateAdd(
-        Builder.CreateAdd(BinOp->getOperand(0),
-                          Builder.CreateNot(BinOp->getOperand(1))),
-        ConstantInt::get(BinOp->getType(), 1));
-
-    // The following is visible only if you pass -debug on the command line
-    // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewValue << "\n");
-
-    // Replace `(a - b)` (original instructions) with `(a + ~b) + 1`
-    // (the new instruction)
-    ReplaceInstWithInst(&BB, Inst, NewValue);
-    Changed = true;
-
-    // Update the statistics
-    ++SubstCount;
+bool MBASub::runOnFunction(Function &F, const TargetTransformInfo *TTI,
+                           const BlockFrequencyInfo *BFI) {
+  // Replace every `(a - b)` with `(a + ~b) + 1` (the identity is implemented
+  // in MBAIdentities.cpp)
+  MBARewriter Rewriter(getMBAIdentity("sub-not"));
+  MBARewriter::RewriteList Rewrites = Rewriter.match(
+      F, [](const BinaryOperator &, ArrayRef<const MBAIdentity *> Identities) {
+        return Identities.front();
+      });
+
+  if (BudgetOptions.isBudgeted()) {
+    assert(TTI && BFI && "The budgets require TTI and BFI");
+    OverBudgetCount += Budget.apply(F, Rewrites, BudgetOptions.getLimits(),
+                                    *TTI, *BFI);
   }
-  return Changed;
+  unsigned NumRewritten = MBARewriter::rewrite(Rewrites);
+
+  // Update the statistics
+  SubstCount += NumRewritten;
+  return NumRewritten != 0;
 }
 
 PreservedAnalyses MBASub::run(llvm::Function &F,
-                              llvm::FunctionAnalysisManager &) {
-  bool Changed = false;
+                              llvm::FunctionAnalysisManager &FAM) {
+  bool Changed =
+      BudgetOptions.isBudgeted()
+          ? runOnFunction(F, &FAM.getResult<TargetIRAnalysis>(F),
+                          &FAM.getResult<BlockFrequencyAnalysis>(F))
+          : runOnFunction(F);
 
-  for (auto &BB : F) {
-    Changed |= runOnBasicBlock(BB);
-  }
   return (Changed ? llvm::PreservedAnalyses::none()
                   : llvm::PreservedAnalyses::all());
 }
 
+bool LegacyMBASub::doInitialization(llvm::Module &) {
+  Impl.Budget = MBABudget();
+  return false;
+}
+
 bool LegacyMBASub::runOnFunction(llvm::Function &F) {
-  bool Changed = false;
+  if (!BudgetOptions.isBudgeted())
+    return Impl.runOnFunction(F);
 
-  for (auto &BB : F) {
-    Changed |= Impl.runOnBasicBlock(BB);
+  return Impl.runOnFunction(
+      F, &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F),
+      &getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI());
+}
+
+void LegacyMBASub::getAnalysisUsage(AnalysisUsage &Info) const {
+  if (BudgetOptions.isBudgeted()) {
+    Info.addRequired<TargetTransformInfoWrapperPass>();
+    Info.addRequired<BlockFrequencyInfoWrapperPass>();
   }
-  return Changed;
 }
 
 //-----------------------------------------------------------------------------
@@ -107,6 +112,17 @@ bool LegacyMBASub::runOnFunction(llvm::Function &F) {
 llvm::PassPluginLibraryInfo getMBASubPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "mba-sub", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
+            // At the module level (e.g. -passes=mba-sub), every module gets a
+            // fresh module budget
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "mba-sub") {
+                    MPM.addPass(MBABudgetModuleAdaptor<MBASub>());
+                    return true;
+                  }
+                  return false;
+                });
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -25,6 +25,15 @@
 //  instructions in BB1 are identical to the instructions in BB2. For finer
 //  details please consult the implementation.
 //
+//  Comparing every block against every other predecessor of its successor is
+//  quadratic (e.g. for switch statements with many cases). Instead, every
+//  block is first hashed (see BlockBuckets::hashBlock) and the blocks are
+//  only compared against the blocks with the same hash.
+//
+//  Merging BB1 into BB2 may make other blocks identical (the predecessors of
+//  BB1 now branch to BB2). These blocks are re-visited until a fixpoint is
+//  reached.
+//
 //  This pass will to some extent revert the modifications introduced by
 //  DuplicateBB. The qualifying clones (lt-clone-1-BBId and lt-clone-2-BBid)
 //  *will indeed* be merged, but the lt-if-then-else and lt-tail blocks (also
@@ -63,51 +72,35 @@ STATISTIC(OverallNumOfUpdatedBranchTargets, "Number of updated branch targets");
 // MergeBB Implementation
 //-----------------------------------------------------------------------------
 bool MergeBB::canRemoveInst(const Instruction *Inst) {
-  assert(Inst->hasOneUse() && "Inst needs to have exactly one use");
-
-  auto *PNUse = dyn_cast<PHINode>(*Inst->user_begin());
   auto *Succ = Inst->getParent()->getTerminator()->getSuccessor(0);
-  auto *User = cast<Instruction>(*Inst->user_begin());
 
-  bool SameParentBB = (User->getParent() == Inst->getParent());
-  bool UsedInPhi = (PNUse && PNUse->getParent() == Succ &&
-                    PNUse->getIncomingValueForBlock(Inst->getParent()) == Inst);
+  return llvm::all_of(Inst->users(), [Inst, Succ](const User *U) {
+    auto *PNUse = dyn_cast<PHINode>(U);
+    auto *User = cast<Instruction>(U);
 
-  return UsedInPhi || SameParentBB;
+    bool SameParentBB = (User->getParent() == Inst->getParent());
+    bool UsedInPhi =
+        (PNUse && PNUse->getParent() == Succ &&
+         PNUse->getIncomingValueForBlock(Inst->getParent()) == Inst);
+
+    return UsedInPhi || SameParentBB;
+  });
 }
 
-bool MergeBB::canMergeInstructions(ArrayRef<Instruction *> Insts) {
+bool MergeBB::canMergeInstructions(ArrayRef<Instruction *> Insts,
+                                   const CounterpartMap &Counterparts) {
   const Instruction *Inst1 = Insts[0];
   const Instruction *Inst2 = Insts[1];
 
-  if (!Inst1->isSameOperationAs(Inst2))
+  // Make sure that Inst1 and Inst2 perform the same operation on identical
+  // operands (or operands that are merged together with Inst1 and Inst2).
+  if (!areEquivalentInstructions(Inst1, Inst2, Counterparts))
     return false;
 
-  // Each instruction must have exactly zero or one use.
-  bool HasUse = !Inst1->user_empty();
-  for (auto *I : Insts) {
-    if (HasUse && !I->hasOneUse())
-      return false;
-    if (!HasUse && !I->user_empty())
-      return false;
-  }
-
-  // Not all instructions that have one use can be merged. Make sure that
-  // instructions that have one use can be safely deleted.
-  if (HasUse) {
-    if (!canRemoveInst(Inst1) || !canRemoveInst(Inst2))
-      return false;
-  }
-
-  // Make sure that Inst1 and Inst2 have identical operands.
-  assert(Inst2->getNumOperands() == Inst1->getNumOperands());
-  auto NumOpnds = Inst1->getNumOperands();
-  for (unsigned OpndIdx = 0; OpndIdx != NumOpnds; ++OpndIdx) {
-    if (Inst2->getOperand(OpndIdx) != Inst1->getOperand(OpndIdx))
-      return false;
-  }
-
-  return true;
+  // Not all instructions can be merged. Make sure that both instructions can
+  // be safely deleted, i.e. that they are only used within their blocks or
+  // in the PHI nodes in the successor (these are checked separately).
+  return canRemoveInst(Inst1) && canRemoveInst(Inst2);
 }
 
 // Get the number of non-debug instructions in BB
@@ -119,6 +112,23 @@ static unsigned getNumNonDbgInstrInBB(BasicBlock *BB) {
   return Count;
 }
 
+// Checks that every PHI node in BBSucc receives either the same value from
+// BB1 and BB2, or two corresponding values defined in BB1 and BB2 (i.e. at the
+// same position).
+static bool
+haveMatchingIncomingValues(BasicBlock *BB1, BasicBlock *BB2,
+                           BasicBlock *BBSucc,
+                           const CounterpartMap &Counterparts) {
+  for (PHINode &PN : BBSucc->phis()) {
+    Value *InValBB1 = PN.getIncomingValueForBlock(BB1);
+    Value *InValBB2 = PN.getIncomingValueForBlock(BB2);
+    if (InValBB1 != InValBB2 && Counterparts.lookup(InValBB2) != InValBB1)
+      return false;
+  }
+
+  return true;
+}
+
 unsigned MergeBB::updateBranchTargets(BasicBlock *BBToErase, BasicBlock *BBToRetain) {
   SmallVector<BasicBlock *, 8> BBToUpdate(predecessors(BBToErase));
 
@@ -145,7 +155,9 @@ unsigned MergeBB::updateBranchTargets(BasicBlock *BBToErase, BasicBlock *BBToRet
 }
 
 bool MergeBB::mergeDuplicatedBlock(BasicBlock *BB1,
-                                   SmallPtrSet<BasicBlock *, 8> &DeleteList) {
+                                   SmallPtrSet<BasicBlock *, 8> &DeleteList,
+                                   BlockBuckets &Buckets,
+                                   SmallVectorImpl<BasicBlock *> &Worklist) {
   // Do not optimize the entry block
   if (BB1 == &BB1->getParent()->getEntryBlock())
     return false;
@@ -164,30 +176,24 @@ bool MergeBB::mergeDuplicatedBlock(BasicBlock *BB1,
 
   BasicBlock *BBSucc = BB1Term->getSuccessor(0);
 
-  BasicBlock::iterator II = BBSucc->begin();
-  const PHINode *PN = dyn_cast<PHINode>(II);
-  Value *InValBB1 = nullptr;
-  Instruction *InInstBB1 = nullptr;
-  BBSucc->getFirstNonPHI();
-  if (nullptr != PN) {
-    // Do not optimize if multiple PHI instructions exist in the successor (to
-    // keep things relatively simple)
-    if (++II != BBSucc->end() && isa<PHINode>(II))
-      return false;
-
-    InValBB1 = PN->getIncomingValueForBlock(BB1);
-    InInstBB1 = dyn_cast<Instruction>(InValBB1);
-  }
+  // Do not optimize blocks with PHI nodes. The predecessors of BB1 become
+  // the predecessors of BB2, and the PHI nodes in BB2 would have no incoming
+  // values for them.
+  if (isa<PHINode>(BB1->begin()))
+    return false;
 
   unsigned BB1NumInst = getNumNonDbgInstrInBB(BB1);
-  for (auto *BB2 : predecessors(BBSucc)) {
+  for (auto *BB2 : Buckets.getCandidates(BB1)) {
     // Do not optimize the entry block
     if (BB2 == &BB2->getParent()->getEntryBlock())
       continue;
 
-    // Only merge CFG edges of unconditional branch
+    // Only merge CFG edges of unconditional branch to the same successor (the
+    // blocks in one bucket will normally share the successor, but hashes can
+    // collide)
     BranchInst *BB2Term = dyn_cast<BranchInst>(BB2->getTerminator());
-    if (!(BB2Term && BB2Term->isUnconditional()))
+    if (!(BB2Term && BB2Term->isUnconditional() &&
+          BB2Term->getSuccessor(0) == BBSucc))
       continue;
 
     // Do not optimize non-branch and non-switch CFG edges (to keep things
@@ -210,24 +216,14 @@ bool MergeBB::mergeDuplicatedBlock(BasicBlock *BB1,
     if (BB1NumInst != getNumNonDbgInstrInBB(BB2))
       continue;
 
-    // Control flow can be merged if incoming values to the PHI node
-    // at the successor are same values or both defined in the BBs to merge.
-    // For the latter case, canMergeInstructions executes further analysis.
-    if (nullptr != PN) {
-      Value *InValBB2 = PN->getIncomingValueForBlock(BB2);
-      Instruction *InInstBB2 = dyn_cast<Instruction>(InValBB2);
-
-      bool areValuesSimilar = (InValBB1 == InValBB2);
-      bool bothValuesDefinedInParent =
-          ((InInstBB1 && InInstBB1->getParent() == BB1) &&
-           (InInstBB2 && InInstBB2->getParent() == BB2));
-      if (!areValuesSimilar && !bothValuesDefinedInParent)
-        continue;
-    }
+    // Pair up the instructions in BB2 with the instructions in BB1
+    CounterpartMap Counterparts;
+    for (LockstepReverseIterator LRI(BB1, BB2); LRI.isValid(); --LRI)
+      Counterparts[(*LRI)[1]] = (*LRI)[0];
 
-    // Finally, check that all instructions in BB1 and BB2 are identical
+    // Check that all instructions in BB1 and BB2 are identical
     LockstepReverseIterator LRI(BB1, BB2);
-    while (LRI.isValid() && canMergeInstructions(*LRI)) {
+    while (LRI.isValid() && canMergeInstructions(*LRI, Counterparts)) {
       --LRI;
     }
 
@@ -235,48 +231,68 @@ bool MergeBB::mergeDuplicatedBlock(BasicBlock *BB1,
     if (LRI.isValid())
       continue;
 
+    // Finally, check the PHI nodes in the successor
+    if (!haveMatchingIncomingValues(BB1, BB2, BBSucc, Counterparts))
+      continue;
+
     // It is safe to de-duplicate - do so.
+    SmallVector<BasicBlock *, 8> BB1Preds(predecessors(BB1));
     unsigned UpdatedTargets = updateBranchTargets(BB1, BB2);
     assert(UpdatedTargets && "No branch target was updated");
     OverallNumOfUpdatedBranchTargets += UpdatedTargets;
     DeleteList.insert(BB1);
     NumDedupBBs++;
 
+    // The predecessors of BB1 now branch to BB2, so their hashes have changed
+    // and they might now be identical to other predecessors of BB2. Re-visit
+    // them.
+    for (BasicBlock *Pred : BB1Preds) {
+      Buckets.update(Pred);
+      Worklist.push_back(Pred);
+    }
+
     return true;
   }
 
   return false;
 }
 
-PreservedAnalyses MergeBB::run(llvm::Function &Func,
-                               llvm::FunctionAnalysisManager &) {
+bool MergeBB::mergeDuplicatedBlocks(Function &Func) {
   bool Changed = false;
   SmallPtrSet<BasicBlock *, 8> DeleteList;
-  for (auto &BB : Func) {
-    Changed |= mergeDuplicatedBlock(&BB, DeleteList);
+  BlockBuckets Buckets(Func);
+
+  // Visit all the blocks (in program order) and then the blocks that might
+  // have become mergeable due to other merges, until a fixpoint is reached.
+  // Every merge removes one block, so this terminates.
+  SmallVector<BasicBlock *, 16> Worklist;
+  for (auto &BB : reverse(Func))
+    Worklist.push_back(&BB);
+
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (DeleteList.count(BB))
+      continue;
+    Changed |= mergeDuplicatedBlock(BB, DeleteList, Buckets, Worklist);
   }
 
   for (BasicBlock *BB : DeleteList) {
     DeleteDeadBlock(BB);
   }
 
+  return Changed;
+}
+
+PreservedAnalyses MergeBB::run(llvm::Function &Func,
+                               llvm::FunctionAnalysisManager &) {
+  bool Changed = mergeDuplicatedBlocks(Func);
+
   return (Changed ? llvm::PreservedAnalyses::none()
                   : llvm::PreservedAnalyses::all());
 }
 
 bool LegacyMergeBB::runOnFunction(llvm::Function &Func) {
-  bool Changed = false;
-  SmallPtrSet<BasicBlock *, 8> DeleteList;
-
-  for (auto &BB : Func) {
-    Changed |= Impl.mergeDuplicatedBlock(&BB, DeleteList);
-  }
-
-  for (BasicBlock *BB : DeleteList) {
-    DeleteDeadBlock(BB);
-  }
-
-  return Changed;
+  return Impl.mergeDuplicatedBlocks(Func);
 }
 
 //-----------------------------------------------------------------------------
@@ -359,3 +375,76 @@ void LockstepReverseIterator::operator--() {
     }
   }
 }
+
+//------------------------------------------------------------------------------
+// BlockBuckets
+//------------------------------------------------------------------------------
+BlockBuckets::BlockBuckets(Function &F) {
+  for (BasicBlock &BB : F) {
+    Positions[&BB] = Positions.size();
+    insert(&BB);
+  }
+}
+
+hash_code BlockBuckets::hashBlock(const BasicBlock *BB) {
+  const BasicBlock *Succ = BB->getTerminator()->getSuccessor(0);
+  hash_code Hash = hash_value(Succ);
+
+  // Values defined in BB differ between identical blocks, so these are
+  // hashed by their position in BB (rather than by their address)
+  LocalValueIds Positions;
+  for (const Instruction &Inst : *BB) {
+    if (isa<DbgInfoIntrinsic>(Inst) || Inst.isTerminator())
+      continue;
+    Hash = hash_combine(Hash, hashInstruction(Inst, Positions));
+    Positions[&Inst] = Positions.size();
+  }
+
+  for (const PHINode &PN : Succ->phis()) {
+    int Idx = PN.getBasicBlockIndex(BB);
+    if (Idx >= 0)
+      Hash = hash_combine(Hash, hashValue(PN.getIncomingValue(Idx), Positions));
+  }
+
+  return Hash;
+}
+
+void BlockBuckets::insert(BasicBlock *BB) {
+  auto *Term = dyn_cast<BranchInst>(BB->getTerminator());
+  if (!(Term && Term->isUnconditional()))
+    return;
+
+  size_t Hash = hashBlock(BB);
+  Hashes[BB] = Hash;
+
+  auto &Bucket = Buckets[Hash];
+  unsigned Pos = Positions.lookup(BB);
+  auto It = llvm::partition_point(Bucket, [&](const BasicBlock *Other) {
+    return Positions.lookup(Other) < Pos;
+  });
+  Bucket.insert(It, BB);
+}
+
+void BlockBuckets::erase(BasicBlock *BB) {
+  auto Hash = Hashes.find(BB);
+  if (Hash == Hashes.end())
+    return;
+
+  auto Bucket = Buckets.find(Hash->second);
+  llvm::erase_value(Bucket->second, BB);
+  if (Bucket->second.empty())
+    Buckets.erase(Bucket);
+  Hashes.erase(Hash);
+}
+
+void BlockBuckets::update(BasicBlock *BB) {
+  erase(BB);
+  insert(BB);
+}
+
+ArrayRef<BasicBlock *> BlockBuckets::getCandidates(BasicBlock *BB) const {
+  auto Hash = Hashes.find(BB);
+  if (Hash == Hashes.end())
+    return {};
+  return Buckets.at(Hash->second);
+}
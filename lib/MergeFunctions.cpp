@@ -0,0 +1,302 @@
+//==============================================================================
+// FILE:
+//    MergeFunctions.cpp
+//
+// DESCRIPTION:
+//    Finds functions with identical bodies and folds them into one (a.k.a.
+//    identical code folding). For every set of identical functions, the first
+//    function (in module order) is kept and the other functions are replaced
+//    with:
+//      * the kept function (local functions whose address is not significant)
+//      * an alias to the kept function (functions with `unnamed_addr`)
+//      * a thunk, i.e. a tail call to the kept function (other functions, as
+//        these must keep a distinct address)
+//
+//    Two functions are identical iff they have the same signatures and
+//    attributes, and all of their instructions are equivalent. The
+//    instructions are compared in the same way as in MergeBB (see
+//    InstructionEquivalence.h): the operands must be identical, or must be
+//    the counterparts from the other function (arguments, blocks and
+//    instructions at the same positions).
+//
+// ALGORITHM:
+//    --------------------------------------------------------------------------
+//    STEP 1: Hash every function that can be folded and group the functions
+//    by their hashes (only functions with equal hashes can be identical).
+//    --------------------------------------------------------------------------
+//    STEP 2: Within every group, compare the functions against the functions
+//    that were kept so far and fold the identical ones.
+//    --------------------------------------------------------------------------
+//    Folding may make other functions identical (e.g. functions that called
+//    two different, but identical, functions), so both steps are repeated
+//    until nothing changes.
+//
+// USAGE:
+//    1. Legacy pass manager:
+//      $ opt -load <BUILD_DIR>/lib/libMergeFunctions.so `\`
+//        --legacy-merge-functions -S <bitcode-file>
+//    2. New pass manager:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMergeFunctions.so `\`
+//        -passes=merge-functions -S <bitcode-file>
+//
+// License: MIT
+//==============================================================================
+#include "MergeFunctions.h"
+#include "InstructionEquivalence.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/Debug.h"
+
+#include <unordered_map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "merge-functions"
+
+STATISTIC(NumFoldedFunctions, "Number of functions folded");
+STATISTIC(NumAliases, "Number of functions replaced with aliases");
+STATISTIC(NumThunks, "Number of functions replaced with thunks");
+
+//-----------------------------------------------------------------------------
+// MergeFunctions implementation
+//-----------------------------------------------------------------------------
+// Returns true if F can be folded (or kept in place of another function)
+static bool isCandidate(const Function &F) {
+  // The definitions of interposable functions can be replaced at link time.
+  // Thunks for variadic functions would need to forward the varargs.
+  return !F.isDeclaration() && !F.isInterposable() &&
+         !F.hasAvailableExternallyLinkage() && !F.isVarArg();
+}
+
+hash_code MergeFunctions::hashFunction(const Function &F) {
+  // Number the local values (the function itself, for recursive calls, the
+  // arguments, the blocks and the instructions) before hashing, as they
+  // can be used before being defined (e.g. in PHI nodes or branches)
+  LocalValueIds LocalIds;
+  LocalIds[&F] = 0;
+  for (const Argument &Arg : F.args())
+    LocalIds[&Arg] = LocalIds.size();
+  for (const BasicBlock &BB : F) {
+    LocalIds[&BB] = LocalIds.size();
+    for (const Instruction &Inst : BB)
+      LocalIds[&Inst] = LocalIds.size();
+  }
+
+  hash_code Hash = hash_combine(F.getFunctionType(), F.size());
+  for (const BasicBlock &BB : F) {
+    Hash = hash_combine(Hash, BB.size());
+    for (const Instruction &Inst : BB)
+      Hash = hash_combine(Hash, hashInstruction(Inst, LocalIds));
+  }
+
+  return Hash;
+}
+
+bool MergeFunctions::areEquivalentFunctions(const Function &F1,
+                                            const Function &F2) {
+  if (F1.getFunctionType() != F2.getFunctionType() ||
+      F1.getAttributes() != F2.getAttributes() ||
+      F1.getCallingConv() != F2.getCallingConv() ||
+      F1.getSection() != F2.getSection() || F1.getAlign() != F2.getAlign() ||
+      F1.size() != F2.size())
+    return false;
+
+  if (F1.hasGC() != F2.hasGC() || (F1.hasGC() && F1.getGC() != F2.getGC()))
+    return false;
+
+  if (F1.hasPersonalityFn() != F2.hasPersonalityFn() ||
+      (F1.hasPersonalityFn() &&
+       F1.getPersonalityFn() != F2.getPersonalityFn()))
+    return false;
+
+  // Pair up the arguments, the blocks and the instructions in F2 with those
+  // in F1. Recursive calls to F2 correspond to recursive calls to F1.
+  CounterpartMap Counterparts;
+  Counterparts[&F2] = &F1;
+  for (auto Args : zip(F1.args(), F2.args()))
+    Counterparts[&std::get<1>(Args)] = &std::get<0>(Args);
+
+  for (auto BBs : zip(F1, F2)) {
+    const BasicBlock &BB1 = std::get<0>(BBs);
+    const BasicBlock &BB2 = std::get<1>(BBs);
+    if (BB1.size() != BB2.size())
+      return false;
+
+    Counterparts[&BB2] = &BB1;
+    for (auto Insts : zip(BB1, BB2))
+      Counterparts[&std::get<1>(Insts)] = &std::get<0>(Insts);
+  }
+
+  // Compare the instructions
+  for (auto BBs : zip(F1, F2))
+    for (auto Insts : zip(std::get<0>(BBs), std::get<1>(BBs)))
+      if (!areEquivalentInstructions(&std::get<0>(Insts), &std::get<1>(Insts),
+                                     Counterparts))
+        return false;
+
+  return true;
+}
+
+Function *MergeFunctions::foldFunction(Function &Duplicate, Function &Target) {
+  LLVM_DEBUG(dbgs() << "MERGE FUNCTIONS: folding " << Duplicate.getName()
+                    << " into " << Target.getName() << "\n");
+  NumFoldedFunctions++;
+
+  // Local functions that can't be compared by address are simply replaced
+  if (Duplicate.hasLocalLinkage() &&
+      (Duplicate.hasGlobalUnnamedAddr() || !Duplicate.hasAddressTaken())) {
+    Duplicate.replaceAllUsesWith(&Target);
+    Duplicate.eraseFromParent();
+    return nullptr;
+  }
+
+  // Functions with a name that must be kept, but with an insignificant
+  // address, become aliases (unless the linker could replace Target)
+  if (Duplicate.hasGlobalUnnamedAddr() && !Duplicate.isWeakForLinker() &&
+      !Target.isWeakForLinker()) {
+    auto *Alias = GlobalAlias::create(
+        Duplicate.getValueType(), Duplicate.getAddressSpace(),
+        Duplicate.getLinkage(), "", &Target, Duplicate.getParent());
+    Alias->setVisibility(Duplicate.getVisibility());
+    Alias->setUnnamedAddr(Duplicate.getUnnamedAddr());
+    Alias->setDLLStorageClass(Duplicate.getDLLStorageClass());
+    Alias->takeName(&Duplicate);
+    Duplicate.replaceAllUsesWith(Alias);
+    Duplicate.eraseFromParent();
+    NumAliases++;
+    return nullptr;
+  }
+
+  // Otherwise, Duplicate must keep its own address. Call Target directly
+  // where possible and turn Duplicate into a thunk for the remaining uses.
+  for (Use &U : make_early_inc_range(Duplicate.uses())) {
+    auto *Call = dyn_cast<CallBase>(U.getUser());
+    if (Call && Call->isCallee(&U))
+      U.set(&Target);
+  }
+
+  Function *Thunk =
+      Function::Create(Duplicate.getFunctionType(), Duplicate.getLinkage(),
+                       Duplicate.getAddressSpace(), "");
+  Duplicate.getParent()->getFunctionList().insert(Duplicate.getIterator(),
+                                                  Thunk);
+  Thunk->copyAttributesFrom(&Duplicate);
+
+  IRBuilder<> Builder(BasicBlock::Create(Thunk->getContext(), "", Thunk));
+  SmallVector<Value *, 8> Args(make_pointer_range(Thunk->args()));
+  CallInst *Call = Builder.CreateCall(&Target, Args);
+  Call->setTailCall();
+  Call->setCallingConv(Target.getCallingConv());
+  Call->setAttributes(Target.getAttributes());
+  if (Thunk->getReturnType()->isVoidTy())
+    Builder.CreateRetVoid();
+  else
+    Builder.CreateRet(Call);
+
+  Thunk->takeName(&Duplicate);
+  Duplicate.replaceAllUsesWith(Thunk);
+  Duplicate.eraseFromParent();
+  NumThunks++;
+  return Thunk;
+}
+
+bool MergeFunctions::runOnModule(Module &M) {
+  bool Changed = false;
+  // The thunks are not folded any further (all thunks for one function are
+  // identical)
+  SmallPtrSet<const Function *, 8> Thunks;
+
+  bool FoldedAny;
+  do {
+    FoldedAny = false;
+
+    // STEP 1: Group the functions by their hashes. The groups are visited in
+    // module order (of their first functions), so that the result is
+    // deterministic.
+    std::unordered_map<size_t, SmallVector<Function *, 2>> Groups;
+    std::vector<size_t> GroupOrder;
+    for (Function &F : M) {
+      if (!isCandidate(F) || Thunks.count(&F))
+        continue;
+
+      size_t Hash = hashFunction(F);
+      auto &Group = Groups[Hash];
+      if (Group.empty())
+        GroupOrder.push_back(Hash);
+      Group.push_back(&F);
+    }
+
+    // STEP 2: Fold the identical functions from every group
+    for (size_t Hash : GroupOrder) {
+      SmallVector<Function *, 2> Kept;
+      for (Function *F : Groups[Hash]) {
+        auto Target = llvm::find_if(Kept, [F](const Function *Other) {
+          return areEquivalentFunctions(*Other, *F);
+        });
+        if (Target == Kept.end()) {
+          Kept.push_back(F);
+          continue;
+        }
+
+        if (Function *Thunk = foldFunction(*F, **Target))
+          Thunks.insert(Thunk);
+        FoldedAny = true;
+      }
+    }
+
+    Changed |= FoldedAny;
+  } while (FoldedAny);
+
+  return Changed;
+}
+
+PreservedAnalyses MergeFunctions::run(Module &M, ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+bool LegacyMergeFunctions::runOnModule(Module &M) {
+  return Impl.runOnModule(M);
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getMergeFunctionsPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "merge-functions", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "merge-functions") {
+                    MPM.addPass(MergeFunctions());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getMergeFunctionsPluginInfo();
+}
+
+//-----------------------------------------------------------------------------
+// Legacy PM Registration
+//-----------------------------------------------------------------------------
+char LegacyMergeFunctions::ID = 0;
+
+// Register the pass - required for (among others) opt
+static RegisterPass<LegacyMergeFunctions>
+    X(/*PassArg=*/"legacy-merge-functions",
+      /*Name=*/"Merge Identical Functions",
+      /*CFGOnly=*/false, /*is_analysis=*/false);
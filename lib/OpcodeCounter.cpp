@@ -12,6 +12,9 @@
 //    vectoriser is run (i.e. via `registerVectorizerStartEPCallback` for the
 //    new PM).
 //
+//    OpcodeHistogram sums the counts over all functions in the module (the
+//    functions are analysed in parallel), so that only one table is printed.
+//
 // USAGE:
 //    1. New PM
 //      opt -load-pass-plugin libOpcodeCounter.dylib `\`
@@ -20,6 +23,13 @@
 //    2. Automatically through an optimisation pipeline - new PM
 //      opt -load-pass-plugin libOpcodeCounter.dylib --passes='default<O1>' `\`
 //        -disable-output <input-llvm-file>
+//    3. New PM with CSV (or JSON lines) output
+//      opt -load-pass-plugin libOpcodeCounter.dylib `\`
+//        -passes="print<opcode-counter>" -opcode-counter-format=csv `\`
+//        -disable-output <input-llvm-file>
+//    4. The module-wide histogram - new PM
+//      opt -load-pass-plugin libOpcodeCounter.dylib `\`
+//        -passes="print<opcode-histogram>" -disable-output <input-llvm-file>
 //
 // License: MIT
 //=============================================================================
@@ -28,9 +38,28 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/ThreadPool.h"
+
+#include <atomic>
 
 using namespace llvm;
 
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+cl::OptionCategory OpcodeCounterCategory{"opcode-counter options"};
+
+static cl::opt<ResultFormat> OutputFormat{
+    "opcode-counter-format", cl::desc("The format of the printed results"),
+    getResultFormatValues(), cl::init(ResultFormat::Text),
+    cl::cat(OpcodeCounterCategory)};
+
+static cl::opt<unsigned> NumThreads{
+    "opcode-histogram-threads",
+    cl::desc("The number of threads used to compute the opcode histogram of a "
+             "module (0 means one per hardware thread)"),
+    cl::value_desc("threads"), cl::init(0), cl::cat(OpcodeCounterCategory)};
+
 // Pretty-prints the result of this analysis
 static void printOpcodeCounterResult(llvm::raw_ostream &,
                               const ResultOpcodeCounter &OC);
@@ -41,21 +70,17 @@ static void printOpcodeCounterResult(llvm::raw_ostream &,
 llvm::AnalysisKey OpcodeCounter::Key;
 
 OpcodeCounter::Result OpcodeCounter::generateOpcodeMap(llvm::Function &Func) {
-  OpcodeCounter::Result OpcodeMap;
+  OpcodeCounter::Result OpcodeMap{};
+  countOpcodes(Func, OpcodeMap);
+  return OpcodeMap;
+}
 
+void OpcodeCounter::countOpcodes(Function &Func, Result &OpcodeMap) {
   for (auto &BB : Func) {
     for (auto &Inst : BB) {
-      StringRef Name = Inst.getOpcodeName();
-
-      if (OpcodeMap.find(Name) == OpcodeMap.end()) {
-        OpcodeMap[Inst.getOpcodeName()] = 1;
-      } else {
-        OpcodeMap[Inst.getOpcodeName()]++;
-      }
+      OpcodeMap[Inst.getOpcode()]++;
     }
   }
-
-  return OpcodeMap;
 }
 
 OpcodeCounter::Result OpcodeCounter::run(llvm::Function &Func,
@@ -67,6 +92,19 @@ PreservedAnalyses OpcodeCounterPrinter::run(Function &Func,
                                             FunctionAnalysisManager &FAM) {
   auto &OpcodeMap = FAM.getResult<OpcodeCounter>(Func);
 
+  if (Writer.getFormat() != ResultFormat::Text) {
+    for (unsigned Opcode = 0; Opcode < OpcodeMap.size(); Opcode++) {
+      if (!OpcodeMap[Opcode])
+        continue;
+      Writer.beginRecord()
+          .field(Func.getName())
+          .field(Instruction::getOpcodeName(Opcode))
+          .field(OpcodeMap[Opcode])
+          .endRecord();
+    }
+    return PreservedAnalyses::all();
+  }
+
   // In the legacy PM, the following string is printed automatically by the
   // pass manager. For the sake of consistency, we're adding this here so that
   // it's also printed when using the new PM.
@@ -77,6 +115,69 @@ PreservedAnalyses OpcodeCounterPrinter::run(Function &Func,
   return PreservedAnalyses::all();
 }
 
+//-----------------------------------------------------------------------------
+// OpcodeHistogram implementation
+//-----------------------------------------------------------------------------
+llvm::AnalysisKey OpcodeHistogram::Key;
+
+OpcodeHistogram::Result OpcodeHistogram::computeHistogram(Module &M,
+                                                          unsigned Threads) {
+  std::vector<Function *> Funcs;
+  for (auto &Func : M)
+    if (!Func.isDeclaration())
+      Funcs.push_back(&Func);
+
+  ThreadPoolStrategy Strategy = hardware_concurrency(Threads);
+  unsigned NumTasks = std::min<size_t>(Strategy.compute_thread_count(),
+                                       Funcs.size());
+  if (NumTasks <= 1) {
+    Result Histogram{};
+    for (Function *Func : Funcs)
+      OpcodeCounter::countOpcodes(*Func, Histogram);
+    return Histogram;
+  }
+
+  // The analysis only reads the IR, so the functions can be safely analysed
+  // in parallel. Every task sums the counts for the functions that it takes
+  // (one at a time, so that the load is balanced even if the sizes of the
+  // functions differ a lot) into its own histogram. These are then reduced.
+  // Note that a local thread pool is used (rather than e.g.
+  // parallelTransformReduce), so that no threads outlive this plugin.
+  std::vector<Result> PartialHistograms(NumTasks, Result{});
+  std::atomic<size_t> NextFunc{0};
+  {
+    ThreadPool Pool(hardware_concurrency(NumTasks));
+    for (unsigned Task = 0; Task < NumTasks; Task++)
+      Pool.async([&, Task] {
+        for (size_t Idx = NextFunc++; Idx < Funcs.size(); Idx = NextFunc++)
+          OpcodeCounter::countOpcodes(*Funcs[Idx], PartialHistograms[Task]);
+      });
+    Pool.wait();
+  }
+
+  Result Histogram{};
+  for (auto &Partial : PartialHistograms)
+    mergeOpcodeCounts(Histogram, Partial);
+  return Histogram;
+}
+
+OpcodeHistogram::Result OpcodeHistogram::run(Module &M,
+                                             ModuleAnalysisManager &) {
+  return computeHistogram(M, NumThreads);
+}
+
+PreservedAnalyses OpcodeHistogramPrinter::run(Module &M,
+                                              ModuleAnalysisManager &MAM) {
+  auto &Histogram = MAM.getResult<OpcodeHistogram>(M);
+
+  if (OutputFormat == ResultFormat::Text)
+    OS << "Printing analysis 'OpcodeHistogram Pass' for module '"
+       << M.getName() << "':\n";
+
+  printOpcodeHistogram(OS, Histogram);
+  return PreservedAnalyses::all();
+}
+
 //-----------------------------------------------------------------------------
 // New PM Registration
 //-----------------------------------------------------------------------------
@@ -91,7 +192,18 @@ llvm::PassPluginLibraryInfo getOpcodeCounterPluginInfo() {
               [&](StringRef Name, FunctionPassManager &FPM,
                   ArrayRef<PassBuilder::PipelineElement>) {
                 if (Name == "print<opcode-counter>") {
-                  FPM.addPass(OpcodeCounterPrinter(llvm::errs()));
+                  FPM.addPass(
+                      OpcodeCounterPrinter(llvm::errs(), OutputFormat));
+                  return true;
+                }
+                return false;
+              });
+          // Same for "opt -passes=print<opcode-histogram>" (a module pass)
+          PB.registerPipelineParsingCallback(
+              [&](StringRef Name, ModulePassManager &MPM,
+                  ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "print<opcode-histogram>") {
+                  MPM.addPass(OpcodeHistogramPrinter(llvm::errs()));
                   return true;
                 }
                 return false;
@@ -105,7 +217,7 @@ llvm::PassPluginLibraryInfo getOpcodeCounterPluginInfo() {
           PB.registerVectorizerStartEPCallback(
               [](llvm::FunctionPassManager &PM,
                  llvm::OptimizationLevel Level) {
-                PM.addPass(OpcodeCounterPrinter(llvm::errs()));
+                PM.addPass(OpcodeCounterPrinter(llvm::errs(), OutputFormat));
               });
           // #3 REGISTRATION FOR "FAM.getResult<OpcodeCounter>(Func)"
           // Register OpcodeCounter as an analysis pass. This is required so that
@@ -115,6 +227,11 @@ llvm::PassPluginLibraryInfo getOpcodeCounterPluginInfo() {
               [](FunctionAnalysisManager &FAM) {
                 FAM.registerPass([&] { return OpcodeCounter(); });
               });
+          // #4 REGISTRATION FOR "MAM.getResult<OpcodeHistogram>(Module)"
+          PB.registerAnalysisRegistrationCallback(
+              [](ModuleAnalysisManager &MAM) {
+                MAM.registerPass([&] { return OpcodeHistogram(); });
+              });
           }
         };
 }
@@ -138,10 +255,36 @@ static void printOpcodeCounterResult(raw_ostream &OutS,
   OutS << format("%-20s %-10s\n", str1, str2);
   OutS << "-------------------------------------------------"
                << "\n";
-  for (auto &Inst : OpcodeMap) {
-    OutS << format("%-20s %-10lu\n", Inst.first().str().c_str(),
-                           Inst.second);
+  for (unsigned Opcode = 0; Opcode < OpcodeMap.size(); Opcode++) {
+    if (!OpcodeMap[Opcode])
+      continue;
+    OutS << format("%-20s %-10u\n", Instruction::getOpcodeName(Opcode),
+                   OpcodeMap[Opcode]);
   }
   OutS << "-------------------------------------------------"
                << "\n\n";
 }
+
+void mergeOpcodeCounts(ResultOpcodeCounter &Sum,
+                       const ResultOpcodeCounter &Other) {
+  for (unsigned Opcode = 0; Opcode < Sum.size(); Opcode++)
+    Sum[Opcode] += Other[Opcode];
+}
+
+void printOpcodeHistogram(raw_ostream &OutS,
+                          const ResultOpcodeCounter &Histogram) {
+  if (OutputFormat == ResultFormat::Text) {
+    printOpcodeCounterResult(OutS, Histogram);
+    return;
+  }
+
+  ResultWriter Writer(OutS, OutputFormat, {"opcode", "count"});
+  for (unsigned Opcode = 0; Opcode < Histogram.size(); Opcode++) {
+    if (!Histogram[Opcode])
+      continue;
+    Writer.beginRecord()
+        .field(Instruction::getOpcodeName(Opcode))
+        .field(Histogram[Opcode])
+        .endRecord();
+  }
+}
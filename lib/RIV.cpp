@@ -13,17 +13,19 @@
 //    RIV_N = set of reachable integer values for basic block N (BB_N)
 //    -------------------------------------------------------------------------
 //    STEP 1:
-//    For every BB_N in F:
-//      compute v_N and store it in DefinedValuesMap
-//    -------------------------------------------------------------------------
-//    STEP 2:
 //    Compute the RIVs for the entry block (BB_0):
 //      RIV_0 = {input args, global vars}
 //    -------------------------------------------------------------------------
-//    STEP 3: Traverse the CFG and for every BB_M that BB_N dominates,
+//    STEP 2: Traverse the CFG and for every BB_M that BB_N dominates,
 //    calculate RIV_M as follows:
 //      RIV_M = {RIV_N, v_N}
 //    -------------------------------------------------------------------------
+//    RIV_M is not materialised. Instead, only v_N and a link to BB_N (the
+//    immediate dominator of BB_M) are stored for BB_M. All v_N are kept in
+//    one array (grouped by the defining block), so every v_N is simply a
+//    range in that array. Enumerating RIV_M means following the links up to
+//    BB_0. The memory used is linear in the number of values and blocks
+//    (rather than in the number of values times the number of blocks).
 //
 // REFERENCES:
 //    Based on examples from:
@@ -44,6 +46,8 @@
 
 #include "RIV.h"
 
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/Format.h"
@@ -57,11 +61,31 @@ using namespace llvm;
 // DominatorTree node types used in RIV. One could use auto instead, but IMO
 // being verbose makes it easier to follow.
 using NodeTy = DomTreeNodeBase<llvm::BasicBlock> *;
-// A map that a basic block BB holds a set of pointers to values defined in BB.
-using DefValMapTy = RIV::Result;
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<ResultFormat> OutputFormat{
+    "riv-format", cl::desc("The format of the printed results"),
+    getResultFormatValues(), cl::init(ResultFormat::Text)};
+
+static cl::opt<bool> VerifyRIV{
+    "riv-verify",
+    cl::desc("Check the RIV queries (contains() and size()) against the "
+             "dominator tree when printing the results"),
+    cl::init(false)};
 
 // Pretty-prints the result of this analysis
 static void printRIVResult(llvm::raw_ostream &OutS, const RIV::Result &RIVMap);
+// Writes the result of this analysis as machine-readable records (one per
+// basic block and reachable value)
+static void writeRIVResult(ResultWriter &Writer, const RIV::Result &RIVMap);
+// Checks ValueSet::contains() and ValueSet::size() for every block in F
+// against DT (a value is reachable iff it's a global or an argument, or if
+// its block strictly dominates the queried block). Prints the mismatches.
+static void verifyRIVResult(raw_ostream &OutS, Function &F,
+                            const DominatorTree &DT,
+                            const RIV::Result &RIVMap);
 
 //-----------------------------------------------------------------------------
 // RIV Implementation
@@ -69,67 +93,150 @@ static void printRIVResult(llvm::raw_ostream &OutS, const RIV::Result &RIVMap);
 RIV::Result RIV::buildRIV(Function &F, NodeTy CFGRoot) {
   Result ResultMap;
 
-  //双端队列
-  // Initialise a double-ended queue that will be used to traverse all BBs in F
-  std::deque<NodeTy> BBsToProcess;
-  BBsToProcess.push_back(CFGRoot);
-
-  // STEP 1: For every basic block BB compute the set of integer values defined
-  // in BB
-  DefValMapTy DefinedValuesMap;
-  for (BasicBlock &BB : F) {
-    auto &Values = DefinedValuesMap[&BB];
-    for (Instruction &Inst : BB)
-      if (Inst.getType()->isIntegerTy())
-        Values.insert(&Inst);
-  }
-
-  // STEP 2: Compute the RIVs for the entry BB. This will include global
+  // STEP 1: Compute the RIVs for the entry BB. This will include global
   // variables and input arguments.
-  auto &EntryBBValues = ResultMap[&F.getEntryBlock()];
-
 #if LLVM_VERSION_MAJOR >= 17
   for (auto &Global : F.getParent()->globals())
 #else
   for (auto &Global : F.getParent()->getGlobalList())
 #endif
     if (Global.getValueType()->isIntegerTy())
-      EntryBBValues.insert(&Global);
+      ResultMap.Values.push_back(&Global);
 
   for (Argument &Arg : F.args())
     if (Arg.getType()->isIntegerTy())
-      EntryBBValues.insert(&Arg);
+      ResultMap.Values.push_back(&Arg);
+  ResultMap.ArgsEnd = ResultMap.Values.size();
+
+  ResultMap.addBlockInfo(CFGRoot->getBlock(), /*IDom=*/-1);
+
+  // Initialise a double-ended queue that will be used to traverse all BBs in F
+  std::deque<NodeTy> BBsToProcess;
+  BBsToProcess.push_back(CFGRoot);
 
-  // STEP 3: Traverse the CFG for every BB in F calculate its RIVs
+  // STEP 2: Traverse the CFG for every BB in F calculate its RIVs
   while (!BBsToProcess.empty()) {
     auto *Parent = BBsToProcess.back();
     BBsToProcess.pop_back();
 
-    // Get the values defined in Parent
-    auto &ParentDefs = DefinedValuesMap[Parent->getBlock()];
-    // Get the RIV set of for Parent
-    // (Since RIVMap is updated on every iteration, its contents are likely to
-    // be moved around when resizing. This means that we need a copy of it
-    // (i.e. a reference is not sufficient).
-    llvm::SmallPtrSet<llvm::Value *, 8> ParentRIVs =
-        ResultMap[Parent->getBlock()];
+    // The RIV set for all the children of Parent is the RIV set of Parent
+    // together with the values defined in Parent, i.e. it's enough to link
+    // the children to Parent.
+    int ParentIdx = ResultMap.BlockIndices.lookup(Parent->getBlock());
 
-    // Loop over all BBs that Parent dominates and update their RIV sets
+    // Loop over all BBs that Parent dominates and set their RIV sets
     for (NodeTy Child : *Parent) {
       BBsToProcess.push_back(Child);
-      auto ChildBB = Child->getBlock();
-
-      // Add values defined in Parent to the current child's set of RIV
-      ResultMap[ChildBB].insert(ParentDefs.begin(), ParentDefs.end());
-
-      // Add Parent's set of RIVs to the current child's RIV
-      ResultMap[ChildBB].insert(ParentRIVs.begin(), ParentRIVs.end());
+      ResultMap.addBlockInfo(Child->getBlock(), ParentIdx);
     }
   }
 
   return ResultMap;
 }
 
+//-----------------------------------------------------------------------------
+// RIVResult Implementation
+//-----------------------------------------------------------------------------
+RIVResult::ValueSet::iterator::iterator(const RIVResult &Res, int Node)
+    : Res(&Res), Node(Node) {
+  std::tie(Idx, End) = Res.getDefs(Node);
+  skipEmptyRanges();
+}
+
+void RIVResult::ValueSet::iterator::skipEmptyRanges() {
+  while (Idx == End && Node >= 0) {
+    Node = Res->Blocks[Node].IDom;
+    std::tie(Idx, End) = Res->getDefs(Node);
+  }
+}
+
+size_t RIVResult::ValueSet::size() const {
+  if (Block < 0)
+    return 0;
+
+  size_t Size = Res->ArgsEnd;
+  for (int Node = Res->Blocks[Block].IDom; Node >= 0;
+       Node = Res->Blocks[Node].IDom)
+    Size += Res->Blocks[Node].DefsEnd - Res->Blocks[Node].DefsBegin;
+  return Size;
+}
+
+bool RIVResult::ValueSet::contains(const Value *V) const {
+  if (Block < 0)
+    return false;
+
+  // The type of a global is always ptr, so check the type of its initializer
+  // (as in RIV::buildRIV)
+  const Function *F = Res->Blocks[Block].BB->getParent();
+  if (auto *Global = dyn_cast<GlobalVariable>(V))
+    return Global->getValueType()->isIntegerTy() &&
+           Global->getParent() == F->getParent();
+  if (!V->getType()->isIntegerTy())
+    return false;
+  if (auto *Arg = dyn_cast<Argument>(V))
+    return Arg->getParent() == F;
+
+  // An instruction is reachable iff its parent strictly dominates this block
+  auto *Inst = dyn_cast<Instruction>(V);
+  if (!Inst)
+    return false;
+  for (int Node = Res->Blocks[Block].IDom; Node >= 0;
+       Node = Res->Blocks[Node].IDom)
+    if (Res->Blocks[Node].BB == Inst->getParent())
+      return true;
+  return false;
+}
+
+RIVResult::ValueSet RIVResult::lookup(const BasicBlock *BB) const {
+  auto Idx = BlockIndices.find(BB);
+  if (Idx == BlockIndices.end())
+    return ValueSet(*this, -1);
+  return ValueSet(*this, Idx->second);
+}
+
+std::pair<unsigned, unsigned> RIVResult::collectDefs(BasicBlock *BB) {
+  unsigned DefsBegin = Values.size();
+  for (Instruction &Inst : *BB)
+    if (Inst.getType()->isIntegerTy())
+      Values.push_back(&Inst);
+  return {DefsBegin, Values.size()};
+}
+
+void RIVResult::addBlockInfo(BasicBlock *BB, int IDom) {
+  auto Defs = collectDefs(BB);
+  BlockIndices[BB] = Blocks.size();
+  Blocks.push_back({BB, IDom, Defs.first, Defs.second});
+}
+
+void RIVResult::addBlock(BasicBlock *NewBB, const BasicBlock *IDom) {
+  assert(BlockIndices.count(IDom) && "Unknown immediate dominator");
+  assert(!BlockIndices.count(NewBB) && "The block has already been added");
+  addBlockInfo(NewBB, BlockIndices.lookup(IDom));
+}
+
+void RIVResult::splitBlock(BasicBlock *Head, BasicBlock *Tail) {
+  assert(BlockIndices.count(Head) && "Unknown block");
+  assert(!BlockIndices.count(Tail) && "The block has already been added");
+
+  // Tail takes over Head's entry, so that the blocks dominated by Head
+  // (which link to that entry) are now dominated by Tail. Head gets a new
+  // entry. This way, the children of Head don't need to be visited.
+  unsigned TailIdx = BlockIndices.lookup(Head);
+  addBlockInfo(Head, Blocks[TailIdx].IDom);
+
+  auto Defs = collectDefs(Tail);
+  Blocks[TailIdx] = {Tail, (int)BlockIndices.lookup(Head), Defs.first,
+                     Defs.second};
+  BlockIndices[Tail] = TailIdx;
+}
+
+void RIVResult::clear() {
+  Values.clear();
+  ArgsEnd = 0;
+  Blocks.clear();
+  BlockIndices.clear();
+}
+
 RIV::Result RIV::run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM) {
   DominatorTree *DT = &FAM.getResult<DominatorTreeAnalysis>(F);
   Result Res = buildRIV(F, DT->getRootNode());
@@ -140,9 +247,16 @@ RIV::Result RIV::run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM) {
 PreservedAnalyses RIVPrinter::run(Function &Func,
                                   FunctionAnalysisManager &FAM) {
 
-  auto RIVMap = FAM.getResult<RIV>(Func);
+  auto &RIVMap = FAM.getResult<RIV>(Func);
+
+  if (Writer.getFormat() != ResultFormat::Text)
+    writeRIVResult(Writer, RIVMap);
+  else
+    printRIVResult(OS, RIVMap);
 
-  printRIVResult(OS, RIVMap);
+  if (VerifyRIV)
+    verifyRIVResult(OS, Func, FAM.getResult<DominatorTreeAnalysis>(Func),
+                    RIVMap);
   return PreservedAnalyses::all();
 }
 
@@ -160,6 +274,12 @@ bool LegacyRIV::runOnFunction(llvm::Function &F) {
 }
 
 void LegacyRIV::print(raw_ostream &out, Module const *) const {
+  if (OutputFormat != ResultFormat::Text) {
+    ResultWriter Writer(out, OutputFormat, {"function", "block", "value"});
+    writeRIVResult(Writer, RIVMap);
+    return;
+  }
+
   printRIVResult(out, RIVMap);
 }
 
@@ -184,7 +304,7 @@ llvm::PassPluginLibraryInfo getRIVPluginInfo() {
                 [&](StringRef Name, FunctionPassManager &FPM,
                     ArrayRef<PassBuilder::PipelineElement>) {
                   if (Name == "print<riv>") {
-                    FPM.addPass(RIVPrinter(llvm::errs()));
+                    FPM.addPass(RIVPrinter(llvm::errs(), OutputFormat));
                     return true;
                   }
                   return false;
@@ -243,3 +363,85 @@ static void printRIVResult(raw_ostream &OutS, const RIV::Result &RIVMap) {
 
   OutS << "\n\n";
 }
+
+static void writeRIVResult(ResultWriter &Writer, const RIV::Result &RIVMap) {
+  if (RIVMap.empty())
+    return;
+
+  // Number the unnamed values once per function (rather than once per
+  // printed value)
+  const Function &Func = *(*RIVMap.begin()).first->getParent();
+  ModuleSlotTracker Tracker(Func.getParent());
+  Tracker.incorporateFunction(Func);
+
+  for (auto const &KV : RIVMap) {
+    for (auto const *IntegerValue : KV.second) {
+      Writer.beginRecord()
+          .field(Func.getName())
+          .printedField([&](raw_ostream &OS) {
+            KV.first->printAsOperand(OS, /*PrintType=*/false, Tracker);
+          })
+          .printedField([&](raw_ostream &OS) {
+            IntegerValue->printAsOperand(OS, /*PrintType=*/true, Tracker);
+          })
+          .endRecord();
+    }
+  }
+}
+
+static void verifyRIVResult(raw_ostream &OutS, Function &F,
+                            const DominatorTree &DT,
+                            const RIV::Result &RIVMap) {
+  // All values that may be reachable: globals, arguments and instructions
+  std::vector<Value *> Candidates;
+#if LLVM_VERSION_MAJOR >= 17
+  for (GlobalVariable &Global : F.getParent()->globals())
+#else
+  for (GlobalVariable &Global : F.getParent()->getGlobalList())
+#endif
+    Candidates.push_back(&Global);
+  for (Argument &Arg : F.args())
+    Candidates.push_back(&Arg);
+  for (Instruction &Inst : instructions(F))
+    Candidates.push_back(&Inst);
+
+  unsigned NumMismatches = 0;
+  for (BasicBlock &BB : F) {
+    if (!DT.isReachableFromEntry(&BB))
+      continue;
+
+    RIVResult::ValueSet Reachable = RIVMap.lookup(&BB);
+    size_t ExpectedSize = 0;
+    for (Value *V : Candidates) {
+      bool Expected = false;
+      if (auto *Global = dyn_cast<GlobalVariable>(V))
+        Expected = Global->getValueType()->isIntegerTy();
+      else if (auto *Inst = dyn_cast<Instruction>(V))
+        Expected = Inst->getType()->isIntegerTy() &&
+                   DT.properlyDominates(Inst->getParent(), &BB);
+      else
+        Expected = V->getType()->isIntegerTy();
+      ExpectedSize += Expected;
+
+      if (Reachable.contains(V) != Expected) {
+        OutS << "RIV mismatch in " << F.getName() << ": contains(";
+        V->printAsOperand(OutS, /*PrintType=*/false);
+        OutS << ") for block ";
+        BB.printAsOperand(OutS, /*PrintType=*/false);
+        OutS << " should be " << (Expected ? "true" : "false") << "\n";
+        NumMismatches++;
+      }
+    }
+
+    if (Reachable.size() != ExpectedSize) {
+      OutS << "RIV mismatch in " << F.getName() << ": size() for block ";
+      BB.printAsOperand(OutS, /*PrintType=*/false);
+      OutS << " is " << Reachable.size() << ", should be " << ExpectedSize
+           << "\n";
+      NumMismatches++;
+    }
+  }
+
+  OutS << "RIV verification of " << F.getName() << ": " << NumMismatches
+       << " mismatch(es)\n";
+}
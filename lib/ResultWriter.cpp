@@ -0,0 +1,164 @@
+//==============================================================================
+// FILE:
+//    ResultWriter.cpp
+//
+// DESCRIPTION:
+//    Implementation of ResultWriter, which streams the results of the
+//    analysis printers as JSON lines or CSV.
+//
+//    String fields are escaped as they are written:
+//      * JSON - quotes, backslashes and control characters are escaped (other
+//        bytes are copied verbatim, i.e. names are assumed to be UTF-8)
+//      * CSV - every string field is quoted and quotes are doubled (RFC 4180),
+//        so that names with commas or new lines don't need special handling
+//
+// License: MIT
+//==============================================================================
+#include "ResultWriter.h"
+
+#include "llvm/Support/Format.h"
+
+using namespace llvm;
+
+// Writes Str, escaped for Format, into OS
+static void writeEscaped(raw_ostream &OS, ResultFormat Format,
+                         StringRef Str) {
+  auto NeedsEscaping = [Format](char C) {
+    if (Format == ResultFormat::CSV)
+      return C == '"';
+    return C == '"' || C == '\\' || static_cast<unsigned char>(C) < 0x20;
+  };
+
+  while (!Str.empty()) {
+    // Copy the longest prefix that doesn't need escaping in one go
+    size_t End = 0;
+    while (End < Str.size() && !NeedsEscaping(Str[End]))
+      End++;
+    OS << Str.take_front(End);
+    if (End == Str.size())
+      return;
+
+    char C = Str[End];
+    Str = Str.drop_front(End + 1);
+    if (Format == ResultFormat::CSV) {
+      OS << "\"\"";
+      continue;
+    }
+
+    switch (C) {
+    case '"':
+      OS << "\\\"";
+      break;
+    case '\\':
+      OS << "\\\\";
+      break;
+    case '\n':
+      OS << "\\n";
+      break;
+    case '\r':
+      OS << "\\r";
+      break;
+    case '\t':
+      OS << "\\t";
+      break;
+    default:
+      OS << format("\\u%04x", static_cast<unsigned char>(C));
+    }
+  }
+}
+
+namespace {
+// An unbuffered stream that escapes everything that is written to it and
+// forwards it to another stream. Leading spaces are dropped (e.g.
+// Instruction::print indents the instruction).
+class EscapingOStream : public raw_ostream {
+public:
+  EscapingOStream(raw_ostream &OS, ResultFormat Format)
+      : raw_ostream(/*unbuffered=*/true), OS(OS), Format(Format) {}
+
+private:
+  void write_impl(const char *Ptr, size_t Size) override {
+    StringRef Str(Ptr, Size);
+    if (Pos == SkippedPrefix) {
+      StringRef Trimmed = Str.ltrim(' ');
+      SkippedPrefix += Str.size() - Trimmed.size();
+      Str = Trimmed;
+    }
+    writeEscaped(OS, Format, Str);
+    Pos += Size;
+  }
+  uint64_t current_pos() const override { return Pos; }
+
+  raw_ostream &OS;
+  ResultFormat Format;
+  uint64_t Pos = 0;
+  // The number of leading spaces dropped so far
+  uint64_t SkippedPrefix = 0;
+};
+} // namespace
+
+//------------------------------------------------------------------------------
+// ResultWriter implementation
+//------------------------------------------------------------------------------
+ResultWriter::ResultWriter(raw_ostream &OutS, ResultFormat Format,
+                           std::initializer_list<StringRef> Columns)
+    : OS(OutS), Format(Format), Columns(Columns) {}
+
+ResultWriter &ResultWriter::beginRecord() {
+  assert(Format != ResultFormat::Text && "Text is printed by the passes");
+  assert(NextField == 0 && "The previous record was not finished");
+
+  if (Format == ResultFormat::CSV && !HeaderWritten) {
+    for (size_t Idx = 0; Idx < Columns.size(); Idx++)
+      OS << (Idx ? "," : "") << Columns[Idx];
+    OS << "\n";
+    HeaderWritten = true;
+  }
+
+  if (Format == ResultFormat::JSONLines)
+    OS << "{";
+  return *this;
+}
+
+void ResultWriter::beginField() {
+  assert(NextField < Columns.size() && "Too many fields in the record");
+
+  if (NextField)
+    OS << ",";
+  if (Format == ResultFormat::JSONLines)
+    OS << "\"" << Columns[NextField] << "\":";
+  NextField++;
+}
+
+ResultWriter &ResultWriter::field(StringRef Value) {
+  beginField();
+  OS << "\"";
+  writeEscaped(OS, Format, Value);
+  OS << "\"";
+  return *this;
+}
+
+ResultWriter &ResultWriter::field(uint64_t Value) {
+  beginField();
+  OS << Value;
+  return *this;
+}
+
+ResultWriter &
+ResultWriter::printedField(function_ref<void(raw_ostream &)> Print) {
+  beginField();
+  OS << "\"";
+  EscapingOStream EscapedOS(OS, Format);
+  Print(EscapedOS);
+  OS << "\"";
+  return *this;
+}
+
+void ResultWriter::endRecord() {
+  assert(NextField == Columns.size() && "Missing fields in the record");
+
+  if (Format == ResultFormat::JSONLines)
+    OS << "}";
+  OS << "\n";
+  NextField = 0;
+}
@@ -13,6 +13,13 @@
 //    that is a wrapper around StaticCallCounter. `static` allows you to run
 //    StaticCallCounter without `opt`.
 //
+//    `static` can also cache the results on disk (see tools/StaticMain.cpp).
+//    The printer pass doesn't: computing a key from an in-memory module (e.g.
+//    by hashing its bitcode) costs more than the analysis itself.
+//
+//    With -static-cc-format=jsonl|csv, the results are printed in a
+//    machine-readable format (one record per function) instead.
+//
 // USAGE:
 //    1. Legacy PM
 //      opt -load libStaticCallCounter.dylib -legacy-static-cc `\`
@@ -21,16 +28,31 @@
 //      opt -load-pass-plugin libStaticCallCounter.dylib `\`
 //        -passes="print<static-cc>" `\`
 //        -disable-output <input-llvm-file>
+//    3. New PM with JSON lines output
+//      opt -load-pass-plugin libStaticCallCounter.dylib `\`
+//        -passes="print<static-cc>" -static-cc-format=jsonl `\`
+//        -disable-output <input-llvm-file>
 //
 // License: MIT
 //==============================================================================
 #include "StaticCallCounter.h"
+#include "ResultWriter.h"
 
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 
 using namespace llvm;
 
+//------------------------------------------------------------------------------
+// Command line options
+//------------------------------------------------------------------------------
+cl::OptionCategory StaticCCCategory{"static-cc options"};
+
+static cl::opt<ResultFormat> OutputFormat{
+    "static-cc-format", cl::desc("The format of the printed results"),
+    getResultFormatValues(), cl::init(ResultFormat::Text),
+    cl::cat(StaticCCCategory)};
+
 // Pretty-prints the result of this analysis
 static void printStaticCCResult(llvm::raw_ostream &OutS,
                          const ResultStaticCC &DirectCalls);
@@ -41,40 +63,42 @@ static void printStaticCCResult(llvm::raw_ostream &OutS,
 StaticCallCounter::Result StaticCallCounter::runOnModule(Module &M) {
   llvm::MapVector<const llvm::Function *, unsigned> Res;
 
-  for (auto &Func : M) {
-    for (auto &BB : Func) {
-      for (auto &Ins : BB) {
-
-        // If this is a call instruction then CB will be not null.
-        auto *CB = dyn_cast<CallBase>(&Ins);
-        if (nullptr == CB) {
-          continue;
-        }
-
-        // If CB is a direct function call then DirectInvoc will be not null.
-        auto DirectInvoc = CB->getCalledFunction();
-        if (nullptr == DirectInvoc) {
-          continue;
-        }
-
-        // We have a direct function call - update the count for the function
-        // being called.
-        auto CallCount = Res.find(DirectInvoc);
-        if (Res.end() == CallCount) {
-          CallCount = Res.insert(std::make_pair(DirectInvoc, 0)).first;
-        }
-        ++CallCount->second;
+  for (auto &Func : M)
+    runOnFunction(Func, Res);
+
+  return Res;
+}
+
+void StaticCallCounter::runOnFunction(Function &Func, Result &Res) {
+  for (auto &BB : Func) {
+    for (auto &Ins : BB) {
+
+      // If this is a call instruction then CB will be not null.
+      auto *CB = dyn_cast<CallBase>(&Ins);
+      if (nullptr == CB) {
+        continue;
+      }
+
+      // If CB is a direct function call then DirectInvoc will be not null.
+      auto DirectInvoc = CB->getCalledFunction();
+      if (nullptr == DirectInvoc) {
+        continue;
       }
+
+      // We have a direct function call - update the count for the function
+      // being called.
+      auto CallCount = Res.find(DirectInvoc);
+      if (Res.end() == CallCount) {
+        CallCount = Res.insert(std::make_pair(DirectInvoc, 0)).first;
+      }
+      ++CallCount->second;
     }
   }
-
-  return Res;
 }
 
 PreservedAnalyses
 StaticCallCounterPrinter::run(Module &M,
                               ModuleAnalysisManager &MAM) {
-
   auto DirectCalls = MAM.getResult<StaticCallCounter>(M);
 
   printStaticCCResult(OS, DirectCalls);
@@ -141,8 +165,36 @@ RegisterPass<LegacyStaticCallCounter>
 //------------------------------------------------------------------------------
 // Helper functions
 //------------------------------------------------------------------------------
+NamedResultStaticCC getNamedResult(const ResultStaticCC &DirectCalls) {
+  NamedResultStaticCC Res;
+  for (auto &CallCount : DirectCalls)
+    Res[CallCount.first->getName().str()] += CallCount.second;
+  return Res;
+}
+
+void mergeStaticCCResults(NamedResultStaticCC &Merged,
+                          const NamedResultStaticCC &Other) {
+  for (auto &CallCount : Other)
+    Merged[CallCount.first] += CallCount.second;
+}
+
 static void printStaticCCResult(raw_ostream &OutS,
                                 const ResultStaticCC &DirectCalls) {
+  printStaticCCResult(OutS, getNamedResult(DirectCalls));
+}
+
+void printStaticCCResult(raw_ostream &OutS,
+                         const NamedResultStaticCC &DirectCalls) {
+  if (OutputFormat != ResultFormat::Text) {
+    ResultWriter Writer(OutS, OutputFormat, {"function", "calls"});
+    for (auto &CallCount : DirectCalls)
+      Writer.beginRecord()
+          .field(CallCount.first)
+          .field(CallCount.second)
+          .endRecord();
+    return;
+  }
+
   OutS << "================================================="
        << "\n";
   OutS << "LLVM-TUTOR: static analysis results\n";
@@ -154,7 +206,7 @@ static void printStaticCCResult(raw_ostream &OutS,
        << "\n";
 
   for (auto &CallCount : DirectCalls) {
-    OutS << format("%-20s %-10lu\n", CallCount.first->getName().str().c_str(),
+    OutS << format("%-20s %-10lu\n", CallCount.first.c_str(),
                    CallCount.second);
   }
 
@@ -0,0 +1,142 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=relative -S %s \
+; RUN:  | FileCheck --check-prefix=RELATIVE %s
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libFindFCmpEq%shlibext -load %shlibdir/libConvertFCmpEq%shlibext -convert-fcmp-eq -convert-fcmp-eq-mode=combined -convert-fcmp-eq-epsilons=4 -S %s \
+; RUN:  | FileCheck --check-prefix=COMBINED %s
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=ulp -S %s \
+; RUN:  | FileCheck --check-prefix=ULP %s
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=ulp -convert-fcmp-eq-ulps=16 -S %s \
+; RUN:  | FileCheck --check-prefix=ULP16 %s
+
+; +/-inf compares equal to itself, and to nothing else, in all modes (see @main)
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=relative %s -o %t.relative.bin
+; RUN: lli %t.relative.bin
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=combined %s -o %t.combined.bin
+; RUN: lli %t.combined.bin
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=ulp %s -o %t.ulp.bin
+; RUN: lli %t.ulp.bin
+; -convert-fcmp-eq-ulps=0 is exact equality, so -0.0 == 0.0 still holds
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-mode=ulp -convert-fcmp-eq-ulps=0 %s -o %t.ulp0.bin
+; RUN: lli %t.ulp0.bin
+
+; With -convert-fcmp-eq-epsilons=0, the absolute comparison is inclusive
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq -convert-fcmp-eq-epsilons=0 -S %s \
+; RUN:  | FileCheck --check-prefix=ZERO %s
+
+; Verify the tolerance modes of ConvertFCmpEq (-convert-fcmp-eq-mode). None of
+; them introduces branches:
+;   * relative - (|a - b| <= eps * max(|a|, |b|) && a, b finite) || a == b
+;   * combined - (|a - b| <= max(eps, eps * max(|a|, |b|)) && a, b finite) ||
+;     a == b, with eps = 4 * 2^-52
+;   * ulp - the distance between the integer representations of a and b,
+;     combined with the original check for NaNs
+
+define i1 @fcmp_oeq(double %a, double %b) {
+  %cmp = fcmp oeq double %a, %b
+  ret i1 %cmp
+}
+
+define <4 x i1> @fcmp_une(<4 x float> %a, <4 x float> %b) {
+  %cmp = fcmp une <4 x float> %a, %b
+  ret <4 x i1> %cmp
+}
+
+; Returns 0 if inf == inf, -inf == -inf and !(inf != inf), but not inf == 1.0,
+; 1.0 == inf or inf == -inf. Also checks that -0.0 == 0.0.
+define i32 @main() {
+  %pos = call i1 @fcmp_oeq(double 0x7FF0000000000000, double 0x7FF0000000000000)
+  %neg = call i1 @fcmp_oeq(double 0xFFF0000000000000, double 0xFFF0000000000000)
+  %inf.one = call i1 @fcmp_oeq(double 0x7FF0000000000000, double 1.000000e+00)
+  %one.inf = call i1 @fcmp_oeq(double 1.000000e+00, double 0x7FF0000000000000)
+  %inf.neg = call i1 @fcmp_oeq(double 0x7FF0000000000000, double 0xFFF0000000000000)
+  %finite.eq.inf.0 = or i1 %inf.one, %one.inf
+  %finite.eq.inf = or i1 %finite.eq.inf.0, %inf.neg
+  %zeros = call i1 @fcmp_oeq(double -0.000000e+00, double 0.000000e+00)
+  %ne.vec = call <4 x i1> @fcmp_une(<4 x float> <float 0x7FF0000000000000, float 0x7FF0000000000000, float 0xFFF0000000000000, float 0xFFF0000000000000>, <4 x float> <float 0x7FF0000000000000, float 0x7FF0000000000000, float 0xFFF0000000000000, float 0xFFF0000000000000>)
+  %ne.int = bitcast <4 x i1> %ne.vec to i4
+  %ne = icmp ne i4 %ne.int, 0
+  %eq.0 = and i1 %pos, %neg
+  %eq = and i1 %eq.0, %zeros
+  %not.ne = xor i1 %ne, true
+  %ok.0 = and i1 %eq, %not.ne
+  %not.finite.eq.inf = xor i1 %finite.eq.inf, true
+  %ok = and i1 %ok.0, %not.finite.eq.inf
+  %res = select i1 %ok, i32 0, i32 1
+  ret i32 %res
+}
+
+; RELATIVE-LABEL: @fcmp_oeq
+; RELATIVE-NEXT:  %1 = fsub double %a, %b
+; RELATIVE-NEXT:  %2 = call double @llvm.fabs.f64(double %1)
+; RELATIVE-NEXT:  %3 = call double @llvm.fabs.f64(double %a)
+; RELATIVE-NEXT:  %4 = call double @llvm.fabs.f64(double %b)
+; RELATIVE-NEXT:  %5 = call double @llvm.maxnum.f64(double %3, double %4)
+; RELATIVE-NEXT:  %6 = fmul double %5, 0x3CB0000000000000
+; RELATIVE-NEXT:  %7 = fcmp oeq double %a, %b
+; RELATIVE-NEXT:  %8 = fcmp ole double %2, %6
+; RELATIVE-NEXT:  %9 = fcmp one double %5, 0x7FF0000000000000
+; RELATIVE-NEXT:  %10 = and i1 %8, %9
+; RELATIVE-NEXT:  %cmp = or i1 %10, %7
+; RELATIVE-NEXT:  ret i1 %cmp
+; RELATIVE-LABEL: @fcmp_une
+; RELATIVE-NEXT:  %1 = fsub <4 x float> %a, %b
+; RELATIVE-NEXT:  %2 = call <4 x float> @llvm.fabs.v4f32(<4 x float> %1)
+; RELATIVE-NEXT:  %3 = call <4 x float> @llvm.fabs.v4f32(<4 x float> %a)
+; RELATIVE-NEXT:  %4 = call <4 x float> @llvm.fabs.v4f32(<4 x float> %b)
+; RELATIVE-NEXT:  %5 = call <4 x float> @llvm.maxnum.v4f32(<4 x float> %3, <4 x float> %4)
+; RELATIVE-NEXT:  %6 = fmul <4 x float> %5, <float 0x3E80000000000000, float 0x3E80000000000000, float 0x3E80000000000000, float 0x3E80000000000000>
+; RELATIVE-NEXT:  %7 = fcmp une <4 x float> %a, %b
+; RELATIVE-NEXT:  %8 = fcmp ugt <4 x float> %2, %6
+; RELATIVE-NEXT:  %9 = fcmp ueq <4 x float> %5, <float 0x7FF0000000000000, float 0x7FF0000000000000, float 0x7FF0000000000000, float 0x7FF0000000000000>
+; RELATIVE-NEXT:  %10 = or <4 x i1> %8, %9
+; RELATIVE-NEXT:  %cmp = and <4 x i1> %10, %7
+; RELATIVE-NEXT:  ret <4 x i1> %cmp
+
+; COMBINED-LABEL: @fcmp_oeq
+; COMBINED-NEXT:  %1 = fsub double %a, %b
+; COMBINED-NEXT:  %2 = call double @llvm.fabs.f64(double %1)
+; COMBINED-NEXT:  %3 = call double @llvm.fabs.f64(double %a)
+; COMBINED-NEXT:  %4 = call double @llvm.fabs.f64(double %b)
+; COMBINED-NEXT:  %5 = call double @llvm.maxnum.f64(double %3, double %4)
+; COMBINED-NEXT:  %6 = fmul double %5, 0x3CD0000000000000
+; COMBINED-NEXT:  %7 = call double @llvm.maxnum.f64(double %6, double 0x3CD0000000000000)
+; COMBINED-NEXT:  %8 = fcmp oeq double %a, %b
+; COMBINED-NEXT:  %9 = fcmp ole double %2, %7
+; COMBINED-NEXT:  %10 = fcmp one double %5, 0x7FF0000000000000
+; COMBINED-NEXT:  %11 = and i1 %9, %10
+; COMBINED-NEXT:  %cmp = or i1 %11, %8
+; COMBINED-NEXT:  ret i1 %cmp
+
+; ULP-LABEL: @fcmp_oeq
+; ULP-NEXT:  %1 = bitcast double %a to i64
+; ULP-NEXT:  %2 = ashr i64 %1, 63
+; ULP-NEXT:  %3 = lshr i64 %2, 1
+; ULP-NEXT:  %4 = xor i64 %1, %3
+; ULP-NEXT:  %5 = sub i64 %4, %2
+; ULP-NEXT:  %6 = bitcast double %b to i64
+; ULP-NEXT:  %7 = ashr i64 %6, 63
+; ULP-NEXT:  %8 = lshr i64 %7, 1
+; ULP-NEXT:  %9 = xor i64 %6, %8
+; ULP-NEXT:  %10 = sub i64 %9, %7
+; ULP-NEXT:  %11 = call i64 @llvm.smax.i64(i64 %5, i64 %10)
+; ULP-NEXT:  %12 = call i64 @llvm.smin.i64(i64 %5, i64 %10)
+; ULP-NEXT:  %13 = sub i64 %11, %12
+; ULP-NEXT:  %14 = icmp ule i64 %13, 4
+; ULP-NEXT:  %15 = fcmp ord double %a, %b
+; ULP-NEXT:  %cmp = and i1 %15, %14
+; ULP-NEXT:  ret i1 %cmp
+; ULP-LABEL: @fcmp_une
+; ULP:       %11 = call <4 x i32> @llvm.smax.v4i32(<4 x i32> %5, <4 x i32> %10)
+; ULP-NEXT:  %12 = call <4 x i32> @llvm.smin.v4i32(<4 x i32> %5, <4 x i32> %10)
+; ULP-NEXT:  %13 = sub <4 x i32> %11, %12
+; ULP-NEXT:  %14 = icmp ugt <4 x i32> %13, <i32 4, i32 4, i32 4, i32 4>
+; ULP-NEXT:  %15 = fcmp uno <4 x float> %a, %b
+; ULP-NEXT:  %cmp = or <4 x i1> %15, %14
+; ULP-NEXT:  ret <4 x i1> %cmp
+
+; ULP16-LABEL: @fcmp_oeq
+; ULP16:       icmp ule i64 %13, 16
+
+; ZERO-LABEL: @fcmp_oeq
+; ZERO-NEXT:  %1 = fsub double %a, %b
+; ZERO-NEXT:  %2 = call double @llvm.fabs.f64(double %1)
+; ZERO-NEXT:  %cmp = fcmp ole double %2, 0.000000e+00
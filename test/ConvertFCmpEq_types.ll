@@ -0,0 +1,58 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libFindFCmpEq%shlibext  -load %shlibdir/libConvertFCmpEq%shlibext -convert-fcmp-eq  -S %s \
+; RUN:  | FileCheck %s
+; RUN: opt -load-pass-plugin=%shlibdir/libFindFCmpEq%shlibext  -load-pass-plugin=%shlibdir/libConvertFCmpEq%shlibext --passes=convert-fcmp-eq  -S %s \
+; RUN:  | FileCheck %s
+
+; Verify that comparisons of types other than double (including vectors) are
+; converted using llvm.fabs for that type and the matching machine epsilon:
+;   half: 2^-10, float: 2^-23, fp128: 2^-112
+
+define i1 @fcmp_float(float %a, float %b) {
+; CHECK-LABEL: @fcmp_float
+; CHECK-NEXT: %1 = fsub float %a, %b
+; CHECK-NEXT: %2 = call float @llvm.fabs.f32(float %1)
+; CHECK-NEXT: %cmp = fcmp olt float %2, 0x3E80000000000000
+; CHECK-NEXT: ret i1 %cmp
+  %cmp = fcmp oeq float %a, %b
+  ret i1 %cmp
+}
+
+define i1 @fcmp_half(half %a, half %b) {
+; CHECK-LABEL: @fcmp_half
+; CHECK-NEXT: %1 = fsub half %a, %b
+; CHECK-NEXT: %2 = call half @llvm.fabs.f16(half %1)
+; CHECK-NEXT: %cmp = fcmp uge half %2, 0xH1400
+; CHECK-NEXT: ret i1 %cmp
+  %cmp = fcmp une half %a, %b
+  ret i1 %cmp
+}
+
+define i1 @fcmp_fp128(fp128 %a, fp128 %b) {
+; CHECK-LABEL: @fcmp_fp128
+; CHECK-NEXT: %1 = fsub fp128 %a, %b
+; CHECK-NEXT: %2 = call fp128 @llvm.fabs.f128(fp128 %1)
+; CHECK-NEXT: %cmp = fcmp olt fp128 %2, 0xL00000000000000003F8F000000000000
+; CHECK-NEXT: ret i1 %cmp
+  %cmp = fcmp oeq fp128 %a, %b
+  ret i1 %cmp
+}
+
+define <4 x i1> @fcmp_v4f32(<4 x float> %a, <4 x float> %b) {
+; CHECK-LABEL: @fcmp_v4f32
+; CHECK-NEXT: %1 = fsub <4 x float> %a, %b
+; CHECK-NEXT: %2 = call <4 x float> @llvm.fabs.v4f32(<4 x float> %1)
+; CHECK-NEXT: %cmp = fcmp olt <4 x float> %2, <float 0x3E80000000000000, float 0x3E80000000000000, float 0x3E80000000000000, float 0x3E80000000000000>
+; CHECK-NEXT: ret <4 x i1> %cmp
+  %cmp = fcmp oeq <4 x float> %a, %b
+  ret <4 x i1> %cmp
+}
+
+define <2 x i1> @fcmp_v2f64(<2 x double> %a, <2 x double> %b) {
+; CHECK-LABEL: @fcmp_v2f64
+; CHECK-NEXT: %1 = fsub <2 x double> %a, %b
+; CHECK-NEXT: %2 = call <2 x double> @llvm.fabs.v2f64(<2 x double> %1)
+; CHECK-NEXT: %cmp = fcmp oge <2 x double> %2, <double 0x3CB0000000000000, double 0x3CB0000000000000>
+; CHECK-NEXT: ret <2 x i1> %cmp
+  %cmp = fcmp one <2 x double> %a, %b
+  ret <2 x i1> %cmp
+}
@@ -0,0 +1,43 @@
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes=duplicate-bb -duplicate-bb-profile-guided -S %s | FileCheck --check-prefix=BUDGET %s
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libRIV%shlibext -load %shlibdir/libDuplicateBB%shlibext -legacy-duplicate-bb -duplicate-bb-profile-guided -S %s | FileCheck --check-prefix=BUDGET %s
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes=duplicate-bb -duplicate-bb-profile-guided -duplicate-bb-size-budget=1000 -duplicate-bb-cycle-budget=1000 -S %s | FileCheck --check-prefix=ALL %s
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes=duplicate-bb -duplicate-bb-profile-guided -duplicate-bb-size-budget=0 -S %s | FileCheck --check-prefix=NONE %s
+
+; Verify that with -duplicate-bb-profile-guided, the blocks are duplicated
+; only within the budgets, and that the hot blocks are left out first. Based
+; on the branch weights, %loop is executed ~1000 times per call, so
+; duplicating it would exceed the (default) cycle budget. The cold blocks
+; (%entry and %exit) are duplicated.
+
+define i32 @foo(i32 %n) {
+entry:
+  %a = add i32 %n, 1
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, %a
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit, !prof !0
+
+exit:
+  ret i32 %i.next
+}
+
+!0 = !{!"branch_weights", i32 1000, i32 1}
+
+; BUDGET-LABEL: define i32 @foo
+; BUDGET:       lt-if-then-else-0:
+; BUDGET:       loop:
+; BUDGET-NEXT:    %i = phi i32
+; BUDGET-NEXT:    %i.next = add i32 %i, %a
+; BUDGET:       lt-if-then-else-1:
+; BUDGET-NOT:   lt-if-then-else-2
+
+; ALL-LABEL: define i32 @foo
+; ALL:       lt-if-then-else-0:
+; ALL:       lt-if-then-else-1:
+; ALL:       lt-if-then-else-2:
+
+; NONE-LABEL: define i32 @foo
+; NONE-NOT:   lt-if-then-else
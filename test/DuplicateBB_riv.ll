@@ -0,0 +1,52 @@
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes="duplicate-bb,print<riv>" -debug-pass-manager -disable-output %s 2>&1 | FileCheck  %s
+
+; Verify that DuplicateBB keeps the RIV results up to date (rather than
+; invalidating them): RIV is computed only once and the results printed
+; afterwards include the blocks and values inserted by DuplicateBB.
+
+define i32 @foo(i32 %a) {
+entry:
+  %x = add i32 %a, 1
+  br label %next
+
+next:
+  %y = mul i32 %x, 2
+  ret i32 %y
+}
+
+; CHECK:     Running analysis: RIV on foo
+; CHECK-NOT: Running analysis: RIV on foo
+
+; The values in entry have been replaced with PHI nodes in lt-tail-0, which
+; dominates the second duplicated block. Every lt-tail block takes over the
+; position of the original block, the other new blocks are printed last.
+; CHECK-LABEL: BB %lt-tail-0
+; CHECK-NEXT:    [[COND0:%[0-9]+]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-tail-1
+; CHECK-NEXT:    [[COND1:%[0-9]+]] = icmp eq i32 %{{(a|x)}}, 0
+; CHECK-NEXT:    %x = phi i32
+; CHECK-NEXT:    [[COND0]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-if-then-else-0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-clone-1-0
+; CHECK-NEXT:    [[COND0]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-clone-2-0
+; CHECK-NEXT:    [[COND0]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-if-then-else-1
+; CHECK-NEXT:    %x = phi i32
+; CHECK-NEXT:    [[COND0]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-clone-1-1
+; CHECK-NEXT:    [[COND1]] = icmp
+; CHECK-NEXT:    %x = phi i32
+; CHECK-NEXT:    [[COND0]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:  BB %lt-clone-2-1
+; CHECK-NEXT:    [[COND1]] = icmp
+; CHECK-NEXT:    %x = phi i32
+; CHECK-NEXT:    [[COND0]] = icmp eq i32 %a, 0
+; CHECK-NEXT:    i32 %a
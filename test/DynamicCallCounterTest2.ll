@@ -7,7 +7,7 @@
 ; The global variables inserted by the pass
 ; CHECK: @CounterFor_foo = common global i32 0, align 4
 ; CHECK-NEXT: @0 = private unnamed_addr constant [4 x i8] c"foo\00", align 1
-; CHECK-NEXT: @ResultFormatStrIR = global [14 x i8]
+; CHECK-NEXT: @ResultFormatStrIR = global [15 x i8]
 ; CHECK-NEXT: @ResultHeaderStrIR = global [225 x i8]
 ; CHECK-NEXT: @llvm.global_dtors = appending global
 ; CHECK-SAME: @printf_wrapper
@@ -32,7 +32,8 @@ define void @foo() {
 ; CHECK-NEXT:  %0 = call i32 (ptr, ...) @printf
 ; CHECK-SAME: @ResultHeaderStrIR
 ; CHECK-NEXT:  %1 = load i32, ptr @CounterFor_foo
-; CHECK-NEXT:  %2 = call i32 (ptr, ...) @printf
+; CHECK-NEXT:  %2 = zext i32 %1 to i64
+; CHECK-NEXT:  %3 = call i32 (ptr, ...) @printf
 ; CHECK-SAME: @ResultFormatStrIR
 ; CHECK-NEXT:  ret void
 ; CHECK-NEXT: }
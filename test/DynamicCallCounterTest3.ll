@@ -3,7 +3,7 @@
 declare void @foo()
 
 ; CHECK-NOT: @CounterFor_foo
-; CHECK-NOT: @ResultFormatStrIR = global [14 x i8]
+; CHECK-NOT: @ResultFormatStrIR = global [15 x i8]
 ; CHECK-NOT: @ResultHeaderStrIR = global [225 x i8]
 
 ; CHECK: declare void @foo()
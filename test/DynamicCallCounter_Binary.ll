@@ -0,0 +1,72 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-output=binary %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: rm -f %t.prof %t.merged.prof
+; RUN: env DYNAMIC_CC_PROFILE=%t.prof lli %t.bin | FileCheck %s --allow-empty --check-prefix=NO_OUTPUT
+; RUN: ../bin/dynamic-cc-merge %t.prof | FileCheck %s --check-prefix=RUN_ONCE
+; RUN: env DYNAMIC_CC_PROFILE=%t.prof lli %t.bin
+; RUN: ../bin/dynamic-cc-merge %t.prof | FileCheck %s --check-prefix=RUN_TWICE
+
+; Merge with the sharded counters and write the merged result to a new profile
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-output=binary -dynamic-cc-counters=sharded -dynamic-cc-profile=%t.sharded.prof %S/Inputs/CallCounterInput.ll -o %t.sharded.bin
+; RUN: rm -f %t.sharded.prof
+; RUN: lli %t.sharded.bin
+; RUN: ../bin/dynamic-cc-merge %t.prof %t.sharded.prof -o %t.merged.prof
+; RUN: ../bin/dynamic-cc-merge %t.merged.prof | FileCheck %s --check-prefix=RUN_THRICE
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-output=binary %S/Inputs/CallCounterInput.ll -S \
+; RUN:   | FileCheck %s --check-prefix=IR
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-output=binary -dynamic-cc-counters=sharded %S/Inputs/CallCounterInput.ll -S \
+; RUN:   | FileCheck %s --check-prefix=IR-SHARDED
+
+; RUN: not ../bin/dynamic-cc-merge %s 2>&1 | FileCheck %s --check-prefix=ERR
+
+; Instrument this file with DynamicCallCounter (binary output), run it (once,
+; twice and three times) and verify that the profiles are merged correctly.
+
+; Nothing is printed by the instrumented module
+; NO_OUTPUT-NOT: {{.}}
+
+; RUN_ONCE: NAME                 #N DIRECT CALLS
+; RUN_ONCE: foo                  13
+; RUN_ONCE-NEXT: bar                  2
+; RUN_ONCE-NEXT: fez                  1
+; RUN_ONCE-NEXT: main                 1
+
+; RUN_TWICE: foo                  26
+; RUN_TWICE-NEXT: bar                  4
+; RUN_TWICE-NEXT: fez                  2
+; RUN_TWICE-NEXT: main                 2
+
+; RUN_THRICE: foo                  39
+; RUN_THRICE-NEXT: bar                  6
+; RUN_THRICE-NEXT: fez                  3
+; RUN_THRICE-NEXT: main                 3
+
+; The profile record, including the name table, is a single global in a
+; dedicated section
+; IR: @DynamicCCProfile = internal global { [8 x i8], i32, i32, i64, i64, [24 x i8], [4 x i64] } { [8 x i8] c"LTDCCPRF", i32 3, i32 4, i64 4, i64 24, [24 x i8] c"foo\00bar\00fez\00main\00\00\00\00\00\00\00\00", [4 x i64] zeroinitializer }, section "lt_dcc_prof", align 8
+; IR-NOT: @printf_wrapper
+; IR-NOT: @CounterFor_
+; IR: @llvm.global_dtors = {{.*}} @write_profile
+
+; The counters are updated in place ...
+; IR-LABEL: define void @foo()
+; IR-NEXT:    [[COUNT:%.*]] = load i64, ptr getelementptr inbounds {{.*}}@DynamicCCProfile, i32 0, i32 6, i32 0)
+; IR-NEXT:    [[INC:%.*]] = add i64 1, [[COUNT]]
+; IR-NEXT:    store i64 [[INC]], ptr getelementptr inbounds {{.*}}@DynamicCCProfile, i32 0, i32 6, i32 0)
+
+; ... so there's nothing to collect before writing the record. Only the first
+; record of a run is marked as such.
+; IR-LABEL: define internal void @write_profile()
+; IR-NOT:     load
+; IR:         call {{.*}} @fwrite(
+; IR-NEXT:    call i32 @fclose(
+; IR-NEXT:    store i32 0, {{.*}} @DynamicCCProfile, i32 0, i32 2)
+
+; The sharded counters are summed up in a loop
+; IR-SHARDED-LABEL: define internal void @write_profile()
+; IR-SHARDED:         call i64 @sum_counter_shards(i32 %
+; IR-SHARDED-NOT:     call i64 @sum_counter_shards(
+; IR-SHARDED:         call {{.*}} @fwrite(
+
+; ERR: not a DynamicCallCounter profile
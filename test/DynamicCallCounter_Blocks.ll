@@ -0,0 +1,91 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libDynamicCallCounter%shlibext -legacy-dynamic-cc -dynamic-cc-mode=blocks -verify %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-mode=blocks %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-mode=blocks -dynamic-cc-counters=sharded %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+
+; Blocks without names are numbered
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-mode=blocks -dynamic-cc-output=binary -dynamic-cc-profile=%t.prof %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: rm -f %t.prof
+; RUN: lli %t.bin
+; RUN: ../bin/dynamic-cc-merge %t.prof | FileCheck %s --check-prefix=UNNAMED
+
+; Profiles of blocks and of calls cannot be merged
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-output=binary -dynamic-cc-profile=%t.calls.prof %S/Inputs/CallCounterInput.ll -o %t.calls.bin
+; RUN: rm -f %t.calls.prof
+; RUN: lli %t.calls.bin
+; RUN: not ../bin/dynamic-cc-merge %t.prof %t.calls.prof 2>&1 | FileCheck %s --check-prefix=MISMATCH
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-mode=blocks %s -S \
+; RUN:   | FileCheck %s --check-prefix=IR
+
+; Instrument this file with DynamicCallCounter (counting basic blocks), run it
+; and verify that the block counts are reconstructed correctly.
+
+; CHECK: NAME                 #N EXECUTIONS
+; CHECK: {{^}}count_odd:entry{{ +}}2{{ *$}}
+; CHECK-NEXT: {{^}}count_odd:loop{{ +}}13{{ *$}}
+; CHECK-NEXT: {{^}}count_odd:then{{ +}}6{{ *$}}
+; CHECK-NEXT: {{^}}count_odd:latch{{ +}}13{{ *$}}
+; CHECK-NEXT: {{^}}count_odd:exit{{ +}}2{{ *$}}
+; CHECK-NEXT: {{^}}main:entry{{ +}}1{{ *$}}
+
+; UNNAMED: NAME                 #N EXECUTIONS
+; UNNAMED: {{^}}foo:bb1{{ +}}13{{ *$}}
+; UNNAMED-NEXT: {{^}}bar:bb1{{ +}}2{{ *$}}
+; UNNAMED-NEXT: {{^}}fez:bb1{{ +}}1{{ *$}}
+; UNNAMED-NEXT: {{^}}main:bb1{{ +}}1{{ *$}}
+; UNNAMED-NEXT: {{^}}main:bb2{{ +}}11{{ *$}}
+; UNNAMED-NEXT: {{^}}main:bb3{{ +}}10{{ *$}}
+; UNNAMED-NEXT: {{^}}main:bb4{{ +}}10{{ *$}}
+; UNNAMED-NEXT: {{^}}main:bb5{{ +}}1{{ *$}}
+
+; MISMATCH: cannot merge profiles of function calls and of basic block executions
+
+; The CFG of count_odd has 5 blocks and 8 edges (including the call and the
+; return), but only 8 - (5 + 1) + 1 = 3 edges need counters. Critical edges
+; are preferably left without counters, so only one of them is split.
+; IR: @CounterFor_count_odd.edge0 = common global i32 0, align 4
+; IR-NEXT: @CounterFor_count_odd.edge1 = common global i32 0, align 4
+; IR-NEXT: @CounterFor_count_odd.edge2 = common global i32 0, align 4
+; IR-NEXT: @CounterFor_main.edge0 = common global i32 0, align 4
+; IR-NOT: @CounterFor_
+; IR-LABEL: @count_odd(
+; IR-NOT: loop.latch_crit_edge:
+; IR: latch.loop_crit_edge:
+; IR-NEXT: load i32, {{.*}} @CounterFor_count_odd.edge1
+; IR-NOT: _crit_edge:
+; IR-LABEL: @main(
+
+define i32 @count_odd(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %latch ]
+  %odd = and i32 %i, 1
+  %is.odd = icmp ne i32 %odd, 0
+  br i1 %is.odd, label %then, label %latch
+
+then:
+  %acc.inc = add i32 %acc, 1
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.inc, %then ]
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @main() {
+entry:
+  %a = call i32 @count_odd(i32 10)
+  %b = call i32 @count_odd(i32 3)
+  ret i32 0
+}
@@ -0,0 +1,79 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libDynamicCallCounter%shlibext -legacy-dynamic-cc -dynamic-cc-sample-rate=2 -verify %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-sample-rate=2 %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-sample-rate=2 -dynamic-cc-counters=sharded %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-sample-rate=2 -dynamic-cc-output=binary -dynamic-cc-profile=%t.prof %s -o %t.bin
+; RUN: rm -f %t.prof
+; RUN: lli %t.bin
+; RUN: ../bin/dynamic-cc-merge %t.prof | FileCheck %s
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-sample-rate=4 %S/Inputs/CallCounterInput.ll -S \
+; RUN:   | FileCheck %s --check-prefix=IR
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-sample-rate=4 -dynamic-cc-counters=sharded %S/Inputs/CallCounterInput.ll -S \
+; RUN:   | FileCheck %s --check-prefix=IR
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-sample-rate=4 -dynamic-cc-mode=blocks %S/Inputs/CallCounterInput.ll -S \
+; RUN:   | FileCheck %s --check-prefix=IR-BLOCKS
+
+; Instrument this file with DynamicCallCounter, sampling one in every 2
+; calls (on average), run it and verify the (scaled) results. foo and bar are
+; called alternately, 1000 times each. With a fixed sampling interval of 2,
+; only one of them would ever be sampled. With a random interval, both
+; estimates are close to 1000.
+;
+; The sampling check splits the entry block, so also verify that the static
+; allocas stay in the entry block of @main in CallCounterInput.ll (rather
+; than becoming dynamic).
+
+; CHECK: foo                  {{(9[0-9][0-9]|10[0-9][0-9])}}
+; CHECK-NEXT: bar                  {{(9[0-9][0-9]|10[0-9][0-9])}}
+; CHECK-NEXT: main                 {{[0-9]+}}
+
+; IR: @SampleCountdown = internal thread_local global i32 0
+; IR: @SampleRNG = internal thread_local global i32
+; IR-LABEL: @foo(
+; IR-NEXT:    [[COUNTDOWN:%.*]] = load i32, {{.*}} @SampleCountdown
+; IR-NEXT:    [[IS_SAMPLE:%.*]] = icmp eq i32 [[COUNTDOWN]], 0
+; IR-NEXT:    [[DEC:%.*]] = sub i32 [[COUNTDOWN]], 1
+; IR-NEXT:    store i32 [[DEC]], {{.*}} @SampleCountdown
+; IR-NEXT:    br i1 [[IS_SAMPLE]], label %[[SAMPLE:.*]], label %[[CONT:.*]], !prof ![[WEIGHTS:[0-9]+]]
+; IR:       [[SAMPLE]]:
+; IR-NEXT:    call void @reload_sample_countdown()
+; IR-LABEL: @main(
+; IR-NEXT:    alloca i32
+; IR-NEXT:    alloca i32
+; IR-NEXT:    load i32, {{.*}} @SampleCountdown
+; IR-LABEL: define internal void @reload_sample_countdown()
+; IR:         store i32 {{.*}} @SampleRNG
+; IR:         [[RELOAD:%.*]] = urem i32 {{.*}}, 7
+; IR-NEXT:    store i32 [[RELOAD]], {{.*}} @SampleCountdown
+; IR:       ![[WEIGHTS]] = !{!"branch_weights", i32 1, i32 3}
+
+; IR-BLOCKS-LABEL: @main(
+; IR-BLOCKS-NEXT:    alloca i32
+; IR-BLOCKS-NEXT:    alloca i32
+
+define void @foo() {
+  ret void
+}
+
+define void @bar() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  call void @foo()
+  call void @bar()
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, 1000
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 0
+}
@@ -0,0 +1,32 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libDynamicCallCounter%shlibext -legacy-dynamic-cc -dynamic-cc-counters=sharded -verify %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-counters=sharded -dynamic-cc-shards=3 %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: lli %t.bin | FileCheck %s
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-counters=sharded -dynamic-cc-shards=3 %S/Inputs/CallCounterInput.ll -S \
+; RUN:   | FileCheck %s --check-prefix=IR
+
+; Instrument the input file using the thread-safe (sharded) counters, run it
+; and verify that the counts are identical to those for the plain counters.
+
+; CHECK: foo                  13
+; CHECK-NEXT: bar                  2
+; CHECK-NEXT: fez                  1
+; CHECK-NEXT: main                 1
+
+; Every shard (i.e. row) is padded to a multiple of the cache line size (i.e.
+; 8 x i64 counters)
+; IR: @CounterShards = internal global [3 x [8 x i64]] zeroinitializer, align 64
+; IR: @CounterShardIdx = internal thread_local global i32 0
+
+; IR-LABEL: define void @foo()
+; IR-NEXT: [[SHARD:%.*]] = call i32 @get_counter_shard()
+; IR-NEXT: [[CNT:%.*]] = getelementptr [3 x [8 x i64]], {{.*}} @CounterShards, i32 0, i32 [[SHARD]], i32 0
+; IR-NEXT: atomicrmw add {{.*}} [[CNT]], i64 1 monotonic, align 8
+
+; IR-LABEL: define internal i32 @get_counter_shard()
+; IR: atomicrmw add {{.*}} @NextCounterShard, i32 1 monotonic
+; IR: urem i32 {{.*}}, 3
+
+; IR-LABEL: define internal i64 @sum_counter_shards(i32 %0)
+; IR: load atomic i64, {{.*}} monotonic, align 8
@@ -0,0 +1,84 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s --check-prefix=CUMULATIVE
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-snapshot-delta %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s --check-prefix=DELTA
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-snapshot-delta -dynamic-cc-counters=sharded %s -o %t.bin
+; RUN: lli %t.bin | FileCheck %s --check-prefix=DELTA
+
+; With delta snapshots, every binary record covers a different period, so
+; merging them gives the totals
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-snapshot-delta -dynamic-cc-output=binary -dynamic-cc-profile=%t.prof %s -o %t.bin
+; RUN: rm -f %t.prof
+; RUN: lli %t.bin
+; RUN: ../bin/dynamic-cc-merge %t.prof | FileCheck %s --check-prefix=MERGED
+
+; Without -dynamic-cc-snapshot-delta, every binary record contains the totals
+; since the start of its run, so only the last record of every run is merged
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-output=binary -dynamic-cc-profile=%t.cumulative.prof %s -o %t.bin
+; RUN: rm -f %t.cumulative.prof
+; RUN: lli %t.bin
+; RUN: ../bin/dynamic-cc-merge %t.cumulative.prof | FileCheck %s --check-prefix=MERGED
+; RUN: lli %t.bin
+; RUN: ../bin/dynamic-cc-merge %t.cumulative.prof | FileCheck %s --check-prefix=MERGED_TWICE
+; RUN: ../bin/dynamic-cc-merge %t.prof %t.cumulative.prof | FileCheck %s --check-prefix=MERGED_THRICE
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext -passes="dynamic-cc,verify" -dynamic-cc-snapshot-signal=10 -dynamic-cc-snapshot-interval=60 %s -S \
+; RUN:   | FileCheck %s --check-prefix=IR
+
+; Instrument this file with DynamicCallCounter and verify that the snapshot
+; taken by main (by calling dynamic_cc_snapshot) and the final results are
+; correct.
+
+; CUMULATIVE: foo                  3
+; CUMULATIVE-NEXT: main                 1
+; CUMULATIVE: foo                  5
+; CUMULATIVE-NEXT: main                 1
+
+; DELTA: foo                  3
+; DELTA-NEXT: main                 1
+; DELTA: foo                  2
+; DELTA-NEXT: main                 0
+
+; MERGED: foo                  5
+; MERGED-NEXT: main                 1
+
+; MERGED_TWICE: foo                  10
+; MERGED_TWICE-NEXT: main                 2
+
+; MERGED_THRICE: foo                  15
+; MERGED_THRICE-NEXT: main                 3
+
+; The threads that take snapshots on a signal and periodically
+; IR-DAG: @llvm.global_ctors = appending global {{.*}} @start_snapshot_threads
+; IR-DAG: @llvm.global_dtors = appending global {{.*}} @dynamic_cc_snapshot
+; IR-LABEL: define void @dynamic_cc_snapshot()
+; IR:         atomicrmw xchg {{.*}} @SnapshotLock, i32 1 acquire
+; IR:         call void @printf_wrapper()
+; IR-NEXT:    store atomic i32 0, {{.*}} @SnapshotLock release
+; IR-LABEL: define internal void @start_snapshot_threads()
+; IR:         call i32 @pthread_sigmask(
+; IR:         call i32 @pthread_create({{.*}} @signal_snapshot_thread
+; IR:         call i32 @pthread_create({{.*}} @timer_snapshot_thread
+; IR-LABEL: define internal {{.*}} @signal_snapshot_thread(
+; IR:         call i32 @sigaddset({{.*}}, i32 10)
+; IR:         call i32 @sigwait(
+; IR:         call void @dynamic_cc_snapshot()
+; IR-LABEL: define internal {{.*}} @timer_snapshot_thread(
+; IR:         call i32 @sleep(i32 60)
+; IR-NEXT:    call void @dynamic_cc_snapshot()
+
+declare void @dynamic_cc_snapshot()
+
+define void @foo() {
+  ret void
+}
+
+define i32 @main() {
+  call void @foo()
+  call void @foo()
+  call void @foo()
+  call void @dynamic_cc_snapshot()
+  call void @foo()
+  call void @foo()
+  ret i32 0
+}
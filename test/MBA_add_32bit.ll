@@ -10,11 +10,26 @@ define signext i32 @foo(i32 signext, i32 signext, i32 signext, i32 signext) {
   ret i32 %7
 }
 
-; Verify that the additions in foo are _not_ substituted (because MBAAdd
-; is only meant for 8-bit additions)
+; Verify that the additions in foo are correctly substituted with the 32-bit
+; variant of the formula:
+;    a + b == (((a ^ b) + 2 * (a & b)) * 39 + 23) * C + D
+; where C = 39^-1 mod 2^32 = 2532929431 (-1762037865 as a signed i32) and
+; D = -C * 23 mod 2^32 = 1872165231
 
 ; CHECK-LABEL: @foo
-; CHECK-NEXT:  %5 = add i32 %1, %0
-; CHECK-NEXT:  %6 = add i32 %5, %2
-; CHECK-NEXT:  %7 = add i32 %6, %3
-; CHECK-NEXT:  ret i32 %7
+; 1st addition
+; CHECK-DAG:   {{%[0-9]+}} = xor i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-DAG:   {{%[0-9]+}} = and i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-DAG:   {{%[0-9]+}} = mul i32 2, {{%[0-9]+}}
+; CHECK-DAG:   [[REG_1:%[0-9]+]] = add i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:  [[REG_2:%[0-9]+]] = mul i32 39, [[REG_1]]
+; CHECK-NEXT:  [[REG_3:%[0-9]+]] = add i32 23, [[REG_2]]
+; CHECK-NEXT:  [[REG_4:%[0-9]+]] = mul i32 -1762037865, [[REG_3]]
+; CHECK-NEXT:  [[REG_5:%[0-9]+]] = add i32 1872165231, [[REG_4]]
+; 2nd addition
+; CHECK:       mul i32 -1762037865
+; CHECK-NEXT:  [[REG_6:%[0-9]+]] = add i32 1872165231
+; 3rd addition
+; CHECK:       mul i32 -1762037865
+; CHECK-NEXT:  [[REG_7:%[0-9]+]] = add i32 1872165231
+; CHECK-NEXT:  ret i32 [[REG_7]]
@@ -0,0 +1,59 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMBAAdd%shlibext -legacy-mba-add -S %s \
+; RUN:  | FileCheck %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext -passes="mba-add" -S %s \
+; RUN:  | FileCheck %s
+
+; Verify that MBAAdd uses the constants that match the bit width of the
+; (element) type:
+;   * i16: C = 28567, D = 63855 (-1681 as a signed i16)
+;   * i64: C = 8040888442386214807, D = -472993437787424401
+;   * vectors use splats of the constants for the element type
+;   * additions of other widths (e.g. i1, i128) are left as they are
+
+; CHECK-LABEL: @add_i16
+; CHECK:       mul i16 39
+; CHECK-NEXT:  add i16 23
+; CHECK-NEXT:  mul i16 28567
+; CHECK-NEXT:  add i16 -1681
+define i16 @add_i16(i16 %a, i16 %b) {
+  %r = add i16 %a, %b
+  ret i16 %r
+}
+
+; CHECK-LABEL: @add_i64
+; CHECK:       mul i64 39
+; CHECK-NEXT:  add i64 23
+; CHECK-NEXT:  mul i64 8040888442386214807
+; CHECK-NEXT:  add i64 -472993437787424401
+define i64 @add_i64(i64 %a, i64 %b) {
+  %r = add i64 %a, %b
+  ret i64 %r
+}
+
+; CHECK-LABEL: @add_v16i8
+; CHECK:       xor <16 x i8> %a, %b
+; CHECK:       mul <16 x i8> <i8 -105,
+; CHECK-NEXT:  add <16 x i8> <i8 111,
+define <16 x i8> @add_v16i8(<16 x i8> %a, <16 x i8> %b) {
+  %r = add <16 x i8> %a, %b
+  ret <16 x i8> %r
+}
+
+; CHECK-LABEL: @add_v4i32
+; CHECK:       mul <4 x i32> <i32 -1762037865, i32 -1762037865, i32 -1762037865, i32 -1762037865>
+; CHECK-NEXT:  add <4 x i32> <i32 1872165231, i32 1872165231, i32 1872165231, i32 1872165231>
+define <4 x i32> @add_v4i32(<4 x i32> %a, <4 x i32> %b) {
+  %r = add <4 x i32> %a, %b
+  ret <4 x i32> %r
+}
+
+; CHECK-LABEL: @add_other
+; CHECK-NEXT:  %r1 = add i1 %a, %b
+; CHECK-NEXT:  %r128 = add i128 %c, %d
+define i1 @add_other(i1 %a, i1 %b, i128 %c, i128 %d) {
+  %r1 = add i1 %a, %b
+  %r128 = add i128 %c, %d
+  %t = trunc i128 %r128 to i1
+  %r = and i1 %r1, %t
+  ret i1 %r
+}
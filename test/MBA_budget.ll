@@ -0,0 +1,88 @@
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes=mba-sub -mba-sub-budgeted -S %s | FileCheck --check-prefix=BUDGET %s
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMBASub%shlibext -legacy-mba-sub -mba-sub-budgeted -S %s | FileCheck --check-prefix=BUDGET %s
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes=mba-sub -mba-sub-budgeted -mba-sub-cycle-budget=1000 -S %s | FileCheck --check-prefix=ALL %s
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes=mba-sub -mba-sub-budgeted -mba-sub-size-budget=0 -S %s | FileCheck --check-prefix=NONE %s
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes=mba-sub -mba-sub-budgeted -mba-sub-module-size-budget=2 -S %s | FileCheck --check-prefix=MODULE %s
+; RUN: opt -load-pass-plugin %shlibdir/libMBAAdd%shlibext -passes=mba-add -mba-add-budgeted -S %s | FileCheck --check-prefix=ADD %s
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes=mba-sub,mba-sub -mba-sub-budgeted -mba-sub-module-size-budget=2 -S %s | FileCheck --check-prefix=TWICE %s
+
+; Verify that with -mba-sub-budgeted (-mba-add-budgeted), the instructions
+; are substituted only within the budgets, and that the hot instructions are
+; left out first. Based on the branch weights, %loop is executed ~1000 times
+; per call, so substituting %hot would exceed the (default) cycle budget. The
+; cold instructions (in %entry and %exit) are substituted. With the module
+; budget, only the first (i.e. the coldest) of these fits, and nothing in @bar
+; does. Every run of the pass starts with a new module budget, so the second
+; run substitutes %cold2 as well.
+
+define i32 @foo(i32 %a, i32 %b, i32 %n) {
+entry:
+  %cold1 = sub i32 %a, %b
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ %cold1, %entry ], [ %hot, %loop ]
+  %hot = sub i32 %acc, %b
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit, !prof !0
+
+exit:
+  %cold2 = sub i32 %hot, %a
+  %cold3 = add i32 %cold2, %b
+  ret i32 %cold3
+}
+
+define i32 @bar(i32 %a, i32 %b) {
+  %bar.sub = sub i32 %a, %b
+  ret i32 %bar.sub
+}
+
+!0 = !{!"branch_weights", i32 1000, i32 1}
+
+; BUDGET-LABEL: define i32 @foo
+; BUDGET:       entry:
+; BUDGET-NEXT:    [[NOT1:%[0-9]+]] = xor i32 %b, -1
+; BUDGET-NEXT:    [[ADD1:%[0-9]+]] = add i32 %a, [[NOT1]]
+; BUDGET-NEXT:    %cold1 = add i32 [[ADD1]], 1
+; BUDGET:       loop:
+; BUDGET:         %hot = sub i32 %acc, %b
+; BUDGET:       exit:
+; BUDGET-NEXT:    [[NOT2:%[0-9]+]] = xor i32 %a, -1
+; BUDGET-NEXT:    [[ADD2:%[0-9]+]] = add i32 %hot, [[NOT2]]
+; BUDGET-NEXT:    %cold2 = add i32 [[ADD2]], 1
+
+; ALL-LABEL: define i32 @foo
+; ALL-NOT:     sub
+; ALL:         %cold1 = add i32
+; ALL:         %hot = add i32
+; ALL:         %cold2 = add i32
+
+; NONE-LABEL: define i32 @foo
+; NONE-NOT:     xor
+; NONE:         %cold1 = sub i32 %a, %b
+; NONE:         %hot = sub i32 %acc, %b
+; NONE:         %cold2 = sub i32 %hot, %a
+
+; MODULE-LABEL: define i32 @foo
+; MODULE:         %cold1 = add i32
+; MODULE:         %hot = sub i32 %acc, %b
+; MODULE:         %cold2 = sub i32 %hot, %a
+; MODULE-LABEL: define i32 @bar
+; MODULE-NEXT:    %bar.sub = sub i32 %a, %b
+
+; TWICE-LABEL: define i32 @foo
+; TWICE:         %cold1 = add i32
+; TWICE:         %hot = sub i32 %acc, %b
+; TWICE:         %cold2 = add i32
+; TWICE-LABEL: define i32 @bar
+; TWICE-NEXT:    %bar.sub = sub i32 %a, %b
+
+; ADD-LABEL: define i32 @foo
+; ADD:       loop:
+; ADD:         %i.next = add nsw i32 %i, 1
+; ADD:       exit:
+; ADD:         %cold2 = sub i32 %hot, %a
+; ADD-NEXT:    {{%[0-9]+}} = xor i32 %cold2, %b
+; ADD:         %cold3 = add i32 1872165231, {{%[0-9]+}}
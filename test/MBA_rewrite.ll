@@ -0,0 +1,80 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMBARewrite%shlibext -legacy-mba-rewrite -mba-rewrite-identities=add-or-and,sub-and-not,xor-or-and,or-and-not,and-or-xor -S %s \
+; RUN:  | FileCheck --check-prefix=SET1 %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBARewrite%shlibext -passes="mba-rewrite" -mba-rewrite-identities=add-or-and,sub-and-not,xor-or-and,or-and-not,and-or-xor -S %s \
+; RUN:  | FileCheck --check-prefix=SET1 %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBARewrite%shlibext -passes="mba-rewrite" -mba-rewrite-identities=add-xor-and,sub-xor-and,xor-or-nand,or-xor-and,and-add-or -S %s \
+; RUN:  | FileCheck --check-prefix=SET2 %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBARewrite%shlibext -passes="mba-rewrite" -mba-rewrite-ratio=0 -S %s \
+; RUN:  | FileCheck --check-prefix=NONE %s
+; RUN: not opt -load-pass-plugin=%shlibdir/libMBARewrite%shlibext -passes="mba-rewrite" -mba-rewrite-identities=add-or-and,foo -S %s 2>&1 \
+; RUN:  | FileCheck --check-prefix=ERROR %s
+
+; Verify that MBARewrite rewrites all the supported opcodes (in one pass)
+; using the selected identities, e.g. (SET1):
+;    a + b == (a | b) + (a & b)
+;    a - b == (a & ~b) - (~a & b)
+;    a ^ b == (a | b) - (a & b)
+;    a | b == (a & ~b) + b
+;    a & b == (a | b) - (a ^ b)
+; and that rewritten values are used by the rewrites of their users.
+
+define i32 @ops(i32 %a, i32 %b) {
+  %add = add i32 %a, %b
+  %sub = sub i32 %add, %b
+  %xor = xor i32 %sub, %a
+  %or = or i32 %xor, %b
+  %and = and i32 %or, %a
+  ret i32 %and
+}
+
+; SET1-LABEL: @ops
+; SET1-NEXT:  [[OR1:%[0-9]+]] = or i32 %a, %b
+; SET1-NEXT:  [[AND1:%[0-9]+]] = and i32 %a, %b
+; SET1-NEXT:  %add = add i32 [[OR1]], [[AND1]]
+; SET1-NEXT:  [[NOT1:%[0-9]+]] = xor i32 %b, -1
+; SET1-NEXT:  [[AND2:%[0-9]+]] = and i32 %add, [[NOT1]]
+; SET1-NEXT:  [[NOT2:%[0-9]+]] = xor i32 %add, -1
+; SET1-NEXT:  [[AND3:%[0-9]+]] = and i32 [[NOT2]], %b
+; SET1-NEXT:  %sub = sub i32 [[AND2]], [[AND3]]
+; SET1-NEXT:  [[OR2:%[0-9]+]] = or i32 %sub, %a
+; SET1-NEXT:  [[AND4:%[0-9]+]] = and i32 %sub, %a
+; SET1-NEXT:  %xor = sub i32 [[OR2]], [[AND4]]
+; SET1-NEXT:  [[NOT3:%[0-9]+]] = xor i32 %b, -1
+; SET1-NEXT:  [[AND5:%[0-9]+]] = and i32 %xor, [[NOT3]]
+; SET1-NEXT:  %or = add i32 [[AND5]], %b
+; SET1-NEXT:  [[OR3:%[0-9]+]] = or i32 %or, %a
+; SET1-NEXT:  [[XOR1:%[0-9]+]] = xor i32 %or, %a
+; SET1-NEXT:  %and = sub i32 [[OR3]], [[XOR1]]
+; SET1-NEXT:  ret i32 %and
+
+; SET2-LABEL: @ops
+; SET2-NEXT:  [[XOR1:%[0-9]+]] = xor i32 %a, %b
+; SET2-NEXT:  [[AND1:%[0-9]+]] = and i32 %a, %b
+; SET2-NEXT:  [[MUL1:%[0-9]+]] = mul i32 2, [[AND1]]
+; SET2-NEXT:  %add = add i32 [[XOR1]], [[MUL1]]
+; SET2-NEXT:  [[NEG:%[0-9]+]] = sub i32 0, %b
+; SET2-NEXT:  [[XOR2:%[0-9]+]] = xor i32 %add, [[NEG]]
+; SET2-NEXT:  [[AND2:%[0-9]+]] = and i32 %add, [[NEG]]
+; SET2-NEXT:  [[MUL2:%[0-9]+]] = mul i32 2, [[AND2]]
+; SET2-NEXT:  %sub = add i32 [[XOR2]], [[MUL2]]
+; SET2-NEXT:  [[OR1:%[0-9]+]] = or i32 %sub, %a
+; SET2-NEXT:  [[AND3:%[0-9]+]] = and i32 %sub, %a
+; SET2-NEXT:  [[NAND:%[0-9]+]] = xor i32 [[AND3]], -1
+; SET2-NEXT:  %xor = and i32 [[OR1]], [[NAND]]
+; SET2-NEXT:  [[XOR3:%[0-9]+]] = xor i32 %xor, %b
+; SET2-NEXT:  [[AND4:%[0-9]+]] = and i32 %xor, %b
+; SET2-NEXT:  %or = add i32 [[XOR3]], [[AND4]]
+; SET2-NEXT:  [[ADD:%[0-9]+]] = add i32 %or, %a
+; SET2-NEXT:  [[OR2:%[0-9]+]] = or i32 %or, %a
+; SET2-NEXT:  %and = sub i32 [[ADD]], [[OR2]]
+; SET2-NEXT:  ret i32 %and
+
+; NONE-LABEL: @ops
+; NONE-NEXT:  %add = add i32 %a, %b
+; NONE-NEXT:  %sub = sub i32 %add, %b
+; NONE-NEXT:  %xor = xor i32 %sub, %a
+; NONE-NEXT:  %or = or i32 %xor, %b
+; NONE-NEXT:  %and = and i32 %or, %a
+; NONE-NEXT:  ret i32 %and
+
+; ERROR: for the --mba-rewrite-identities option: 'foo' is not a known MBA identity
@@ -0,0 +1,97 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext -passes="mba-add" -S %s \
+; RUN:  | opt -load-pass-plugin=%shlibdir/libMBASimplify%shlibext -passes="mba-simplify" -S \
+; RUN:  | FileCheck --check-prefix=ADD %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBASub%shlibext -passes="mba-sub" -S %s \
+; RUN:  | opt -load-pass-plugin=%shlibdir/libMBASimplify%shlibext -passes="mba-simplify" -S \
+; RUN:  | FileCheck --check-prefix=SUB %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBARewrite%shlibext -passes="mba-rewrite" -S %s \
+; RUN:  | opt --enable-new-pm=0 -load %shlibdir/libMBASimplify%shlibext -legacy-mba-simplify -S \
+; RUN:  | FileCheck --check-prefix=REWRITE %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBASimplify%shlibext -passes="mba-simplify" -S %s \
+; RUN:  | FileCheck --check-prefix=PLAIN %s
+
+; Verify that MBASimplify undoes the substitutions made by MBAAdd, MBASub and
+; MBARewrite, and that it leaves plain code alone. Note that @ops as a whole is
+; a linear MBA expression of %a and %b:
+;    ((((a + b) - b) ^ a) | b) & a == a & b
+; so it's folded into a single instruction. In @shared, every sub-expression
+; of %res is used elsewhere, so replacing it with a + b + 1 would add
+; instructions. In @partially_shared, only %or is kept.
+
+define i8 @add8(i8 %a, i8 %b) {
+  %r = add i8 %a, %b
+  ret i8 %r
+}
+
+define i32 @ops(i32 %a, i32 %b) {
+  %add = add i32 %a, %b
+  %sub = sub i32 %add, %b
+  %xor = xor i32 %sub, %a
+  %or = or i32 %xor, %b
+  %and = and i32 %or, %a
+  ret i32 %and
+}
+
+define i32 @plain(i32 %a, i32 %b, i32 %c) {
+  %mul = mul i32 %a, %b
+  %add = add i32 %mul, %c
+  %and = and i32 %add, 255
+  %shl = shl i32 %a, 3
+  %sub = sub i32 %and, %shl
+  ret i32 %sub
+}
+
+declare void @use(i32)
+
+define i32 @shared(i32 %a, i32 %b) {
+  %or = or i32 %a, %b
+  %and = and i32 %a, %b
+  %sum = add i32 %or, %and
+  %res = add i32 %sum, 1
+  call void @use(i32 %or)
+  call void @use(i32 %and)
+  call void @use(i32 %sum)
+  ret i32 %res
+}
+
+define i32 @partially_shared(i32 %a, i32 %b) {
+  %or = or i32 %a, %b
+  %and = and i32 %a, %b
+  %sum = add i32 %or, %and
+  call void @use(i32 %or)
+  ret i32 %sum
+}
+
+; ADD-LABEL: @add8
+; ADD-NEXT:  %r = add i8 %a, %b
+; ADD-NEXT:  ret i8 %r
+
+; SUB-LABEL: @ops
+; SUB-NEXT:  %and = and i32 %a, %b
+; SUB-NEXT:  ret i32 %and
+
+; REWRITE-LABEL: @add8
+; REWRITE-NEXT:  %r = add i8 %a, %b
+; REWRITE-NEXT:  ret i8 %r
+; REWRITE-LABEL: @ops
+; REWRITE-NEXT:  %and = and i32 %a, %b
+; REWRITE-NEXT:  ret i32 %and
+
+; PLAIN-LABEL: @plain
+; PLAIN-NEXT:  %mul = mul i32 %a, %b
+; PLAIN-NEXT:  %add = add i32 %mul, %c
+; PLAIN-NEXT:  %and = and i32 %add, 255
+; PLAIN-NEXT:  %shl = shl i32 %a, 3
+; PLAIN-NEXT:  %sub = sub i32 %and, %shl
+; PLAIN-NEXT:  ret i32 %sub
+
+; PLAIN-LABEL: @shared
+; PLAIN-NEXT:  %or = or i32 %a, %b
+; PLAIN-NEXT:  %and = and i32 %a, %b
+; PLAIN-NEXT:  %sum = add i32 %or, %and
+; PLAIN-NEXT:  %res = add i32 %sum, 1
+; PLAIN-LABEL: @partially_shared
+; PLAIN-NEXT:  %or = or i32 %a, %b
+; PLAIN-NEXT:  %sum = add i32 %a, %b
+; PLAIN-NEXT:  call void @use(i32 %or)
+; PLAIN-NEXT:  ret i32 %sum
@@ -0,0 +1,143 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMergeBB%shlibext -legacy-merge-bb -S %s | FileCheck  %s
+; RUN: opt -load-pass-plugin %shlibdir/libMergeBB%shlibext -passes=merge-bb -S %s | FileCheck  %s
+
+; Verify that MergeBB:
+;   * re-visits blocks that become identical once other blocks are merged,
+;   * supports successors with multiple PHI nodes,
+;   * merges blocks with values that are used within the block.
+
+; %p and %q become identical only after %b1 has been merged into %b2. Note
+; that %p is visited before %b1.
+define i32 @fixpoint(i32 %x) {
+entry:
+  switch i32 %x, label %exit [
+    i32 1, label %p
+    i32 2, label %q
+  ]
+
+p:
+  br label %b1
+
+q:
+  br label %b2
+
+b1:
+  br label %exit
+
+b2:
+  br label %exit
+
+exit:
+  %r = phi i32 [ 0, %entry ], [ 1, %b1 ], [ 1, %b2 ]
+  ret i32 %r
+}
+
+; CHECK-LABEL: @fixpoint
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    switch i32 %x, label %exit [
+; CHECK-NEXT:      i32 1, label %q
+; CHECK-NEXT:      i32 2, label %q
+; CHECK-NEXT:    ]
+; CHECK-NOT:   {{^}}p:
+; CHECK:       q:
+; CHECK-NEXT:    br label %b2
+; CHECK-NOT:   b1:
+; CHECK:       b2:
+; CHECK-NEXT:    br label %exit
+; CHECK:       exit:
+; CHECK-NEXT:    %r = phi i32 [ 0, %entry ], [ 1, %b2 ]
+
+; Two PHI nodes that receive the corresponding values from %m1 and %m2
+define i32 @multi_phi(i1 %c, i32 %y) {
+entry:
+  br i1 %c, label %m1, label %m2
+
+m1:
+  %x1 = add i32 %y, 1
+  %z1 = mul i32 %y, 3
+  br label %exit
+
+m2:
+  %x2 = add i32 %y, 1
+  %z2 = mul i32 %y, 3
+  br label %exit
+
+exit:
+  %r1 = phi i32 [ %x1, %m1 ], [ %x2, %m2 ]
+  %r2 = phi i32 [ %z1, %m1 ], [ %z2, %m2 ]
+  %r = sub i32 %r1, %r2
+  ret i32 %r
+}
+
+; CHECK-LABEL: @multi_phi
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    br i1 %c, label %m2, label %m2
+; CHECK-NOT:   m1:
+; CHECK:       m2:
+; CHECK:       exit:
+; CHECK-NEXT:    %r = sub i32 %x2, %z2
+
+; The blocks are identical, but the values that they define reach the PHI
+; nodes in a different order, so they can't be merged
+define i32 @multi_phi_swapped(i1 %c, i32 %y) {
+entry:
+  br i1 %c, label %s1, label %s2
+
+s1:
+  %x1 = add i32 %y, 1
+  %z1 = add i32 %y, 1
+  br label %exit
+
+s2:
+  %x2 = add i32 %y, 1
+  %z2 = add i32 %y, 1
+  br label %exit
+
+exit:
+  %r1 = phi i32 [ %x1, %s1 ], [ %z2, %s2 ]
+  %r2 = phi i32 [ %z1, %s1 ], [ %x2, %s2 ]
+  %r = sub i32 %r1, %r2
+  ret i32 %r
+}
+
+; CHECK-LABEL: @multi_phi_swapped
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    br i1 %c, label %s1, label %s2
+; CHECK:       s1:
+; CHECK:       s2:
+; CHECK:       exit:
+; CHECK-NEXT:    %r1 = phi i32 [ %x1, %s1 ], [ %z2, %s2 ]
+; CHECK-NEXT:    %r2 = phi i32 [ %z1, %s1 ], [ %x2, %s2 ]
+
+; Values used within the block (i.e. with multiple uses) are compared by
+; position, so clones (e.g. created by DuplicateBB) are merged
+define i32 @local_chain(i1 %c, i32 %y) {
+entry:
+  br i1 %c, label %l1, label %l2
+
+l1:
+  %x1 = add i32 %y, 1
+  %z1 = mul i32 %x1, %x1
+  br label %exit
+
+l2:
+  %x2 = add i32 %y, 1
+  %z2 = mul i32 %x2, %x2
+  br label %exit
+
+exit:
+  %r1 = phi i32 [ %x1, %l1 ], [ %x2, %l2 ]
+  %r2 = phi i32 [ %z1, %l1 ], [ %z2, %l2 ]
+  %r = sub i32 %r1, %r2
+  ret i32 %r
+}
+
+; CHECK-LABEL: @local_chain
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    br i1 %c, label %l2, label %l2
+; CHECK-NOT:   l1:
+; CHECK:       l2:
+; CHECK-NEXT:    %x2 = add i32 %y, 1
+; CHECK-NEXT:    %z2 = mul i32 %x2, %x2
+; CHECK:       exit:
+; CHECK-NEXT:    %r = sub i32 %x2, %z2
@@ -0,0 +1,70 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMergeBB%shlibext -legacy-merge-bb -S %s | FileCheck  %s
+; RUN: opt -load-pass-plugin %shlibdir/libMergeBB%shlibext -passes=merge-bb -S %s | FileCheck  %s
+
+; Blocks are only compared against blocks with the same structural hash.
+; Verify that:
+;   * identical blocks are merged (%c1 into %c2, %b1 into %b2)
+;   * blocks that differ only in operands are not merged (%c3)
+;   * blocks are re-hashed when their successor changes: once %b1 has been
+;     merged into %b2, %p (previously branching to %b1) is identical to %q
+
+define i32 @foo(i32 %x, i32 %y) {
+entry:
+  switch i32 %x, label %exit [
+    i32 1, label %c1
+    i32 2, label %c2
+    i32 3, label %c3
+    i32 4, label %p
+    i32 5, label %q
+  ]
+
+c1:
+  %a1 = add i32 %y, 1
+  br label %exit
+
+c2:
+  %a2 = add i32 %y, 1
+  br label %exit
+
+c3:
+  %a3 = add i32 %y, 2
+  br label %exit
+
+b1:
+  br label %exit
+
+b2:
+  br label %exit
+
+p:
+  br label %b1
+
+q:
+  br label %b2
+
+exit:
+  %r = phi i32 [ 0, %entry ], [ %a1, %c1 ], [ %a2, %c2 ], [ %a3, %c3 ], [ 0, %b1 ], [ 0, %b2 ]
+  ret i32 %r
+}
+
+; CHECK-LABEL: @foo
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    switch i32 %x, label %exit [
+; CHECK-NEXT:      i32 1, label %c2
+; CHECK-NEXT:      i32 2, label %c2
+; CHECK-NEXT:      i32 3, label %c3
+; CHECK-NEXT:      i32 4, label %q
+; CHECK-NEXT:      i32 5, label %q
+; CHECK-NEXT:    ]
+; CHECK-NOT:   c1:
+; CHECK:       c2:
+; CHECK-NEXT:    %a2 = add i32 %y, 1
+; CHECK:       c3:
+; CHECK-NEXT:    %a3 = add i32 %y, 2
+; CHECK-NOT:   b1:
+; CHECK:       b2:
+; CHECK-NOT:   {{^}}p:
+; CHECK:       q:
+; CHECK-NEXT:    br label %b2
+; CHECK:       exit:
+; CHECK-NEXT:    %r = phi i32 [ 0, %entry ], [ %a2, %c2 ], [ %a3, %c3 ], [ 0, %b2 ]
@@ -0,0 +1,148 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMergeFunctions%shlibext -legacy-merge-functions -S %s | FileCheck  %s
+; RUN: opt -load-pass-plugin %shlibdir/libMergeFunctions%shlibext -passes=merge-functions -S %s | FileCheck  %s
+
+; Verify that:
+;   * identical functions are folded, depending on their linkage into:
+;       - the kept function (@internal_dup is erased)
+;       - an alias (@unnamed_dup)
+;       - a thunk (@external_dup, direct calls go to @add)
+;   * functions that differ only in a constant are kept (@add_two)
+;   * functions that differ only in poison-generating flags or in metadata
+;     are kept (@add_nsw, @load_range)
+;   * identical recursive functions are folded (@fact_dup)
+;   * functions calling folded functions are folded too (@caller_dup)
+
+; CHECK: @unnamed_dup = unnamed_addr alias {{.*}} @add
+
+define i32 @add(i32 %a, i32 %b) {
+  %c = add i32 %a, %b
+  %d = mul i32 %c, 3
+  ret i32 %d
+}
+
+; CHECK-NOT: define internal i32 @internal_dup
+define internal i32 @internal_dup(i32 %x, i32 %y) {
+  %c = add i32 %x, %y
+  %d = mul i32 %c, 3
+  ret i32 %d
+}
+
+define i32 @unnamed_dup(i32 %a, i32 %b) unnamed_addr {
+  %c = add i32 %a, %b
+  %d = mul i32 %c, 3
+  ret i32 %d
+}
+
+; CHECK-LABEL: define i32 @external_dup(i32 %0, i32 %1) {
+; CHECK-NEXT:    %3 = tail call i32 @add(i32 %0, i32 %1)
+; CHECK-NEXT:    ret i32 %3
+define i32 @external_dup(i32 %a, i32 %b) {
+  %c = add i32 %a, %b
+  %d = mul i32 %c, 3
+  ret i32 %d
+}
+
+; CHECK-LABEL: define i32 @add_two(
+; CHECK-NEXT:    %c = add i32 %a, %b
+; CHECK-NEXT:    %d = mul i32 %c, 2
+define i32 @add_two(i32 %a, i32 %b) {
+  %c = add i32 %a, %b
+  %d = mul i32 %c, 2
+  ret i32 %d
+}
+
+; CHECK-LABEL: define i32 @add_nsw(
+; CHECK-NEXT:    %c = add nsw i32 %a, %b
+define i32 @add_nsw(i32 %a, i32 %b) {
+  %c = add nsw i32 %a, %b
+  %d = mul i32 %c, 3
+  ret i32 %d
+}
+
+; CHECK-LABEL: define i32 @load(
+; CHECK-NEXT:    %v = load i32, ptr %p, align 4
+define i32 @load(ptr %p) {
+  %v = load i32, ptr %p, align 4
+  ret i32 %v
+}
+
+; CHECK-LABEL: define i32 @load_range(
+; CHECK-NEXT:    %v = load i32, ptr %p, align 4, !range !0
+define i32 @load_range(ptr %p) {
+  %v = load i32, ptr %p, align 4, !range !0
+  ret i32 %v
+}
+
+; CHECK-LABEL: define internal i32 @fact(
+define internal i32 @fact(i32 %n) {
+entry:
+  %cmp = icmp eq i32 %n, 0
+  br i1 %cmp, label %exit, label %rec
+
+rec:
+  %m = sub i32 %n, 1
+  %r = call i32 @fact(i32 %m)
+  %p = mul i32 %n, %r
+  br label %exit
+
+exit:
+  %res = phi i32 [ 1, %entry ], [ %p, %rec ]
+  ret i32 %res
+}
+
+; CHECK-NOT: define internal i32 @fact_dup
+define internal i32 @fact_dup(i32 %n) {
+entry:
+  %cmp = icmp eq i32 %n, 0
+  br i1 %cmp, label %exit, label %rec
+
+rec:
+  %m = sub i32 %n, 1
+  %r = call i32 @fact_dup(i32 %m)
+  %p = mul i32 %n, %r
+  br label %exit
+
+exit:
+  %res = phi i32 [ 1, %entry ], [ %p, %rec ]
+  ret i32 %res
+}
+
+; CHECK-LABEL: define internal i32 @caller(
+define internal i32 @caller(i32 %n) {
+  %r = call i32 @fact(i32 %n)
+  ret i32 %r
+}
+
+; CHECK-NOT: define internal i32 @caller_dup
+define internal i32 @caller_dup(i32 %n) {
+  %r = call i32 @fact_dup(i32 %n)
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @main(
+; CHECK-NEXT:    %1 = call i32 @add(i32 1, i32 2)
+; CHECK-NEXT:    %2 = call i32 @unnamed_dup(i32 1, i32 2)
+; CHECK-NEXT:    %3 = call i32 @add(i32 1, i32 2)
+; CHECK-NEXT:    %4 = call i32 @add_two(i32 1, i32 2)
+; CHECK-NEXT:    %5 = call i32 @caller(i32 5)
+; CHECK-NEXT:    %6 = call i32 @caller(i32 5)
+; CHECK-NEXT:    %7 = ptrtoint ptr @external_dup to i64
+define i32 @main() {
+  %1 = call i32 @internal_dup(i32 1, i32 2)
+  %2 = call i32 @unnamed_dup(i32 1, i32 2)
+  %3 = call i32 @external_dup(i32 1, i32 2)
+  %4 = call i32 @add_two(i32 1, i32 2)
+  %5 = call i32 @caller(i32 5)
+  %6 = call i32 @caller_dup(i32 5)
+  %7 = ptrtoint ptr @external_dup to i64
+  %8 = trunc i64 %7 to i32
+  %9 = add i32 %1, %2
+  %10 = add i32 %9, %3
+  %11 = add i32 %10, %4
+  %12 = add i32 %11, %5
+  %13 = add i32 %12, %6
+  %14 = add i32 %13, %8
+  ret i32 %14
+}
+
+!0 = !{i32 0, i32 10}
@@ -17,11 +17,11 @@
 ; CHECK-NEXT: call                 1
 
 ; CHECK-LABEL: main
-; CHECK: load                 2
+; CHECK: ret                  1
 ; CHECK-NEXT: br                   4
-; CHECK-NEXT: icmp                 1
 ; CHECK-NEXT: add                  1
-; CHECK-NEXT: ret                  1
 ; CHECK-NEXT: alloca               2
+; CHECK-NEXT: load                 2
 ; CHECK-NEXT: store                4
+; CHECK-NEXT: icmp                 1
 ; CHECK-NEXT: call                 4
@@ -0,0 +1,52 @@
+; RUN: opt -load-pass-plugin %shlibdir/libOpcodeCounter%shlibext -passes="print<opcode-histogram>" -disable-output %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefixes=OPT,CHECK
+; RUN: opt -load-pass-plugin %shlibdir/libOpcodeCounter%shlibext -passes="print<opcode-histogram>" -opcode-histogram-threads=3 -disable-output %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefixes=OPT,CHECK
+; RUN: opt -load-pass-plugin %shlibdir/libOpcodeCounter%shlibext -passes="print<opcode-histogram>" -opcode-counter-format=jsonl -disable-output %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=JSONL
+
+; Across modules (via static)
+; RUN: opt %S/Inputs/CallCounterInput.ll -o %t.bc
+; RUN: ../bin/static -opcode-histogram %S/Inputs/CallCounterInput.ll 2>&1 | FileCheck %s
+; RUN: ../bin/static -opcode-histogram -opcode-histogram-threads=3 -j=2 %t.bc %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=TWICE
+; RUN: ../bin/static -opcode-histogram -lazy %t.bc %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=TWICE
+
+; Test the opcode histogram for the whole module (i.e. summed over all
+; functions) and for multiple modules.
+
+; OPT: Printing analysis 'OpcodeHistogram Pass' for module
+; CHECK: OPCODE               #TIMES USED
+; CHECK-NEXT: ---
+; CHECK-NEXT: ret                  4
+; CHECK-NEXT: br                   4
+; CHECK-NEXT: add                  1
+; CHECK-NEXT: alloca               2
+; CHECK-NEXT: load                 2
+; CHECK-NEXT: store                4
+; CHECK-NEXT: icmp                 1
+; CHECK-NEXT: call                 6
+; CHECK-NEXT: ---
+
+; JSONL: {"opcode":"ret","count":4}
+; JSONL-NEXT: {"opcode":"br","count":4}
+; JSONL-NEXT: {"opcode":"add","count":1}
+; JSONL-NEXT: {"opcode":"alloca","count":2}
+; JSONL-NEXT: {"opcode":"load","count":2}
+; JSONL-NEXT: {"opcode":"store","count":4}
+; JSONL-NEXT: {"opcode":"icmp","count":1}
+; JSONL-NEXT: {"opcode":"call","count":6}
+; JSONL-NOT: {{.}}
+
+; TWICE: OPCODE               #TIMES USED
+; TWICE-NEXT: ---
+; TWICE-NEXT: ret                  8
+; TWICE-NEXT: br                   8
+; TWICE-NEXT: add                  2
+; TWICE-NEXT: alloca               4
+; TWICE-NEXT: load                 4
+; TWICE-NEXT: store                8
+; TWICE-NEXT: icmp                 2
+; TWICE-NEXT: call                 12
+; TWICE-NEXT: ---
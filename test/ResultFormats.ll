@@ -0,0 +1,62 @@
+; RUN: opt -load-pass-plugin %shlibdir/libStaticCallCounter%shlibext -passes="print<static-cc>" -static-cc-format=jsonl -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=STATIC-JSONL
+; RUN: ../bin/static -static-cc-format=csv %s 2>&1 | FileCheck %s --check-prefix=STATIC-CSV
+; RUN: opt -load-pass-plugin %shlibdir/libOpcodeCounter%shlibext -passes="print<opcode-counter>" -opcode-counter-format=csv -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=OPCODE-CSV
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -passes="print<riv>" -riv-format=jsonl -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=RIV-JSONL
+; RUN: opt -load-pass-plugin %shlibdir/libFindFCmpEq%shlibext -passes="print<find-fcmp-eq>" -find-fcmp-eq-format=csv -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=FCMP-CSV
+
+; Verify the machine-readable output of the analysis printers. Function names
+; (and instructions) are escaped, so that names with quotes, commas or
+; backslashes don't break the output.
+
+; STATIC-JSONL: {"function":"odd\"name,with\\escapes","calls":2}
+; STATIC-JSONL-NEXT: {"function":"compare","calls":1}
+; STATIC-JSONL-NOT: {{.}}
+
+; STATIC-CSV: function,calls
+; STATIC-CSV-NEXT: "odd""name,with\escapes",2
+; STATIC-CSV-NEXT: "compare",1
+; STATIC-CSV-NOT: {{.}}
+
+; The header is printed once (rather than once per function)
+; OPCODE-CSV: function,opcode,count
+; OPCODE-CSV-NEXT: "odd""name,with\escapes","ret",1
+; OPCODE-CSV-NEXT: "compare","ret",1
+; OPCODE-CSV-NEXT: "compare","fcmp",1
+; OPCODE-CSV-NEXT: "main","ret",1
+; OPCODE-CSV-NEXT: "main","br",1
+; OPCODE-CSV-NEXT: "main","zext",1
+; OPCODE-CSV-NEXT: "main","call",3
+; OPCODE-CSV-NOT: {{.}}
+
+; RIV-JSONL: {"function":"main","block":"%entry","value":"i32 %n"}
+; RIV-JSONL-NEXT: {"function":"main","block":"%exit","value":"i1 %cmp"}
+; RIV-JSONL-NEXT: {"function":"main","block":"%exit","value":"i32 %n"}
+
+; FCMP-CSV: function,instruction
+; FCMP-CSV-NEXT: "compare","%cmp = fcmp oeq double %a, %b"
+; FCMP-CSV-NOT: {{.}}
+
+define void @"odd\22name,with\5Cescapes"() {
+  ret void
+}
+
+define i1 @compare(double %a, double %b) {
+  %cmp = fcmp oeq double %a, %b
+  ret i1 %cmp
+}
+
+define i32 @main(i32 %n) {
+entry:
+  call void @"odd\22name,with\5Cescapes"()
+  call void @"odd\22name,with\5Cescapes"()
+  %cmp = call i1 @compare(double 1.0, double 2.0)
+  br label %exit
+
+exit:
+  %res = zext i1 %cmp to i32
+  ret i32 %res
+}
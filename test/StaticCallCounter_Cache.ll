@@ -0,0 +1,42 @@
+; The first run populates the cache ...
+; RUN: rm -rf %t.cache && mkdir %t.cache
+; RUN: ../bin/static -static-cc-cache-dir=%t.cache %s 2>&1 | FileCheck %s
+; RUN: ls %t.cache | FileCheck %s --check-prefix=ENTRY
+; ... and the second run reads the results from it (replace the cached results
+; to verify that)
+; RUN: echo "42 3 foo" > %t.fake
+; RUN: cp %t.fake %t.cache/llvmcache-static-cc-v1-*
+; RUN: ../bin/static -static-cc-cache-dir=%t.cache %s 2>&1 | FileCheck %s --check-prefix=CACHED
+; RUN: ../bin/static -static-cc-cache-dir=%t.cache -lazy %s 2>&1 | FileCheck %s --check-prefix=CACHED
+
+; Corrupted entries are ignored
+; RUN: echo "corrupted" > %t.fake
+; RUN: cp %t.fake %t.cache/llvmcache-static-cc-v1-*
+; RUN: ../bin/static -static-cc-cache-dir=%t.cache %s 2>&1 | FileCheck %s
+
+; Entries are evicted once the cache is too large
+; RUN: rm -rf %t.small.cache && mkdir %t.small.cache
+; RUN: ../bin/static -static-cc-cache-dir=%t.small.cache -static-cc-cache-limit=1 %s 2>&1 | FileCheck %s
+; RUN: ls %t.small.cache | FileCheck %s --allow-empty --check-prefix=EVICTED
+
+; Test the cache of StaticCallCounter results (used by static).
+
+; CHECK: foo                  2
+; CHECK-NEXT: bar                  1
+
+; ENTRY: llvmcache-static-cc-v1-{{[0-9a-f]{40}$}}
+
+; CACHED: foo                  42
+; CACHED-NOT: bar
+
+; EVICTED-NOT: llvmcache-static-cc-v1-
+
+declare void @foo()
+declare void @bar()
+
+define void @main() {
+  call void @foo()
+  call void @bar()
+  call void @foo()
+  ret void
+}
@@ -0,0 +1,37 @@
+; RUN:  opt -load-pass-plugin %shlibdir/libRIV%shlibext -passes="print<riv>" -riv-verify -disable-output %s 2>&1 | FileCheck %s
+
+; Verifies the RIV queries, ValueSet::contains() and ValueSet::size(), against
+; the dominator tree (see -riv-verify) for every block in @foo. That covers:
+;   * integer and non-integer globals (the type of both is ptr),
+;   * integer and non-integer arguments,
+;   * instructions from dominating blocks (%entry for all other blocks),
+;   * instructions from non-dominating blocks (%if.then and %if.else for each
+;     other and for %if.end), and from the queried block itself.
+
+@int_global = global i32 123
+@float_global = global float 1.0
+
+define i32 @foo(i32 %a, float %x) {
+entry:
+  %add = add nsw i32 %a, 123
+  %cmp = icmp sgt i32 %a, 0
+  br i1 %cmp, label %if.then, label %if.else
+
+if.then:
+  %mul = mul nsw i32 %add, %a
+  br label %if.end
+
+if.else:
+  %conv = fptosi float %x to i32
+  %sub = sub nsw i32 %add, %conv
+  br label %if.end
+
+if.end:
+  %res = phi i32 [ %mul, %if.then ], [ %sub, %if.else ]
+  %g = load i32, ptr @int_global
+  %sum = add i32 %res, %g
+  ret i32 %sum
+}
+
+; CHECK-NOT: RIV mismatch
+; CHECK: RIV verification of foo: 0 mismatch(es)
@@ -0,0 +1,83 @@
+; RUN:  opt -load-pass-plugin %shlibdir/libRIV%shlibext -passes="print<riv>" -disable-output %s 2>&1 | FileCheck %s
+
+; Verifies the RIV results for blocks with many reachable values. The values
+; are always listed in the same order: the values defined in the closest
+; dominator first, then global variables and input arguments. Blocks that are
+; not reachable from the entry block have no reachable values (and are not
+; printed).
+
+@g = global i64 0
+
+define i32 @foo(i32 %a, i8 %b) {
+entry:
+  %e1 = add i32 %a, 1
+  %e2 = add i32 %a, 2
+  %e3 = add i32 %a, 3
+  %e4 = add i32 %a, 4
+  %c = icmp eq i32 %e4, 0
+  br i1 %c, label %left, label %right
+
+left:
+  %l1 = mul i32 %e1, %e2
+  %l2 = mul i32 %l1, %e3
+  %f = fadd float 0.0, 1.0
+  br label %join
+
+right:
+  %r1 = sub i32 %e1, %e2
+  br label %join
+
+join:
+  %p = phi i32 [ %l2, %left ], [ %r1, %right ]
+  br label %exit
+
+exit:
+  ret i32 %p
+
+dead:
+  %d = add i32 %a, 5
+  br label %exit
+}
+
+; CHECK-LABEL: BB %entry
+; CHECK-NEXT:    @g = global i64 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:    i8 %b
+; CHECK-NEXT:  BB %left
+; CHECK-NEXT:    %e1 = add i32 %a, 1
+; CHECK-NEXT:    %e2 = add i32 %a, 2
+; CHECK-NEXT:    %e3 = add i32 %a, 3
+; CHECK-NEXT:    %e4 = add i32 %a, 4
+; CHECK-NEXT:    %c = icmp eq i32 %e4, 0
+; CHECK-NEXT:    @g = global i64 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:    i8 %b
+; CHECK-NEXT:  BB %join
+; CHECK-NEXT:    %e1 = add i32 %a, 1
+; CHECK-NEXT:    %e2 = add i32 %a, 2
+; CHECK-NEXT:    %e3 = add i32 %a, 3
+; CHECK-NEXT:    %e4 = add i32 %a, 4
+; CHECK-NEXT:    %c = icmp eq i32 %e4, 0
+; CHECK-NEXT:    @g = global i64 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:    i8 %b
+; CHECK-NEXT:  BB %right
+; CHECK-NEXT:    %e1 = add i32 %a, 1
+; CHECK-NEXT:    %e2 = add i32 %a, 2
+; CHECK-NEXT:    %e3 = add i32 %a, 3
+; CHECK-NEXT:    %e4 = add i32 %a, 4
+; CHECK-NEXT:    %c = icmp eq i32 %e4, 0
+; CHECK-NEXT:    @g = global i64 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:    i8 %b
+; CHECK-NEXT:  BB %exit
+; CHECK-NEXT:    %p = phi i32 [ %l2, %left ], [ %r1, %right ]
+; CHECK-NEXT:    %e1 = add i32 %a, 1
+; CHECK-NEXT:    %e2 = add i32 %a, 2
+; CHECK-NEXT:    %e3 = add i32 %a, 3
+; CHECK-NEXT:    %e4 = add i32 %a, 4
+; CHECK-NEXT:    %c = icmp eq i32 %e4, 0
+; CHECK-NEXT:    @g = global i64 0
+; CHECK-NEXT:    i32 %a
+; CHECK-NEXT:    i8 %b
+; CHECK-NOT:   BB %dead
@@ -0,0 +1,73 @@
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libMBAAdd%shlibext -legacy-mba-add -mba-ratio=0.5 -rng-seed=42 -S %s -o %t.mba.legacy
+; RUN: opt -load-pass-plugin %shlibdir/libMBAAdd%shlibext -passes=mba-add -mba-ratio=0.5 -rng-seed=42 -S %s -o %t.mba.1
+; RUN: opt -load-pass-plugin %shlibdir/libMBAAdd%shlibext -passes=mba-add -mba-ratio=0.5 -rng-seed=42 -S %s -o %t.mba.2
+; RUN: diff %t.mba.1 %t.mba.2
+; RUN: diff %t.mba.legacy %t.mba.1
+; RUN: FileCheck --check-prefix=MBA %s < %t.mba.1
+; RUN: opt -load-pass-plugin %shlibdir/libMBAAdd%shlibext -passes=mba-add -mba-ratio=0.5 -rng-seed=7 -S %s -o %t.mba.seed7
+; RUN: not diff %t.mba.1 %t.mba.seed7
+; RUN: FileCheck --check-prefix=MBA-SEED7 %s < %t.mba.seed7
+
+; RUN: opt --enable-new-pm=0 -load %shlibdir/libRIV%shlibext -load %shlibdir/libDuplicateBB%shlibext -legacy-duplicate-bb -rng-seed=42 -S %s -o %t.dup.legacy
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes=duplicate-bb -rng-seed=42 -S %s -o %t.dup.1
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes=duplicate-bb -rng-seed=42 -S %s -o %t.dup.2
+; RUN: diff %t.dup.1 %t.dup.2
+; RUN: diff %t.dup.legacy %t.dup.1
+; RUN: opt -load-pass-plugin %shlibdir/libRIV%shlibext -load-pass-plugin %shlibdir/libDuplicateBB%shlibext -passes=duplicate-bb -rng-seed=7 -S %s -o %t.dup.seed7
+; RUN: not diff %t.dup.1 %t.dup.seed7
+; RUN: FileCheck --check-prefix=DUP %s < %t.dup.1
+; RUN: FileCheck --check-prefix=DUP %s < %t.dup.seed7
+
+; Verify that, for a fixed seed (-rng-seed), MBAAdd and DuplicateBB make the
+; same random choices in every run and with both pass managers (every
+; function gets its own, deterministic, random stream), and that a different
+; seed leads to different choices. With -mba-ratio=0.5, some of the `add`
+; instructions are substituted (the ones defined as `add i8 111, ...`) and
+; some are kept.
+
+; MBA-LABEL: define i8 @foo
+; MBA:       %s6 = add i8 %s5, %c
+; MBA-LABEL: define i8 @bar
+; MBA:       mul i8 39,
+; MBA:       %s1 = add i8 111,
+; MBA:       %s2 = add i8 %s1, %c
+; MBA:       %s6 = add i8 111,
+
+; MBA-SEED7-LABEL: define i8 @foo
+; MBA-SEED7:       %s4 = add i8 %s3, %a
+; MBA-SEED7:       mul i8 39,
+; MBA-SEED7:       %s5 = add i8 111,
+; MBA-SEED7-LABEL: define i8 @bar
+; MBA-SEED7:       %s1 = add i8 %a, %b
+; MBA-SEED7:       %s2 = add i8 111,
+
+; DUP-LABEL: define i8 @foo
+; DUP:       br i1 {{.*}}, label %lt-clone-1-{{[0-9]+}}, label %lt-clone-2-{{[0-9]+}}
+
+define i8 @foo(i8 %a, i8 %b, i8 %c, i8 %d) {
+entry:
+  %s1 = add i8 %a, %b
+  %s2 = add i8 %s1, %c
+  %s3 = add i8 %s2, %d
+  br label %next
+
+next:
+  %s4 = add i8 %s3, %a
+  %s5 = add i8 %s4, %b
+  %s6 = add i8 %s5, %c
+  ret i8 %s6
+}
+
+define i8 @bar(i8 %a, i8 %b, i8 %c, i8 %d) {
+entry:
+  %s1 = add i8 %a, %b
+  %s2 = add i8 %s1, %c
+  %s3 = add i8 %s2, %d
+  br label %next
+
+next:
+  %s4 = add i8 %s3, %a
+  %s5 = add i8 %s4, %b
+  %s6 = add i8 %s5, %c
+  ret i8 %s6
+}
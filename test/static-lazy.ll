@@ -0,0 +1,15 @@
+; RUN: opt %S/Inputs/CallCounterInput.ll -o %t.bc
+; RUN: ../bin/static -lazy %t.bc 2>&1 | FileCheck %s
+; RUN: ../bin/static -lazy %t.bc %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=TWICE
+
+; Test StaticCallCounter when run via static with lazy loading (for both
+; bitcode and textual IR).
+
+; CHECK: foo                  3
+; CHECK-NEXT: bar                  2
+; CHECK-NEXT: fez                  1
+
+; TWICE: foo                  6
+; TWICE-NEXT: bar                  4
+; TWICE-NEXT: fez                  2
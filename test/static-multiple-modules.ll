@@ -0,0 +1,36 @@
+; RUN: ../bin/static %S/Inputs/CallCounterInput.ll %s 2>&1 | FileCheck %s
+; RUN: ../bin/static -j=1 %S/Inputs/CallCounterInput.ll %s 2>&1 | FileCheck %s
+
+; RUN: echo %S/Inputs/CallCounterInput.ll > %t.list
+; RUN: echo %s >> %t.list
+; RUN: ../bin/static -input-list=%t.list -j=2 2>&1 | FileCheck %s
+; RUN: ../bin/static -input-list=%t.list %S/Inputs/CallCounterInput.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=THREE
+
+; RUN: not ../bin/static %s %t.missing.ll 2>&1 | FileCheck %s --check-prefix=ERR
+
+; Test the static tool with multiple input modules. The results are merged by
+; function name (in the order of the input files).
+
+; CHECK: foo                  5
+; CHECK-NEXT: bar                  2
+; CHECK-NEXT: fez                  1
+; CHECK-NEXT: baz                  1
+
+; THREE: foo                  8
+; THREE-NEXT: bar                  4
+; THREE-NEXT: fez                  2
+; THREE-NEXT: baz                  1
+
+; ERR: Error reading bitcode file: {{.*}}.missing.ll
+; ERR-NOT: LLVM-TUTOR
+
+declare void @foo()
+declare void @baz()
+
+define void @main2() {
+  call void @foo()
+  call void @foo()
+  call void @baz()
+  ret void
+}
@@ -0,0 +1,240 @@
+//========================================================================
+// FILE:
+//    DynamicCCMerge.cpp
+//
+// DESCRIPTION:
+//    A command-line tool that reads binary profiles generated by modules
+//    instrumented with DynamicCallCounter (`-dynamic-cc-output=binary`),
+//    merges them and prints the results. Every profile file can contain any
+//    number of records (e.g. one per run of the instrumented binary). Records
+//    are merged by name, so profiles from different modules can be merged as
+//    well. Profiles of function calls and of basic block executions
+//    (`-dynamic-cc-mode=blocks`) cannot be merged with each other. Unless the
+//    snapshots were taken with `-dynamic-cc-snapshot-delta`, every record
+//    contains the totals since the start of its run, so only the last record
+//    of every run is merged.
+//    Optionally, the merged results are written back as a new profile.
+//
+// USAGE:
+//    # First, generate a profile:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-output=binary <bitcode-file> `\`
+//        -o instrumented.bin
+//      DYNAMIC_CC_PROFILE=run1.prof lli instrumented.bin
+//      DYNAMIC_CC_PROFILE=run2.prof lli instrumented.bin
+//    # Now you can merge the profiles as follows:
+//      <BUILD/DIR>/bin/dynamic-cc-merge [-o merged.prof] run1.prof run2.prof
+//
+// License: MIT
+//========================================================================
+#include "DynamicCallCounter.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cinttypes>
+#include <map>
+#include <optional>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::support;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory MergeCategory{"dynamic-cc-merge options"};
+
+static cl::list<std::string> InputProfiles{cl::Positional,
+                                           cl::desc{"<profile files>"},
+                                           cl::OneOrMore,
+                                           cl::cat{MergeCategory}};
+
+static cl::opt<std::string> OutputProfile{
+    "o", cl::desc{"Write the merged results to this profile file"},
+    cl::value_desc{"filename"}, cl::init(""), cl::cat{MergeCategory}};
+
+//===----------------------------------------------------------------------===//
+// dynamic-cc-merge - implementation
+//===----------------------------------------------------------------------===//
+// Counter name <--> merged count (in the order in which the names were seen)
+using MergedCounters =
+    MapVector<std::string, uint64_t, std::map<std::string, unsigned>>;
+
+struct MergedProfile {
+  // What the merged records count (dynamic_cc::ProfileFlagBlocks or 0), all
+  // records must agree. None until the first record is read.
+  std::optional<uint32_t> Flags;
+  MergedCounters Counters;
+};
+
+// The (name, count) pairs from a single record
+using RecordCounters = std::vector<std::pair<std::string, uint64_t>>;
+
+// Reads all records from Buffer and adds their counters to Profile. The
+// records of every run are expected to be contiguous.
+static Error readProfile(StringRef FileName, StringRef Buffer,
+                         MergedProfile &Profile) {
+  auto MakeError = [&](const Twine &Msg) {
+    return createStringError(inconvertibleErrorCode(),
+                             FileName + ": " + Msg);
+  };
+
+  // The last cumulative record of the current run. Every such record
+  // supersedes the previous ones, so it's only merged once the run is over.
+  std::optional<RecordCounters> LastCumulative;
+  auto FinishRun = [&]() {
+    if (LastCumulative)
+      for (auto &[Name, Count] : *LastCumulative)
+        Profile.Counters[Name] += Count;
+    LastCumulative.reset();
+  };
+
+  while (!Buffer.empty()) {
+    if (Buffer.size() < dynamic_cc::ProfileHeaderSize)
+      return MakeError("truncated profile record");
+    if (!Buffer.startswith(dynamic_cc::ProfileMagic))
+      return MakeError("not a DynamicCallCounter profile");
+
+    const char *Data = Buffer.data();
+    uint32_t Version = endian::read32le(Data + 8);
+    uint32_t Flags = endian::read32le(Data + 12);
+    uint64_t NumCounters = endian::read64le(Data + 16);
+    uint64_t NamesSize = endian::read64le(Data + 24);
+    if (Version != dynamic_cc::ProfileVersion)
+      return MakeError("unsupported profile version " + Twine(Version));
+
+    // Check the sizes one at a time so that the sum cannot overflow
+    uint64_t Available = Buffer.size() - dynamic_cc::ProfileHeaderSize;
+    if (NamesSize > Available ||
+        NumCounters > (Available - NamesSize) / sizeof(uint64_t))
+      return MakeError("truncated profile record");
+    uint64_t RecordSize = dynamic_cc::ProfileHeaderSize + NamesSize +
+                          NumCounters * sizeof(uint64_t);
+
+    uint32_t Kind = Flags & dynamic_cc::ProfileFlagBlocks;
+    if (!Profile.Flags)
+      Profile.Flags = Kind;
+    else if (*Profile.Flags != Kind)
+      return MakeError("cannot merge profiles of function calls and of basic "
+                       "block executions");
+
+    RecordCounters Record;
+    StringRef Names = Buffer.substr(dynamic_cc::ProfileHeaderSize, NamesSize);
+    const char *Counters = Data + dynamic_cc::ProfileHeaderSize + NamesSize;
+    for (uint64_t Idx = 0; Idx < NumCounters; Idx++) {
+      size_t NameEnd = Names.find('\0');
+      if (NameEnd == StringRef::npos)
+        return MakeError("corrupted name table");
+
+      Record.emplace_back(Names.take_front(NameEnd).str(),
+                          endian::read64le(Counters + Idx * sizeof(uint64_t)));
+      Names = Names.drop_front(NameEnd + 1);
+    }
+
+    if (Flags & dynamic_cc::ProfileFlagRunStart)
+      FinishRun();
+    if (Flags & dynamic_cc::ProfileFlagDelta) {
+      for (auto &[Name, Count] : Record)
+        Profile.Counters[Name] += Count;
+    } else {
+      LastCumulative = std::move(Record);
+    }
+
+    Buffer = Buffer.drop_front(RecordSize);
+  }
+
+  FinishRun();
+  return Error::success();
+}
+
+// Writes Profile as a single record (see DynamicCallCounter.h), i.e. as if it
+// was a single run
+static void writeProfile(raw_ostream &OS, const MergedProfile &Profile) {
+  std::string NameTable;
+  for (auto &Entry : Profile.Counters) {
+    NameTable += Entry.first;
+    NameTable.push_back('\0');
+  }
+  NameTable.resize(alignTo(NameTable.size(), 8), '\0');
+
+  OS << dynamic_cc::ProfileMagic;
+  endian::write<uint32_t>(OS, dynamic_cc::ProfileVersion, little);
+  endian::write<uint32_t>(
+      OS, Profile.Flags.value_or(0) | dynamic_cc::ProfileFlagRunStart, little);
+  endian::write<uint64_t>(OS, Profile.Counters.size(), little);
+  endian::write<uint64_t>(OS, NameTable.size(), little);
+  OS << NameTable;
+  for (auto &Entry : Profile.Counters)
+    endian::write<uint64_t>(OS, Entry.second, little);
+}
+
+// Prints Profile in the same format as the text output of DynamicCallCounter
+static void printProfile(raw_ostream &OS, const MergedProfile &Profile) {
+  OS << "=================================================\n";
+  OS << "LLVM-TUTOR: dynamic analysis results\n";
+  OS << "=================================================\n";
+  const char *Str1 = "NAME";
+  const char *Str2 =
+      Profile.Flags.value_or(0) & dynamic_cc::ProfileFlagBlocks
+          ? "#N EXECUTIONS"
+          : "#N DIRECT CALLS";
+  OS << format("%-20s %-10s\n", Str1, Str2);
+  OS << "-------------------------------------------------\n";
+
+  for (auto &Entry : Profile.Counters)
+    OS << format("%-20s %-10" PRIu64 "\n", Entry.first.c_str(), Entry.second);
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(MergeCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Merges profiles generated by modules "
+                              "instrumented with DynamicCallCounter\n");
+
+  MergedProfile Profile;
+  for (const std::string &FileName : InputProfiles) {
+    auto BufferOrErr = MemoryBuffer::getFile(FileName);
+    if (!BufferOrErr) {
+      errs() << "Error reading profile file " << FileName << ": "
+             << BufferOrErr.getError().message() << "\n";
+      return -1;
+    }
+
+    if (Error Err =
+            readProfile(FileName, (*BufferOrErr)->getBuffer(), Profile)) {
+      errs() << "Error: " << toString(std::move(Err)) << "\n";
+      return -1;
+    }
+  }
+
+  if (!OutputProfile.empty()) {
+    std::error_code EC;
+    ToolOutputFile Out(OutputProfile, EC, sys::fs::OF_None);
+    if (EC) {
+      errs() << "Error opening " << OutputProfile << ": " << EC.message()
+             << "\n";
+      return -1;
+    }
+    writeProfile(Out.os(), Profile);
+    Out.keep();
+    return 0;
+  }
+
+  printProfile(outs(), Profile);
+  return 0;
+}
@@ -4,23 +4,64 @@
 //
 // DESCRIPTION:
 //    A command-line tool that counts all static calls (i.e. calls as seen
-//    in the source code) in the input LLVM file. Internally it uses the
+//    in the source code) in the input LLVM files. Internally it uses the
 //    StaticCallCounter pass.
 //
+//    The input files are analysed in parallel (on a thread pool, every module
+//    is loaded into its own LLVMContext) and the results are merged into one
+//    report. Functions from different modules are matched by name.
+//
+//    With -lazy, bitcode files are loaded lazily: function bodies are
+//    materialized (and analysed) one at a time and freed straight after. This
+//    way, the memory usage is bounded by the size of the largest function
+//    rather than the size of the whole module (textual IR files are always
+//    parsed in full).
+//
+//    With -static-cc-cache-dir, the results for every input file are cached
+//    (keyed by a hash of the file contents). Unchanged files are then not even
+//    parsed. Least recently used entries are evicted once the cache exceeds
+//    -static-cc-cache-limit. The cache lives in this tool rather than in the
+//    StaticCallCounter plugin: within `opt`, the module is already parsed, and
+//    hashing it costs more than the analysis itself.
+//
+//    With -opcode-histogram, the tool prints the opcode histogram summed over
+//    all input modules (see OpcodeHistogram) instead. The modules are
+//    analysed in parallel (-j), the functions within every module serially.
+//    The cache is not used in this mode.
+//
 // USAGE:
 //    # First, generate an LLVM file:
 //      clang -emit-llvm <input-file> -c -o <output-llvm-file>
 //    # Now you can run this tool as follows:
-//      <BUILD/DIR>/bin/static <output-llvm-file>
+//      <BUILD/DIR>/bin/static <output-llvm-file> [<more-llvm-files>...]
+//    # Alternatively, you can list the input files in a file (one per line):
+//      <BUILD/DIR>/bin/static -input-list=<file> [-j=<threads>]
+//    # To reduce the memory usage for large bitcode files:
+//      <BUILD/DIR>/bin/static -lazy <output-llvm-file>
+//    # To reuse the results for unchanged files:
+//      <BUILD/DIR>/bin/static -static-cc-cache-dir=<dir> <output-llvm-file>
+//    # To print the results as JSON lines (or CSV):
+//      <BUILD/DIR>/bin/static -static-cc-format=jsonl <output-llvm-file>
+//    # To print the opcode histogram for all input files instead:
+//      <BUILD/DIR>/bin/static -opcode-histogram <output-llvm-file> [...]
 //
 // License: MIT
 //========================================================================
+#include "OpcodeCounter.h"
 #include "StaticCallCounter.h"
 
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CachePruning.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
@@ -30,21 +71,206 @@ using namespace llvm;
 //===----------------------------------------------------------------------===//
 static cl::OptionCategory CallCounterCategory{"call counter options"};
 
-static cl::opt<std::string> InputModule{cl::Positional,
-                                        cl::desc{"<Module to analyze>"},
-                                        cl::value_desc{"bitcode filename"},
-                                        cl::init(""),
-                                        cl::Required,
-                                        cl::cat{CallCounterCategory}};
+static cl::list<std::string> InputModules{cl::Positional,
+                                          cl::desc{"<Modules to analyze>"},
+                                          cl::value_desc{"bitcode filenames"},
+                                          cl::ZeroOrMore,
+                                          cl::cat{CallCounterCategory}};
+
+static cl::opt<std::string> InputList{
+    "input-list",
+    cl::desc{"A file with the names of the modules to analyze (one per line)"},
+    cl::value_desc{"filename"}, cl::init(""), cl::cat{CallCounterCategory}};
+
+static cl::opt<unsigned> NumThreads{
+    "j",
+    cl::desc{"The number of modules to analyze in parallel (0 means one per "
+             "hardware thread)"},
+    cl::value_desc{"threads"}, cl::init(0), cl::cat{CallCounterCategory}};
+
+static cl::opt<bool> OpcodeHistogramMode{
+    "opcode-histogram",
+    cl::desc{"Print a histogram of the opcodes used in the input modules "
+             "(instead of the number of static calls)"},
+    cl::init(false), cl::cat{CallCounterCategory}};
+
+static cl::opt<bool> LazyLoading{
+    "lazy",
+    cl::desc{"Load bitcode lazily and analyze one function body at a time"},
+    cl::init(false), cl::cat{CallCounterCategory}};
+
+static cl::opt<std::string> CacheDir{
+    "static-cc-cache-dir",
+    cl::desc{"Cache the results of StaticCallCounter in this directory"},
+    cl::value_desc{"directory"}, cl::init(""), cl::cat{CallCounterCategory}};
+
+static cl::opt<uint64_t> CacheLimit{
+    "static-cc-cache-limit",
+    cl::desc{"The maximum size of the StaticCallCounter cache (least recently "
+             "used entries are evicted first, 0 means no limit)"},
+    cl::value_desc{"bytes"}, cl::init(64 * 1024 * 1024),
+    cl::cat{CallCounterCategory}};
+
+// Bump whenever the results (or their format) change so that stale cache
+// entries are never used. Note that CachePruning only considers files that
+// start with "llvmcache-".
+static constexpr char CacheEntryPrefix[] = "llvmcache-static-cc-v1-";
+
+//===----------------------------------------------------------------------===//
+// On-disk cache of the StaticCallCounter results
+//===----------------------------------------------------------------------===//
+// Every cache entry is a file with one line per function:
+//    <number of calls> <length of the name> <name>\n
+// (names are length-prefixed, so they can contain any characters)
+static std::string getCacheEntryPath(StringRef Key) {
+  SmallString<128> Path(CacheDir);
+  sys::path::append(Path, CacheEntryPrefix + Key);
+  return std::string(Path);
+}
+
+static bool parseCacheEntry(StringRef Entry, NamedResultStaticCC &Res) {
+  NamedResultStaticCC Parsed;
+  while (!Entry.empty()) {
+    unsigned Count = 0;
+    size_t NameLength = 0;
+    if (Entry.consumeInteger(10, Count) || !Entry.consume_front(" ") ||
+        Entry.consumeInteger(10, NameLength) || !Entry.consume_front(" ") ||
+        Entry.size() < NameLength + 1 || Entry[NameLength] != '\n')
+      return false;
+    Parsed[Entry.take_front(NameLength).str()] += Count;
+    Entry = Entry.drop_front(NameLength + 1);
+  }
+
+  Res = std::move(Parsed);
+  return true;
+}
+
+static bool isStaticCCCacheEnabled() { return !CacheDir.empty(); }
+
+// Returns the cache key for a module with the given contents (i.e. the input
+// file)
+static std::string getStaticCCCacheKey(StringRef ModuleContents) {
+  return toHex(SHA1::hash(arrayRefFromStringRef(ModuleContents)),
+               /*LowerCase=*/true);
+}
+
+// Reads the results cached under Key into Res. Returns false on a cache miss.
+static bool lookupStaticCCCache(StringRef Key, NamedResultStaticCC &Res) {
+  std::string Path = getCacheEntryPath(Key);
+  int FD = -1;
+  if (sys::fs::openFileForRead(Path, FD))
+    return false;
+
+  auto EntryOrErr = MemoryBuffer::getOpenFile(
+      sys::fs::convertFDToNativeFile(FD), Path, /*FileSize=*/-1);
+  // Mark the entry as recently used (for pruneStaticCCCache)
+  sys::fs::setLastAccessAndModificationTime(FD,
+                                            std::chrono::system_clock::now());
+  sys::Process::SafelyCloseFileDescriptor(FD);
+
+  return EntryOrErr && parseCacheEntry((*EntryOrErr)->getBuffer(), Res);
+}
+
+// Caches Res under Key (errors are ignored)
+static void storeStaticCCCache(StringRef Key, const NamedResultStaticCC &Res) {
+  if (sys::fs::create_directories(CacheDir))
+    return;
+
+  // Write to a temporary file first and then rename it, so that other
+  // processes/threads never see partially written entries
+  SmallString<128> TempPattern(CacheDir);
+  sys::path::append(TempPattern, "static-cc-tmp-%%%%%%%%");
+  Expected<sys::fs::TempFile> Temp = sys::fs::TempFile::create(TempPattern);
+  if (!Temp) {
+    consumeError(Temp.takeError());
+    return;
+  }
+
+  {
+    raw_fd_ostream OS(Temp->FD, /*shouldClose=*/false);
+    for (auto &CallCount : Res)
+      OS << CallCount.second << " " << CallCount.first.size() << " "
+         << CallCount.first << "\n";
+  }
+
+  // Failing to store the entry is not an error (it's just a cache)
+  consumeError(Temp->keep(getCacheEntryPath(Key)));
+}
+
+// Evicts the least recently used entries until the size of the cache is
+// below -static-cc-cache-limit
+static void pruneStaticCCCache() {
+  if (!isStaticCCCacheEnabled())
+    return;
+
+  CachePruningPolicy Policy;
+  // Prune on every call, based on the size only
+  Policy.Interval = std::chrono::seconds(0);
+  Policy.Expiration = std::chrono::seconds(0);
+  Policy.MaxSizeBytes = CacheLimit;
+  pruneCache(CacheDir, Policy);
+}
 
 //===----------------------------------------------------------------------===//
 // static - implementation
 //===----------------------------------------------------------------------===//
-static void countStaticCalls(Module &M) {
-  // Create a module pass manager and add StaticCallCounterPrinter to it.
-  ModulePassManager MPM;
-  MPM.addPass(StaticCallCounterPrinter(llvm::errs()));
+// Reads FileName into memory. On failure, returns null and sets ErrMsg.
+static std::unique_ptr<MemoryBuffer> readInputFile(StringRef FileName,
+                                                   std::string &ErrMsg) {
+  auto BufferOrErr = MemoryBuffer::getFileOrSTDIN(FileName);
+  if (!BufferOrErr) {
+    ErrMsg = "Error reading bitcode file: " + FileName.str() + "\n" +
+             BufferOrErr.getError().message() + "\n";
+    return nullptr;
+  }
+  return std::move(*BufferOrErr);
+}
+
+// Parses the module in Buffer (lazily with -lazy) into Ctx. On failure,
+// returns null and sets ErrMsg.
+static std::unique_ptr<Module>
+parseInputModule(std::unique_ptr<MemoryBuffer> Buffer, LLVMContext &Ctx,
+                 std::string &ErrMsg) {
+  std::string FileName = Buffer->getBufferIdentifier().str();
+
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M =
+      LazyLoading ? getLazyIRModule(std::move(Buffer), Err, Ctx)
+                  : parseIR(Buffer->getMemBufferRef(), Err, Ctx);
+
+  if (!M) {
+    raw_string_ostream ErrOS(ErrMsg);
+    ErrOS << "Error reading bitcode file: " << FileName << "\n";
+    Err.print("static", ErrOS);
+  }
+  return M;
+}
+
+// Calls Visit for every function defined in the lazily loaded module M. Every
+// function body is materialized right before, and deleted right after, it's
+// visited. On failure, returns false and sets ErrMsg.
+static bool visitFunctionsLazily(Module &M,
+                                 function_ref<void(Function &)> Visit,
+                                 std::string &ErrMsg) {
+  for (Function &F : M) {
+    if (Error Err = F.materialize()) {
+      ErrMsg = "Error materializing " + M.getModuleIdentifier() + ": " +
+               toString(std::move(Err)) + "\n";
+      return false;
+    }
+    if (F.isDeclaration())
+      continue;
 
+    Visit(F);
+    // Free the body. F becomes a declaration, so the results can still refer
+    // to it
+    F.deleteBody();
+  }
+
+  return true;
+}
+
+static ResultStaticCC countStaticCalls(Module &M) {
   // Create an analysis manager and register StaticCallCounter with it.
   ModuleAnalysisManager MAM;
   MAM.registerPass([&] { return StaticCallCounter(); });
@@ -56,8 +282,126 @@ static void countStaticCalls(Module &M) {
   PassBuilder PB;
   PB.registerModuleAnalyses(MAM);
 
-  // Finally, run the passes registered with MPM
-  MPM.run(M, MAM);
+  // Finally, run the analysis
+  return MAM.getResult<StaticCallCounter>(M);
+}
+
+// Counts the static calls in the module stored in FileName. On failure,
+// returns false and sets ErrMsg.
+static bool countStaticCalls(StringRef FileName, NamedResultStaticCC &Res,
+                             std::string &ErrMsg) {
+  std::unique_ptr<MemoryBuffer> Buffer = readInputFile(FileName, ErrMsg);
+  if (!Buffer)
+    return false;
+
+  // Try the cache first
+  std::string CacheKey;
+  if (isStaticCCCacheEnabled()) {
+    CacheKey = getStaticCCCacheKey(Buffer->getBuffer());
+    if (lookupStaticCCCache(CacheKey, Res))
+      return true;
+  }
+
+  // Every module gets its own context, so that it can be analysed (and
+  // freed) independently of the others
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseInputModule(std::move(Buffer), Ctx, ErrMsg);
+  if (!M)
+    return false;
+
+  if (!LazyLoading) {
+    // The result refers to the IR objects in Ctx, so keep the names only
+    Res = getNamedResult(countStaticCalls(*M));
+  } else {
+    ResultStaticCC DirectCalls;
+    if (!visitFunctionsLazily(
+            *M,
+            [&](Function &F) {
+              StaticCallCounter::runOnFunction(F, DirectCalls);
+            },
+            ErrMsg))
+      return false;
+    Res = getNamedResult(DirectCalls);
+  }
+
+  if (isStaticCCCacheEnabled())
+    storeStaticCCCache(CacheKey, Res);
+  return true;
+}
+
+// Computes the opcode histogram for the module stored in FileName. On
+// failure, returns false and sets ErrMsg.
+static bool countOpcodes(StringRef FileName, ResultOpcodeCounter &Res,
+                         std::string &ErrMsg) {
+  std::unique_ptr<MemoryBuffer> Buffer = readInputFile(FileName, ErrMsg);
+  if (!Buffer)
+    return false;
+
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseInputModule(std::move(Buffer), Ctx, ErrMsg);
+  if (!M)
+    return false;
+
+  // This already runs on one of the -j worker threads, so the functions are
+  // analysed serially (rather than on yet another thread pool per module)
+  if (!LazyLoading) {
+    Res = OpcodeHistogram::computeHistogram(*M, /*NumThreads=*/1);
+    return true;
+  }
+
+  Res = {};
+  return visitFunctionsLazily(
+      *M, [&](Function &F) { OpcodeCounter::countOpcodes(F, Res); }, ErrMsg);
+}
+
+// Analyses the input modules in parallel (on a thread pool). Every module
+// gets its own slot in Results, so that these can be merged in a
+// deterministic order. Returns false (after printing the errors in the order
+// of the input files) if any of the modules could not be analysed.
+template <typename ResultT>
+static bool analyzeInputs(const std::vector<std::string> &Inputs,
+                          std::vector<ResultT> &Results,
+                          bool (*Analyze)(StringRef, ResultT &,
+                                          std::string &)) {
+  Results.resize(Inputs.size());
+  std::vector<std::string> Errors(Inputs.size());
+  std::vector<char> Succeeded(Inputs.size(), false);
+  {
+    ThreadPool Pool(hardware_concurrency(NumThreads));
+    for (size_t Idx = 0; Idx < Inputs.size(); Idx++)
+      Pool.async([&, Idx] {
+        Succeeded[Idx] = Analyze(Inputs[Idx], Results[Idx], Errors[Idx]);
+      });
+    Pool.wait();
+  }
+
+  bool Failed = false;
+  for (size_t Idx = 0; Idx < Inputs.size(); Idx++) {
+    if (!Succeeded[Idx]) {
+      errs() << Errors[Idx];
+      Failed = true;
+    }
+  }
+  return !Failed;
+}
+
+// Appends the names of the modules listed in FileName to Inputs
+static bool readInputList(StringRef FileName,
+                          std::vector<std::string> &Inputs) {
+  auto BufferOrErr = MemoryBuffer::getFile(FileName);
+  if (!BufferOrErr) {
+    errs() << "Error reading input list " << FileName << ": "
+           << BufferOrErr.getError().message() << "\n";
+    return false;
+  }
+
+  SmallVector<StringRef, 16> Lines;
+  (*BufferOrErr)->getBuffer().split(Lines, '\n', /*MaxSplit=*/-1,
+                                    /*KeepEmpty=*/false);
+  for (StringRef Line : Lines)
+    if (!Line.trim().empty())
+      Inputs.push_back(Line.trim().str());
+  return true;
 }
 
 //===----------------------------------------------------------------------===//
@@ -65,29 +409,54 @@ static void countStaticCalls(Module &M) {
 //===----------------------------------------------------------------------===//
 int main(int Argc, char **Argv) {
   // Hide all options apart from the ones specific to this tool
-  cl::HideUnrelatedOptions(CallCounterCategory);
+  cl::HideUnrelatedOptions(
+      {&CallCounterCategory, &StaticCCCategory, &OpcodeCounterCategory});
 
   cl::ParseCommandLineOptions(Argc, Argv,
                               "Counts the number of static function "
-                              "calls in the input IR file\n");
+                              "calls in the input IR files\n");
 
   // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
   //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
   llvm_shutdown_obj SDO;
 
-  // Parse the IR file passed on the command line.
-  SMDiagnostic Err;
-  LLVMContext Ctx;
-  std::unique_ptr<Module> M = parseIRFile(InputModule.getValue(), Err, Ctx);
+  std::vector<std::string> Inputs(InputModules.begin(), InputModules.end());
+  if (!InputList.empty() && !readInputList(InputList, Inputs))
+    return -1;
 
-  if (!M) {
-    errs() << "Error reading bitcode file: " << InputModule << "\n";
-    Err.print(Argv[0], errs());
+  if (Inputs.empty()) {
+    errs() << "No input files (pass the modules to analyze on the command "
+              "line or via -input-list)\n";
     return -1;
   }
 
-  // Run the analysis and print the results
-  countStaticCalls(*M);
+  if (OpcodeHistogramMode) {
+    std::vector<ResultOpcodeCounter> Results;
+    if (!analyzeInputs(Inputs, Results, countOpcodes))
+      return -1;
+
+    // Merge the results and print them
+    ResultOpcodeCounter Merged{};
+    for (auto &Histogram : Results)
+      mergeOpcodeCounts(Merged, Histogram);
+    printOpcodeHistogram(errs(), Merged);
+    return 0;
+  }
+
+  std::vector<NamedResultStaticCC> Results;
+  bool Succeeded = analyzeInputs(Inputs, Results, countStaticCalls);
+
+  // Evict stale cache entries (once all the new ones have been stored)
+  pruneStaticCCCache();
+
+  if (!Succeeded)
+    return -1;
+
+  // Merge the results (in the order of the input files) and print them
+  NamedResultStaticCC Merged;
+  for (auto &Res : Results)
+    mergeStaticCCResults(Merged, Res);
+  printStaticCCResult(errs(), Merged);
 
   return 0;
 }